@@ -2,9 +2,268 @@
  * @brief 各種定義
  * @note
  */
-#define NULL ((void *)0) // ヌルポインタ
-#define STACK_SIZE 8149  // スタックサイズ
-#define THREAD_MAX_NUM 8 // スレッドの最大数
+#define NULL ((void *)0)                                     // ヌルポインタ
+#define STACK_SIZE 8149                                      // スタックサイズ (ブート処理)
+#define PAGE_SIZE 4096                                       // ページサイズ
+#define PAGE_ORDER_NUM 11                                    // ページ割り当ての次数の段階数 (最大 2^10 ページ = 4MB)
+#define PAGE_INFO_FREE 0x80                                  // ページごとの情報 : 空きブロックの先頭ページ
+#define PAGE_INFO_SLAB 0x40                                  // ページごとの情報 : kmallocのスラブのページ (下位ビットはサイズクラス)
+#define MEGAPAGE_SIZE (4 * 1024 * 1024)                      // メガページのサイズ (Sv32の1段目のリーフ)
+#define THREAD_STACK_PAGES 2                                 // スレッドのスタックのページ数
+#define THREAD_STACK_SIZE (THREAD_STACK_PAGES * PAGE_SIZE)   // スレッドのスタックサイズ
+#define THREAD_PRIORITY_NUM 8                                // スレッドの優先度の段階数 (0が最高優先度)
+#define THREAD_PRIORITY_DEFAULT 4                            // スレッドの優先度の初期値
+#define HART_MAX 8                                           // 管理できるハートの数 (ハートIDは0〜HART_MAX-1)
+#define HART_STACK_PAGES 2                                   // ブートしたハート以外のハートのスタックのページ数
+#define HART_STOP_TIMEOUT_MS 100                             // 初期化に失敗したハートの停止を待つ時間(ms)
+#define READY_QUEUE_PAGES 2                                  // 実行可能キュー(優先度ごと・ハートごと)のページ数
+#define READY_QUEUE_SIZE (READY_QUEUE_PAGES * PAGE_SIZE / 4) // 実行可能キューに入るスレッドの数
+#define KMALLOC_CLASS_NUM 14                                 // kmallocのサイズクラスの数
+#define KMALLOC_MAX_SIZE 2048                                // kmallocのサイズクラスの最大 (これより大きい領域はページ単位で割り当てる)
+#define KMALLOC_MAGAZINE_SIZE 16                             // kmallocのハートごとのマガジンに置けるオブジェクトの数
+/**
+ * @brief スレッドのスタック領域の定義
+ * @note スタック領域を2のべき乗のサイズの枠に分け、各枠の上端にスタック、下側にガードページを置く
+ */
+#define THREAD_STACK_AREA 0xc0000000                                                  // スレッドのスタック領域の仮想アドレス (RAM・MMIOと重ならない)
+#define THREAD_STACK_AREA_SHIFT 25                                                    // スレッドのスタック領域のサイズ (2^25 = 32MB)
+#define THREAD_STACK_SLOT_SHIFT 14                                                    // スレッドごとのスタック枠のサイズ (2^14 = 16KB)
+#define THREAD_STACK_SLOTS (1 << (THREAD_STACK_AREA_SHIFT - THREAD_STACK_SLOT_SHIFT)) // スタック枠の数
+#define THREAD_STACK_SLOT_PAGES (1 << (THREAD_STACK_SLOT_SHIFT - 12))                 // スタック枠のページ数
+#define THREAD_STACK_GUARD_PAGES (THREAD_STACK_SLOT_PAGES - THREAD_STACK_PAGES)       // スタック枠の下側のガードページの数 (1以上)
+#define THREAD_STACK_CACHED_SLOTS 64                                                  // 物理ページを対応付けたまま空きリストに置く枠の上限
+#define STACK_PAINT 0x5a5a5a5a                                                        // スタックの未使用部分に書き込んでおく値 (使用量の確認用)
+/**
+ * @brief ユーザーモードのプロセスの定義
+ * @note プロセスのアドレス空間のうち、カーネルの対応付け(RAM・MMIO・スレッドのスタック領域)と重ならない下位の領域をユーザー領域とする
+ *       プログラムはリンカスクリプトの__user_baseから、スタックはユーザー領域の末尾から下へ置く
+ *       ヒープ(sbrk)・無名の対応付け(mmap)・スタックは領域だけを予約し、ページは最初のアクセスのページフォルトで割り当てる
+ *       [__user_base, USER_HEAP_BASE) : プログラム
+ *       [USER_HEAP_BASE, USER_MMAP_BASE) : ヒープ
+ *       [USER_MMAP_BASE, スタックの下限) : 無名の対応付け
+ *       [USER_END - USER_STACK_MAX_PAGES * PAGE_SIZE, USER_END) : スタック
+ */
+#define USER_END 0x08000000                                  // ユーザー領域の末尾 (PLICより下)
+#define USER_STACK_PAGES 1                                   // 作成時に対応付けるスタックのページ数 (引数を置く)
+#define USER_STACK_MAX_PAGES 256                             // スタックを伸ばせる最大のページ数 (1MB)
+#define USER_HEAP_BASE 0x01000000                            // ユーザー領域のヒープの先頭
+#define USER_MMAP_BASE 0x04000000                            // ユーザー領域の無名の対応付けの先頭
+#define USER_MMAP_MAX 8                                      // プロセスごとの無名の対応付けの領域の最大数
+#define USER_TEXT __attribute__((section(".user.text")))     // ユーザーモードで実行する関数 (カーネルから呼び出さないこと)
+#define USER_RODATA __attribute__((section(".user.rodata"))) // ユーザーモードで参照する定数
+#define SYSCALL_WRITE_CHUNK 64                               // writeでユーザー領域から一度に複写するバイト数
+/**
+ * @brief システムコール番号 (a7レジスタで指定し、引数はa0〜a2、戻り値はa0)
+ * @note SYS_FAST_NUM未満の番号は、全レジスタのトラップフレームを作らずに処理する(高速パス)
+ *       高速パスではt0〜t6・a1〜a7を0にして戻るため、呼び出し側はこれらのレジスタを壊れるものとして扱う
+ */
+#define SYS_GETPID 0              // プロセスIDの取得 (高速パス)
+#define SYS_YIELD 1               // CPUを譲る (高速パス)
+#define SYS_WRITE 2               // コンソールへの書き込み (高速パス)
+#define SYS_FAST_NUM 3            // 高速パスで処理するシステムコールの数
+#define SYS_EXIT 3                // プロセスの終了
+#define SYS_NULL 4                // 何もしない (通常のパスの計測用)
+#define SYS_FORK 5                // プロセスの複製 (親にはプロセスID、子には0を返す)
+#define SYS_EXEC 6                // 初期RAMディスクのプログラムの実行 (a0:ファイル名, a1:バイト数)
+#define SYS_WAIT 7                // 子プロセスが全て終了するまで待つ
+#define SYS_SBRK 8                // ヒープの伸縮 (a0:増減するバイト数、戻り値は元のヒープの末尾)
+#define SYS_MMAP 9                // 無名の対応付け (a0:バイト数, a1:MMAP_PROT_*、戻り値は先頭アドレス)
+#define SYS_MUNMAP 10             // 無名の対応付けの解除 (a0:mmapの戻り値, a1:バイト数)
+#define SYS_MEMINFO 11            // プロセスのメモリ使用量 (a0:0なら仮想、1なら実メモリのページ数)
+#define SYS_NUM 12                // システムコールの数
+#define MMAP_PROT_READ 1          // mmap : 読み込み可
+#define MMAP_PROT_WRITE 2         // mmap : 書き込み可
+#define SYSCALL_BENCH_COUNT 10000 // システムコールの性能計測で呼び出す回数
+#define FORK_BENCH_COUNT 20       // forkの性能計測の回数
+#define FORK_BENCH_HEAP_PAGES 256 // forkの性能計測のプロセスのヒープのページ数 (1MB)
+#define LAZY_BENCH_HEAP_PAGES 256 // 要求時のページ割り当ての計測でsbrkするページ数 (1MB)
+#define LAZY_BENCH_MMAP_PAGES 64  // 要求時のページ割り当ての計測でmmapするページ数
+#define LAZY_BENCH_STACK_DEPTH 32 // 要求時のページ割り当ての計測でスタックを伸ばす再帰の深さ (1KBずつ)
+#define ASID_BENCH_ROUNDS 2000    // プロセスのピンポンの計測で各プロセスがCPUを譲る回数
+#define ASID_BENCH_PAGES 16       // プロセスのピンポンの計測で1往復ごとに書き込むページ数
+/**
+ * @brief ELF(32ビット)の定義
+ * @note 初期RAMディスクに取り込んだユーザープログラムの読み込みで使用する
+ */
+#define ELF_MAGIC 0x464c457f // e_ident[0〜3] : "\x7fELF"
+#define ELF_CLASS32 1        // e_ident[4]    : 32ビット
+#define ELF_DATA2LSB 1       // e_ident[5]    : リトルエンディアン
+#define ELF_ET_EXEC 2        // e_type        : 実行ファイル
+#define ELF_EM_RISCV 243     // e_machine     : RISC-V
+#define ELF_PT_LOAD 1        // p_type        : メモリへ読み込むセグメント
+#define ELF_PF_X (1 << 0)    // p_flags       : 実行可
+#define ELF_PF_W (1 << 1)    // p_flags       : 書き込み可
+#define ELF_PF_R (1 << 2)    // p_flags       : 読み込み可
+#define ELF_ARG_MAX 64       // プログラムに渡す引数(プログラム名)の最大バイト数
+#define ELF_BENCH_COUNT 100  // ELFの読み込みの性能計測の回数
+/**
+ * @brief ページテーブル(Sv32)の定義
+ * @note ページテーブルエントリ(PTE)は、物理ページ番号(PPN)を10ビット目から、フラグを下位10ビットに持つ
+ */
+#define SATP_SV32 (1u << 31) // satp : Sv32のページングを有効化
+#define SATP_ASID_SHIFT 22   // satp : ASID(アドレス空間ID)の位置
+#define SATP_ASID_MASK 0x1ff // satp : ASIDのビット (Sv32は最大9ビット。実装されていないビットは0に読める)
+#define PAGE_V (1 << 0)      // PTE  : 有効
+#define PAGE_R (1 << 1)      // PTE  : 読み込み可
+#define PAGE_W (1 << 2)      // PTE  : 書き込み可
+#define PAGE_X (1 << 3)      // PTE  : 実行可
+#define PAGE_U (1 << 4)      // PTE  : ユーザーモードからアクセス可
+#define PAGE_A (1 << 6)      // PTE  : アクセス済み
+#define PAGE_D (1 << 7)      // PTE  : 書き込み済み
+#define PAGE_COW (1 << 8)    // PTE  : コピーオンライト (ソフトウェア用のRSWビット。書き込み不可にして共有し、書き込み時に複写する)
+/**
+ * @brief タイマー(タイムスライス)関連の定義
+ * @note QEMU(virt)のtimeレジスタは10MHzで加算される
+ */
+#define TIMER_FREQ_HZ 10000000                          // timeレジスタの周波数(Hz)
+#define TICKS_PER_MS (TIMER_FREQ_HZ / 1000)             // 1ms当たりのtick数
+#define TICKS_PER_US (TIMER_FREQ_HZ / 1000000)          // 1us当たりのtick数
+#define TIME_SLICE_MS 10                                // タイムスライス(クォンタム)の長さ(ms)
+#define TIME_SLICE_TICKS (TIME_SLICE_MS * TICKS_PER_MS) // タイムスライス(クォンタム)のtick数
+#define TIMER_NEVER 0xffffffffffffffffULL               // タイマーを設定しない時の時刻 (割り込みが発生しない)
+#define BUSY_THREAD_MS 100                              // 譲らないスレッドがCPUを占有する時間(ms)
+#define SWITCH_BENCH_YIELDS 100                         // 性能計測で各スレッドがCPUを譲る回数
+#define YIELD_BENCH_YIELDS 10000                        // yieldの性能計測で全スレッドがCPUを譲る回数の合計
+#define PAGE_BENCH_SLOTS 512                            // ページ割り当ての負荷試験で保持する領域の数
+#define PAGE_BENCH_ITERATIONS 100000                    // ページ割り当ての負荷試験の処理回数
+#define PAGE_BENCH_MAX_ORDER 6                          // ページ割り当ての負荷試験で割り当てる次数の上限(未満)
+#define PAGING_BENCH_SIZE (32 * 1024 * 1024)            // メガページの性能計測で走査する領域のサイズ
+#define PAGING_BENCH_PASSES 4                           // メガページの性能計測で走査する回数
+#define SMP_BENCH_THREADS 32                            // マルチコアの性能計測で作成するスレッドの数
+#define SMP_BENCH_WORK 1000000                          // マルチコアの性能計測で各スレッドが処理するループ回数
+#define LOCK_BENCH_MS 200                               // ロックの性能計測で各ハートがロックを取り続ける時間(ms)
+#define SLEEP_BENCH_THREADS 4                           // アイドルの計測で作成するスリープするスレッドの数
+#define SLEEP_BENCH_COUNT 20                            // アイドルの計測で各スレッドがスリープする回数
+#define SLEEP_BENCH_MS 50                               // アイドルの計測で各スレッドが1回にスリープする時間(ms)
+#define PC_BENCH_ITEMS 1000                             // 生産者・消費者の計測で受け渡すデータの数
+#define PC_BENCH_QUEUE_SIZE 8                           // 生産者・消費者の計測で使うキューの大きさ
+#define CHURN_BENCH_THREADS 4000                        // スレッドの作成・合流の計測で作成するスレッドの数
+#define CHURN_BENCH_BATCH 8                             // スレッドの作成・合流の計測でまとめて作成してから合流するスレッドの数
+#define KMALLOC_BENCH_PAIRS 10000                       // kmallocの性能計測でサイズクラスごとに割り当て・解放する回数
+#define KMALLOC_BENCH_OPS 100000                        // kmallocの負荷試験で各ハートが割り当て/解放する回数
+#define KMALLOC_BENCH_SLOTS 256                         // kmallocの負荷試験で各ハートが保持する領域の数
+#define MEM_BENCH_REPEAT 100                            // memset/memcpy/memmoveの性能計測で各サイズを処理する回数
+#define MEM_BENCH_MAX_SIZE 16384                        // memset/memcpy/memmoveの性能計測の最大バイト数
+/**
+ * @brief CSR(制御レジスタ)のビット定義
+ * @note トラップ・割り込みの制御で使用する
+ */
+#define SSTATUS_SIE (1 << 1)                // sstatus : Sモードの割り込み許可
+#define SSTATUS_SPIE (1 << 5)               // sstatus : トラップ発生前のSIE (sretでSIEへ戻される)
+#define SSTATUS_SPP (1 << 8)                // sstatus : トラップ発生前のモード (0ならユーザーモード、sretで戻るモード)
+#define SSTATUS_SUM (1 << 18)               // sstatus : Sモードからユーザーモード用のページへのアクセスを許可
+#define SSTATUS_FS (3 << 13)                // sstatus : 浮動小数点レジスタの状態 (Off/Initial/Clean/Dirty)
+#define SSTATUS_FS_INITIAL (1 << 13)        // sstatus : 浮動小数点レジスタは初期状態
+#define SSTATUS_FS_CLEAN (2 << 13)          // sstatus : 浮動小数点レジスタは保存した状態から変更なし
+#define SSTATUS_FS_DIRTY (3 << 13)          // sstatus : 浮動小数点レジスタが変更された
+#define SIE_SSIE (1 << 1)                   // sie     : Sモードのソフトウェア割り込み(IPI)許可
+#define SIE_STIE (1 << 5)                   // sie     : Sモードのタイマー割り込み許可
+#define SIP_SSIP (1 << 1)                   // sip     : Sモードのソフトウェア割り込み(IPI)保留
+#define SIE_SEIE (1 << 9)                   // sie     : Sモードの外部割り込み許可
+#define SCAUSE_INTERRUPT (1u << 31)         // scause  : 最上位ビットが1なら割り込み、0なら例外
+#define SCAUSE_S_SOFTWARE_INTERRUPT 1       // scause  : Sモードのソフトウェア割り込みの要因コード
+#define SCAUSE_S_TIMER_INTERRUPT 5          // scause  : Sモードのタイマー割り込みの要因コード
+#define SCAUSE_S_EXTERNAL_INTERRUPT 9       // scause  : Sモードの外部割り込みの要因コード
+#define SCAUSE_ILLEGAL_INSTRUCTION 2        // scause  : 不正命令例外の要因コード (FS=Offでの浮動小数点命令を含む)
+#define SCAUSE_BREAKPOINT 3                 // scause  : ブレークポイント例外の要因コード
+#define SCAUSE_ECALL_U 8                    // scause  : ユーザーモードからのecall(システムコール)の要因コード
+#define SCAUSE_LOAD_PAGE_FAULT 13           // scause  : ロードのページフォルトの要因コード
+#define SCAUSE_STORE_PAGE_FAULT 15          // scause  : ストアのページフォルトの要因コード
+#define SCOUNTEREN_CY_TM_IR 0x7             // scounteren : ユーザーモードからcycle/time/instretを読み込み可
+#define TRAP_CAUSE_NUM 16                   // トラップハンドラのテーブルに登録できる要因コードの数
+#define SBI_EXT_TIME 0x54494D45             // SBI Timer Extension ("TIME")
+#define SBI_TIME_SET_TIMER 0                // SBI Timer Extension : sbi_set_timer
+#define SBI_EXT_BASE 0x10                   // SBI Base Extension
+#define SBI_BASE_PROBE_EXTENSION 3          // SBI Base Extension : sbi_probe_extension
+#define SBI_EXT_DBCN 0x4442434E             // SBI Debug Console Extension ("DBCN")
+#define SBI_DBCN_CONSOLE_WRITE 0            // SBI Debug Console Extension : sbi_debug_console_write
+#define SBI_EXT_LEGACY_CONSOLE_PUTCHAR 0x01 // SBI Legacy Extension : sbi_console_putchar
+#define SBI_EXT_HSM 0x48534D                // SBI Hart State Management Extension ("HSM")
+#define SBI_HSM_HART_START 0                // SBI HSM Extension : sbi_hart_start
+#define SBI_HSM_HART_STOP 1                 // SBI HSM Extension : sbi_hart_stop
+#define SBI_HSM_HART_GET_STATUS 2           // SBI HSM Extension : sbi_hart_get_status
+#define SBI_HSM_STATE_STOPPED 1             // SBI HSM Extension : ハートが停止中
+#define SBI_EXT_IPI 0x735049                // SBI IPI Extension ("sPI")
+#define SBI_IPI_SEND_IPI 0                  // SBI IPI Extension : sbi_send_ipi
+#define SBI_EXT_RFENCE 0x52464E43           // SBI RFENCE Extension ("RFNC")
+#define SBI_RFENCE_REMOTE_SFENCE_VMA 1      // SBI RFENCE Extension : sbi_remote_sfence_vma
+/**
+ * @brief トラップ処理の性能計測の定義
+ * @note トラップの入口から出口までのサイクル数をこの値以内に収める
+ */
+#define TRAP_BENCH_COUNT 1000  // 計測回数
+#define TRAP_CYCLE_BUDGET 1000 // トラップ1回(入口〜出口)のサイクル数の上限
+/**
+ * @brief コンソール出力の定義
+ */
+#define CONSOLE_BUF_SIZE 256    // コンソール出力のリングバッファのサイズ
+#define CONSOLE_BENCH_LINES 20  // コンソール出力の性能計測で表示する行数
+#define FORMAT_BENCH_COUNT 1000 // 書式変換の性能計測の処理回数
+/**
+ * @brief プロファイル用の計測の定義
+ * @note コンパイル時に-DPROFILE_ENABLE=0を指定すると、計測処理を全て取り除く
+ */
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 1 // 1ならプロファイル用の計測を組み込む
+#endif
+#define PROFILE_HIST_NUM 16   // プロファイル用のカウンタのヒストグラムのバケット数
+#define PROFILE_DUMP_KEY 0x10 // プロファイル用のカウンタを表示する入力文字 (Ctrl-P)
+/**
+ * @brief 起動時の性能計測の定義
+ * @note コンパイル時に-DBENCHMARK_ENABLE=1を指定すると、起動時に性能計測を全て実行する (run.shで指定する)
+ */
+#ifndef BENCHMARK_ENABLE
+#define BENCHMARK_ENABLE 0 // 1なら起動時に性能計測を実行する
+#endif
+/**
+ * @brief UART(NS16550A)の定義
+ * @note QEMU(virt)ではUARTが0x10000000に配置され、PLICの割り込み番号10に接続されている
+ */
+#define UART_BASE 0x10000000   // UARTのレジスタの先頭アドレス
+#define UART_IRQ 10            // UARTの割り込み番号 (PLIC)
+#define UART_RBR 0             // 受信バッファレジスタ (読み込み)
+#define UART_THR 0             // 送信保持レジスタ (書き込み)
+#define UART_IER 1             // 割り込み許可レジスタ
+#define UART_FCR 2             // FIFO制御レジスタ (書き込み)
+#define UART_LCR 3             // ライン制御レジスタ
+#define UART_MCR 4             // モデム制御レジスタ
+#define UART_LSR 5             // ラインステータスレジスタ
+#define UART_IER_RDI (1 << 0)  // IER : 受信データ割り込み許可
+#define UART_IER_THRI (1 << 1) // IER : 送信保持レジスタ空き割り込み許可
+#define UART_FCR_ENABLE 0x07   // FCR : FIFOを有効化し、送受信のFIFOをクリア
+#define UART_LCR_8N1 0x03      // LCR : データ8ビット・パリティなし・ストップ1ビット
+#define UART_MCR_OUT2 (1 << 3) // MCR : 割り込み出力の有効化
+#define UART_LSR_DR (1 << 0)   // LSR : 受信データあり
+#define UART_LSR_THRE (1 << 5) // LSR : 送信FIFOが空
+#define UART_LSR_TEMT (1 << 6) // LSR : 送信FIFO・シフトレジスタが共に空 (送信完了)
+#define UART_FIFO_SIZE 16      // 送信FIFOの段数
+#define UART_TX_BUF_SIZE 4096  // 送信のリングバッファのサイズ
+#define UART_RX_BUF_SIZE 256   // 受信のリングバッファのサイズ
+#define UART_BENCH_BYTES 8192  // UARTの性能計測で送信するバイト数
+/**
+ * @brief PLIC(Platform-Level Interrupt Controller)の定義
+ * @note QEMU(virt)ではハートごとにMモード(コンテキスト2n)とSモード(コンテキスト2n+1)のコンテキストを持つ
+ */
+#define PLIC_BASE 0x0c000000                                          // PLICのレジスタの先頭アドレス
+#define PLIC_SIZE (4 * 1024 * 1024)                                   // カーネルのページテーブルにマップするPLICの領域のサイズ
+#define PLIC_PRIORITY(irq) (PLIC_BASE + 4 * (irq))                    // 割り込み番号ごとの優先度
+#define PLIC_SENABLE(hart) (PLIC_BASE + 0x2080 + 0x100 * (hart))      // Sモードのコンテキストの割り込み許可
+#define PLIC_SPRIORITY(hart) (PLIC_BASE + 0x201000 + 0x2000 * (hart)) // Sモードのコンテキストの優先度の閾値
+#define PLIC_SCLAIM(hart) (PLIC_BASE + 0x201004 + 0x2000 * (hart))    // Sモードのコンテキストの割り込みの取得・完了通知
+/**
+ * @brief プロトタイプ宣言
+ * @note トラップハンドラからスケジューラを呼び出すために先に宣言しておく
+ */
+struct trap_frame;
+void schedule_threads(void);
+void handle_timer_interrupt(struct trap_frame *tf);
+struct hart *this_hart(void);
+struct thread *current_thread(void);
+void drain_inbox(struct hart *hart);
+void handle_user_fault(struct trap_frame *tf);
+void handle_fpu_disabled(struct trap_frame *tf);
+struct wait_queue;
+struct thread *wait_queue_wake_one(struct wait_queue *wq);
 /**
  * @brief SBI(Supervisor Binary Interface)の戻り値
  * @note スーパーバイザ (S モード OS) とスーパーバイザ間のシステム コール形式の呼び出し規則
@@ -21,19 +280,21 @@ struct sbiret
  * @param arg0  : 引数
  * @param arg1  : 引数
  * @param arg2  : 引数
+ * @param arg3  : 引数
  * @details Supervisor Execution Environment(SEE)としてEALL関数を呼び出す
  * @note ECALLは、スーパーバイザとSEE間の制御転送命令として使用するもの
  */
-struct sbiret sbi_call(long eid, long fid, long arg0, long arg1, long arg2)
+struct sbiret sbi_call(long eid, long fid, long arg0, long arg1, long arg2, long arg3)
 {
     // SBIのバイナリエンコーディング
     // バイナリエンコードとは、アセンブリからバイナリへの変換プロセスを指す
     // 本関数により、SBIコマンドやSモードの命令をバイナリ形式でエンコードし、RISC-Vにより実行
     // CALL仕様に基づいてレジスタに設定
-    // a0〜a5レジスタには、引数を設定 (今回は引数３つまで)
+    // a0〜a5レジスタには、引数を設定 (今回は引数4つまで)
     register long a0 __asm__("a0") = arg0;
     register long a1 __asm__("a1") = arg1;
     register long a2 __asm__("a2") = arg2;
+    register long a3 __asm__("a3") = arg3;
     // a7レジスタには、Extension IDを設定
     register long a7 __asm__("a7") = eid;
     // a6レジスタには、Function ID設定
@@ -57,452 +318,7726 @@ struct sbiret sbi_call(long eid, long fid, long arg0, long arg1, long arg2)
     __asm__ __volatile__(
         "ecall"
         : "=r"(a0), "=r"(a1)
-        : "r"(a0), "r"(a1), "r"(a2), "r"(a6), "r"(a7)
+        : "r"(a0), "r"(a1), "r"(a2), "r"(a3), "r"(a6), "r"(a7)
         :);
 
     return (struct sbiret){.error = a0, .value = a1};
 }
 /**
- * @brief 1文字表示処理
- * @param ch :
- * @details １文字を表示するシステムコールを呼び出す
+ * @brief 現在時刻(timeレジスタ)の取得
+ * @return timeレジスタの値 (64ビット)
+ * @details RV32ではtimeレジスタを上位(timeh)/下位(time)の2回に分けて読むため、
+ *          読み込みの間に下位が桁あふれしていないかを上位の再読み込みで確認する
  */
-void putchar(char ch)
+unsigned long long get_time(void)
+{
+    unsigned int hi = 0;  // 上位32ビット
+    unsigned int lo = 0;  // 下位32ビット
+    unsigned int tmp = 0; // 上位32ビット(再読み込み)
+
+    do
+    {
+        __asm__ __volatile__(
+            "rdtimeh %0\n"                   /* 上位32ビットを読み込む */
+            "rdtime  %1\n"                   /* 下位32ビットを読み込む */
+            "rdtimeh %2\n"                   /* 上位32ビットを再度読み込む */
+            : "=r"(hi), "=r"(lo), "=r"(tmp)); /* 上記の結果をC言語の変数に書き込む */
+    } while (hi != tmp);
+    return ((unsigned long long)hi << 32) | lo;
+}
+/**
+ * @brief タイマーの設定 (SBI Timer Extension)
+ * @param stime_value : 次にタイマー割り込みを発生させる時刻(timeレジスタの値)
+ * @details RV32では64ビットの時刻をa0(下位)とa1(上位)に分けて渡す
+ *          タイマーを設定し直すと、保留中のタイマー割り込み(sip.STIP)もクリアされる
+ */
+void sbi_set_timer(unsigned long long stime_value)
 {
-    sbi_call(0x01, 0, ch, 0, 0);
+    sbi_call(SBI_EXT_TIME, SBI_TIME_SET_TIMER, (long)(stime_value & 0xffffffff), (long)(stime_value >> 32), 0, 0);
 }
 /**
- * @brief コンパイラが提供する組み込み関数や型
- * @details __builtinは、特定のコンパイラ（特にGCCやClang）が提供するものであり、
- *          標準C/C++言語仕様には含まれていません。
- *          特定のコンパイラに依存するため、他のコンパイラでは利用できない場合があります。
+ * @brief 割り込みの禁止
+ * @return 禁止する前のsstatus.SIEの値
+ * @details sstatus.SIEをクリアし、元の状態をintr_restoreで戻せるように返す
  */
-#define va_list __builtin_va_list
-#define va_start __builtin_va_start
-#define va_end __builtin_va_end
-#define va_arg __builtin_va_arg
+unsigned int intr_disable(void)
+{
+    unsigned int sstatus = 0;
+    __asm__ __volatile__(
+        "csrrc %0, sstatus, %1\n" /* sstatusのSIEビットをクリアし、変更前の値を%0に読み込む */
+        : "=r"(sstatus)
+        : "r"(SSTATUS_SIE)
+        : "memory");
+    return sstatus & SSTATUS_SIE;
+}
 /**
- * @brief 文字列表示処理
- * @param fmt   : 表示する文字列データ もしくは フォーマット指定子の設定
- * @param ...   : 可変長引数 (表示データ)
- * @details
+ * @brief 割り込み状態の復元
+ * @param sie : intr_disableで取得したsstatus.SIEの値
  */
-void printf(const char *fmt, ...)
+void intr_restore(unsigned int sie)
 {
-    int value = 0;
-    int divisor = 0;
-    const char *s;
-
-    // 可変長引数の設定
-    // 第1引数は、可変長の情報をまとめるための変数
-    // 第2引数は、第1引数のアドレス位置を設定。通常は、可変引数の情報が始まる1つ前のアドレス位置を設定
-    va_list vargs;        // 可変長リストを格納できる型(va_list)
-    va_start(vargs, fmt); // 可変長引数の情報を1つの変数にまとめる
-
-    // 指定した文字列データを表示する処理
-    while (*fmt)
+    if (sie)
+    {
+        __asm__ __volatile__("csrs sstatus, %0\n" ::"r"(SSTATUS_SIE) : "memory"); /* sstatusのSIEビットをセット */
+    }
+}
+/**
+ * @brief 割り込みの許可
+ */
+void intr_enable(void)
+{
+    intr_restore(SSTATUS_SIE);
+}
+/**
+ * @brief スピンロック (test-and-set)
+ * @note 複数のハートから同時に更新されるデータを保護する
+ *       ロックを持っている間に割り込みハンドラから同じロックを取ると戻れなくなるため、
+ *       割り込みハンドラからも使うデータにはspin_lock_irqsaveを使う
+ *       最も軽いが取得の順番は保証されない (競合が激しいと特定のハートが取り続けることがある)
+ */
+struct spinlock
+{
+    volatile unsigned int locked; // 1ならロック中
+};
+/**
+ * @brief スピンロックの取得
+ * @param lock : スピンロック
+ * @details amoswapで1を書き込み、元の値が0ならロックを取得できている
+ *          取得できない間は、通常の読み込みで解放を待つ (amoswapの書き込みでキャッシュラインを奪い合わないようにする)
+ */
+void spin_lock(struct spinlock *lock)
+{
+    unsigned int old = 0;
+    for (;;)
     {
-        if (*fmt == '%') // フォーマット指定子の場合
+        __asm__ __volatile__(
+            "amoswap.w.aq %0, %1, (%2)\n" /* lock->lockedに1を書き込み、元の値を読み込む (以降の読み書きを先に行わない) */
+            : "=r"(old)
+            : "r"(1), "r"(&lock->locked)
+            : "memory");
+        if (old == 0)
         {
-            // フォーマット指定子まで進める
-            fmt++;
-            // それぞれのフォマット指定子で表示処理
-            switch (*fmt)
-            {
-            case '\0':         // 終端文字の場合
-                putchar('%');  //
-                va_end(vargs); // 可変長引数の取得を終了
-                return;
-                break;
-            case '%':         // %表示の場合
-                putchar('%'); //
-                break;
-            case 's': // 文字列表示の場合
-                // 1つずつ文字を取り出す
-                // 第1引数がフォーマット指定子のアドレス位置を指す
-                // 第2引数は、第1引数のアドレス位置から指定したサイズ (今回はchar型サイズ)のデータを取得
-                s = va_arg(vargs, const char *);
-                // 1文字ずつ表示
-                while (*s)
-                {
-                    putchar(*s);
-                    s++;
-                }
-                break;
-            case 'd': // 整数データの場合
-                // 1つずつ文字を取り出す
-                // 第1引数がフォーマット指定子のアドレス位置を指す
-                // 第2引数は、第1引数のアドレス位置から指定したサイズ (今回はint型サイズ)のデータを取得
-                value = va_arg(vargs, signed int);
-                // 負の数の場合、マイナスの符号を表示
-                if (value < 0)
-                {
-                    putchar('-');   // 負の数を表示
-                    value = -value; // データをプラスにしておく
-                }
-                // 整数の桁数を求める
-                divisor = 1;
-                while ((value / divisor) > 9)
-                    divisor *= 10;
-                // 文字に変換
-                // 桁数が大きいものから順番に表示
-                while (divisor > 0)
-                {
-                    // 文字を表示し、整数を除数で丸め、除数の桁数を下げていく
-                    putchar('0' + (value / divisor));
-                    value %= divisor;
-                    divisor /= 10;
-                }
-                break;
-            case 'x': // 16進数表示の場合
-                // 1つずつ文字を取り出す
-                // 第1引数がフォーマット指定子のアドレス位置を指す
-                // 第2引数は、第1引数のアドレス位置から指定したサイズ (今回はunsigned int型サイズ)のデータを取得
-                value = va_arg(vargs, unsigned int);
-                // 16進数に変換
-                // 4バイトなので、4ビットずつ取り出すと8回となる
-                for (int i = 7; i >= 0; i--)
-                {
-                    // 4バイトの情報を4ビットずつ8個(0~7)取り出す
-                    int nibble = (value >> (i * 4)) & 0xf;
-                    putchar("0123456789abcdef"[nibble]);
-                }
-                break;
-            default:
-                break;
-            }
+            return;
+        }
+        while (lock->locked)
+            ;
+    }
+}
+/**
+ * @brief スピンロックの解放
+ * @param lock : スピンロック
+ */
+void spin_unlock(struct spinlock *lock)
+{
+    __asm__ __volatile__(
+        "amoswap.w.rl zero, zero, (%0)\n" /* lock->lockedに0を書き込む (それまでの読み書きを先に完了させる) */
+        ::"r"(&lock->locked)
+        : "memory");
+}
+/**
+ * @brief 割り込みを禁止してスピンロックを取得
+ * @param lock : スピンロック
+ * @return 禁止する前のsstatus.SIEの値
+ */
+unsigned int spin_lock_irqsave(struct spinlock *lock)
+{
+    unsigned int sie = intr_disable();
+    spin_lock(lock);
+    return sie;
+}
+/**
+ * @brief スピンロックを解放して割り込み状態を復元
+ * @param lock : スピンロック
+ * @param sie  : spin_lock_irqsaveで取得したsstatus.SIEの値
+ */
+void spin_unlock_irqrestore(struct spinlock *lock, unsigned int sie)
+{
+    spin_unlock(lock);
+    intr_restore(sie);
+}
+/**
+ * @brief compare-and-swap (lr/sc)
+ * @param addr     : 書き換える32ビットの変数のアドレス
+ * @param expected : 期待する値
+ * @param desired  : 書き込む値
+ * @return 書き換える前の値 (expectedと等しければ書き換えに成功している)
+ * @details lr.wで予約付きで読み込み、期待する値の場合だけsc.wで書き込む (予約が外れていたらやり直す)
+ */
+unsigned int atomic_cas_word(volatile unsigned int *addr, unsigned int expected, unsigned int desired)
+{
+    unsigned int old = 0;
+    unsigned int fail = 0;
+    __asm__ __volatile__(
+        "1:\n"
+        "lr.w.aqrl %0, (%2)\n"  /* 予約付きで読み込む */
+        "bne %0, %3, 2f\n"      /* 期待する値でなければ失敗 */
+        "sc.w.rl %1, %4, (%2)\n" /* 予約が有効なら書き込む (成功なら%1に0) */
+        "bnez %1, 1b\n"         /* 予約が外れていたらやり直す */
+        "2:\n"
+        : "=&r"(old), "=&r"(fail)
+        : "r"(addr), "r"(expected), "r"(desired)
+        : "memory");
+    return old;
+}
+/**
+ * @brief チケットロック
+ * @note 取得を待つハートは整理券(ticket)を受け取り、受け取った順番にロックを取得する (公平)
+ *       待っている全てのハートが同じownerを読み続けるため、解放のたびに全員のキャッシュラインが無効になる
+ */
+struct ticket_lock
+{
+    volatile unsigned int next;  // 次に配る整理券の番号
+    volatile unsigned int owner; // ロックを持っている整理券の番号
+};
+/**
+ * @brief チケットロックの取得
+ * @param lock : チケットロック
+ * @details amoaddで整理券を受け取り、ownerが自分の番号になるまで待つ
+ */
+void ticket_spin_lock(struct ticket_lock *lock)
+{
+    unsigned int ticket = 0;
+    __asm__ __volatile__(
+        "amoadd.w %0, %1, (%2)\n" /* lock->nextに1を加算し、加算前の値(整理券)を読み込む */
+        : "=r"(ticket)
+        : "r"(1), "r"(&lock->next)
+        : "memory");
+    while (lock->owner != ticket)
+        ;
+    __asm__ __volatile__("fence r, rw\n" ::: "memory"); /* ownerの読み込みより後に、保護するデータを読み書きする */
+}
+/**
+ * @brief チケットロックの解放
+ * @param lock : チケットロック
+ * @details ownerを書き換えるのはロックを持っているハートだけのため、アトミック命令は使わない
+ */
+void ticket_spin_unlock(struct ticket_lock *lock)
+{
+    __asm__ __volatile__("fence rw, w\n" ::: "memory"); /* 保護するデータの読み書きを、ownerの書き込みより先に完了させる */
+    lock->owner = lock->owner + 1;
+}
+/**
+ * @brief 割り込みを禁止してチケットロックを取得
+ * @param lock : チケットロック
+ * @return 禁止する前のsstatus.SIEの値
+ */
+unsigned int ticket_spin_lock_irqsave(struct ticket_lock *lock)
+{
+    unsigned int sie = intr_disable();
+    ticket_spin_lock(lock);
+    return sie;
+}
+/**
+ * @brief チケットロックを解放して割り込み状態を復元
+ * @param lock : チケットロック
+ * @param sie  : ticket_spin_lock_irqsaveで取得したsstatus.SIEの値
+ */
+void ticket_spin_unlock_irqrestore(struct ticket_lock *lock, unsigned int sie)
+{
+    ticket_spin_unlock(lock);
+    intr_restore(sie);
+}
+/**
+ * @brief MCSロック
+ * @note 取得を待つハートは自分のノードを待ち行列の末尾につなぎ、自分のノードのlockedだけを読んで待つ
+ *       解放するハートは次のノードのlockedだけを書き換えるため、待っているハートが増えてもキャッシュラインを奪い合わない
+ *       ノードは取得から解放までの間有効であること (呼び出し元のスタックに置く)
+ */
+struct mcs_node
+{
+    struct mcs_node *volatile next; // 次にロックを取得するハートのノード
+    volatile unsigned int locked;   // 1なら前のハートの解放待ち
+};
+struct mcs_lock
+{
+    struct mcs_node *volatile tail; // 待ち行列の末尾のノード (NULLならロックされていない)
+};
+/**
+ * @brief MCSロックの取得
+ * @param lock : MCSロック
+ * @param node : 自分のノード
+ * @details amoswapで待ち行列の末尾を自分のノードに置き換え、前のノードがあればそこにつないで解放を待つ
+ */
+void mcs_spin_lock(struct mcs_lock *lock, struct mcs_node *node)
+{
+    struct mcs_node *prev = NULL;
+    node->next = NULL;
+    node->locked = 1;
+    __asm__ __volatile__(
+        "amoswap.w.aqrl %0, %1, (%2)\n" /* lock->tailに自分のノードを書き込み、前の末尾を読み込む */
+        : "=r"(prev)
+        : "r"(node), "r"(&lock->tail)
+        : "memory");
+    if (prev != NULL)
+    {
+        prev->next = node;
+        while (node->locked)
+            ;
+        __asm__ __volatile__("fence r, rw\n" ::: "memory"); /* lockedの読み込みより後に、保護するデータを読み書きする */
+    }
+}
+/**
+ * @brief MCSロックの解放
+ * @param lock : MCSロック
+ * @param node : mcs_spin_lockで渡した自分のノード
+ * @details 次のノードがなければ、末尾が自分のままの場合だけcompare-and-swapでNULLに戻す
+ *          末尾が変わっていた場合は、取得中のハートが自分のノードにつなぐのを待ってから引き渡す
+ */
+void mcs_spin_unlock(struct mcs_lock *lock, struct mcs_node *node)
+{
+    struct mcs_node *next = node->next;
+    if (next == NULL)
+    {
+        if (atomic_cas_word((volatile unsigned int *)&lock->tail, (unsigned int)node, 0) == (unsigned int)node)
+        {
+            return;
+        }
+        while ((next = node->next) == NULL)
+            ;
+    }
+    __asm__ __volatile__("fence rw, w\n" ::: "memory"); /* 保護するデータの読み書きを、引き渡しより先に完了させる */
+    next->locked = 0;
+}
+/**
+ * @brief 割り込みを禁止してMCSロックを取得
+ * @param lock : MCSロック
+ * @param node : 自分のノード
+ * @return 禁止する前のsstatus.SIEの値
+ */
+unsigned int mcs_spin_lock_irqsave(struct mcs_lock *lock, struct mcs_node *node)
+{
+    unsigned int sie = intr_disable();
+    mcs_spin_lock(lock, node);
+    return sie;
+}
+/**
+ * @brief MCSロックを解放して割り込み状態を復元
+ * @param lock : MCSロック
+ * @param node : mcs_spin_lock_irqsaveで渡した自分のノード
+ * @param sie  : mcs_spin_lock_irqsaveで取得したsstatus.SIEの値
+ */
+void mcs_spin_unlock_irqrestore(struct mcs_lock *lock, struct mcs_node *node, unsigned int sie)
+{
+    mcs_spin_unlock(lock, node);
+    intr_restore(sie);
+}
+/**
+ * @brief サイクルカウンタ(cycleレジスタ)の取得
+ * @return cycleレジスタの下位32ビット
+ * @note 短い区間の計測用 (差分は32ビットの桁あふれを考慮して符号なしで計算する)
+ */
+unsigned int get_cycle(void)
+{
+    unsigned int cycle = 0;
+    __asm__ __volatile__("rdcycle %0\n" : "=r"(cycle)); /* cycleレジスタの下位32ビットを読み込む */
+    return cycle;
+}
+/**
+ * @brief プロファイル用の計測
+ * @note PROFILE_BEGINで開始時のサイクル数を変数に読み込み、PROFILE_ENDで経過サイクル数をカウンタに記録する
+ *       PROFILE_ENABLEが0の場合は、計測処理とカウンタの表を全て取り除く
+ */
+#if PROFILE_ENABLE
+#define PROFILE_BEGIN(start) unsigned int start = get_cycle()              // 計測開始 (開始時のサイクル数を持つ変数を宣言)
+#define PROFILE_MARK(start) ((start) = get_cycle())                        // 計測開始 (宣言済みの変数に読み込む)
+#define PROFILE_END(id, start) profile_record((id), get_cycle() - (start)) // 計測終了 (経過サイクル数を記録)
+#else
+#define PROFILE_BEGIN(start)
+#define PROFILE_MARK(start) ((void)0)
+#define PROFILE_END(id, start) ((void)0)
+#endif
+/**
+ * @brief プロファイル用のカウンタの番号
+ */
+enum ProfileId
+{
+    PROFILE_SWITCH_CONTEXT,   // コンテキストスイッチ (switch_contextの呼び出しから切り替え先で戻るまで)
+    PROFILE_SCHEDULE_THREADS, // スケジューラ (次のスレッドの選択・タイマー設定)
+    PROFILE_TRAP_HANDLER,     // トラップハンドラ (入口・出口のレジスタ退避・復元を除く)
+    PROFILE_PRINTF,           // printf (書式変換とコンソール出力)
+    PROFILE_ALLOC_PAGES,      // ページの割り当て
+    PROFILE_ID_NUM,           // カウンタの数
+};
+/**
+ * @brief プロファイル用のカウンタ
+ * @note ヒストグラムのバケットiには、経過サイクル数が [2^i, 2^(i+1)) の計測回数を数える (最後のバケットは上限なし)
+ */
+struct profile_counter
+{
+    const char *name;                    // カウンタの名前
+    unsigned int count;                  // 計測回数
+    unsigned long long total;            // 経過サイクル数の合計
+    unsigned int min;                    // 経過サイクル数の最小値
+    unsigned int max;                    // 経過サイクル数の最大値
+    unsigned int hist[PROFILE_HIST_NUM]; // 経過サイクル数のヒストグラム
+};
+#if PROFILE_ENABLE
+/**
+ * @brief プロファイル用のカウンタの表
+ */
+struct spinlock g_profile_lock; // プロファイル用のカウンタの表のロック
+struct profile_counter g_profile_counters[PROFILE_ID_NUM] = {
+    [PROFILE_SWITCH_CONTEXT] = {.name = "switch_context", .min = 0xffffffff},
+    [PROFILE_SCHEDULE_THREADS] = {.name = "schedule_threads", .min = 0xffffffff},
+    [PROFILE_TRAP_HANDLER] = {.name = "trap_handler", .min = 0xffffffff},
+    [PROFILE_PRINTF] = {.name = "printf", .min = 0xffffffff},
+    [PROFILE_ALLOC_PAGES] = {.name = "alloc_pages", .min = 0xffffffff},
+};
+/**
+ * @brief プロファイル用のカウンタへの記録
+ * @param id     : カウンタの番号
+ * @param cycles : 経過サイクル数
+ * @details 割り込みハンドラや他のハートからも記録するため、割り込みを禁止してロックを取って更新する
+ */
+void profile_record(enum ProfileId id, unsigned int cycles)
+{
+    struct profile_counter *counter = &g_profile_counters[id];
+    int bucket = (cycles == 0) ? 0 : 31 - __builtin_clz(cycles);
+    if (bucket >= PROFILE_HIST_NUM)
+    {
+        bucket = PROFILE_HIST_NUM - 1;
+    }
+    unsigned int sie = spin_lock_irqsave(&g_profile_lock);
+    counter->count++;
+    counter->total += cycles;
+    if (cycles < counter->min)
+    {
+        counter->min = cycles;
+    }
+    if (cycles > counter->max)
+    {
+        counter->max = cycles;
+    }
+    counter->hist[bucket]++;
+    spin_unlock_irqrestore(&g_profile_lock, sie);
+}
+#endif
+/**
+ * @brief UARTのレジスタへのアクセス
+ * @note MMIOのため、volatileを付けてコンパイラによる読み書きの省略・並べ替えを防ぐ
+ */
+#define UART_REG(reg) (*(volatile unsigned char *)(UART_BASE + (reg)))
+/**
+ * @brief UART(グローバル変数)
+ * @note 送信はリングバッファに溜めて、送信FIFOが空いた時の割り込みでFIFOへ書き込む
+ *       受信は受信データの割り込みでリングバッファに溜める (head/tailは剰余を取る前の通し番号)
+ */
+char g_uart_tx_buf[UART_TX_BUF_SIZE]; // 送信のリングバッファ
+unsigned int g_uart_tx_head;          // 送信 : 次に書き込む位置
+unsigned int g_uart_tx_tail;          // 送信 : 次にFIFOへ書き込む位置
+char g_uart_rx_buf[UART_RX_BUF_SIZE]; // 受信のリングバッファ
+unsigned int g_uart_rx_head;          // 受信 : 次に書き込む位置
+unsigned int g_uart_rx_tail;          // 受信 : 次に読み込む位置
+unsigned int g_uart_rx_dropped;       // 受信のリングバッファが一杯で捨てた文字数
+unsigned int g_uart_tx_stalls;        // 送信のリングバッファが一杯で送信完了を待った回数
+struct spinlock g_uart_lock;          // UARTのレジスタとリングバッファのロック
+unsigned int g_boot_hartid;           // ブートしたハートのID (UARTの割り込みを受け付けるハート)
+/**
+ * @brief UARTの初期化
+ * @details FIFOを有効にし、受信データの割り込みを許可する
+ *          (QEMUのUARTはボーレートの設定を使わないため、分周比は設定しない)
+ */
+void init_uart(void)
+{
+    UART_REG(UART_IER) = 0;
+    UART_REG(UART_LCR) = UART_LCR_8N1;
+    UART_REG(UART_FCR) = UART_FCR_ENABLE;
+    UART_REG(UART_MCR) = UART_MCR_OUT2;
+    g_uart_tx_head = 0;
+    g_uart_tx_tail = 0;
+    g_uart_rx_head = 0;
+    g_uart_rx_tail = 0;
+    UART_REG(UART_IER) = UART_IER_RDI;
+}
+/**
+ * @brief 送信FIFOへの書き込み
+ * @details 送信FIFOが空なら、送信のリングバッファから最大でFIFOの段数分を書き込む
+ *          送信するデータが残っている間だけ、送信FIFOが空いた時の割り込みを許可する
+ * @note 割り込みを禁止し、UARTのロックを取った状態で呼び出すこと
+ */
+void uart_fill_fifo(void)
+{
+    if (UART_REG(UART_LSR) & UART_LSR_THRE)
+    {
+        for (int i = 0; i < UART_FIFO_SIZE && g_uart_tx_tail != g_uart_tx_head; i++)
+        {
+            UART_REG(UART_THR) = g_uart_tx_buf[g_uart_tx_tail % UART_TX_BUF_SIZE];
+            g_uart_tx_tail++;
+        }
+    }
+    UART_REG(UART_IER) = (g_uart_tx_tail != g_uart_tx_head) ? (UART_IER_RDI | UART_IER_THRI) : UART_IER_RDI;
+}
+/**
+ * @brief 文字列の送信
+ * @param buf : 送信する文字列
+ * @param len : 送信するバイト数
+ * @details 送信のリングバッファに追加して戻る (送信は割り込みで進む)
+ *          リングバッファが一杯の場合だけ、送信FIFOが空くのを待って書き込む
+ */
+void uart_write(const char *buf, unsigned int len)
+{
+    unsigned int sie = spin_lock_irqsave(&g_uart_lock);
+    for (unsigned int i = 0; i < len; i++)
+    {
+        if (g_uart_tx_head - g_uart_tx_tail == UART_TX_BUF_SIZE)
+        {
+            g_uart_tx_stalls++;
+            while (!(UART_REG(UART_LSR) & UART_LSR_THRE))
+                ;
+            uart_fill_fifo();
+        }
+        g_uart_tx_buf[g_uart_tx_head % UART_TX_BUF_SIZE] = buf[i];
+        g_uart_tx_head++;
+    }
+    uart_fill_fifo();
+    spin_unlock_irqrestore(&g_uart_lock, sie);
+}
+/**
+ * @brief 送信完了の待機
+ * @details 割り込みを使わずに、送信のリングバッファと送信FIFOが空になるまで書き込む
+ *          (割り込みを禁止したままの停止処理や、SBI経由の出力に切り替える前に使用する)
+ */
+void uart_sync(void)
+{
+    unsigned int sie = spin_lock_irqsave(&g_uart_lock);
+    while (g_uart_tx_tail != g_uart_tx_head || !(UART_REG(UART_LSR) & UART_LSR_TEMT))
+    {
+        uart_fill_fifo();
+    }
+    spin_unlock_irqrestore(&g_uart_lock, sie);
+}
+/**
+ * @brief 1文字受信処理
+ * @return 受信した文字 (受信した文字がない場合は-1)
+ */
+int uart_getchar(void)
+{
+    int ch = -1;
+    unsigned int sie = spin_lock_irqsave(&g_uart_lock);
+    if (g_uart_rx_tail != g_uart_rx_head)
+    {
+        ch = (unsigned char)g_uart_rx_buf[g_uart_rx_tail % UART_RX_BUF_SIZE];
+        g_uart_rx_tail++;
+    }
+    spin_unlock_irqrestore(&g_uart_lock, sie);
+    return ch;
+}
+/**
+ * @brief UARTの割り込み処理
+ * @details 受信FIFOの文字を受信のリングバッファへ移し、送信FIFOが空いていれば続きを書き込む
+ */
+void uart_handle_interrupt(void)
+{
+    spin_lock(&g_uart_lock);
+    while (UART_REG(UART_LSR) & UART_LSR_DR)
+    {
+        char ch = UART_REG(UART_RBR);
+        if (g_uart_rx_head - g_uart_rx_tail == UART_RX_BUF_SIZE)
+        {
+            g_uart_rx_dropped++;
+            continue;
         }
-        else // フォーマット指定子でない場合
+        g_uart_rx_buf[g_uart_rx_head % UART_RX_BUF_SIZE] = ch;
+        g_uart_rx_head++;
+    }
+    uart_fill_fifo();
+    spin_unlock(&g_uart_lock);
+}
+/**
+ * @brief PLICの初期化
+ * @details UARTの割り込みを許可し、sieのSEIEビットをセットしてSモードの外部割り込みを受け付ける
+ * @note ブートしたハートのSモードのコンテキストにだけ割り込みを届ける
+ */
+void init_plic(void)
+{
+    *(volatile unsigned int *)PLIC_PRIORITY(UART_IRQ) = 1;
+    *(volatile unsigned int *)PLIC_SENABLE(g_boot_hartid) = (1 << UART_IRQ);
+    *(volatile unsigned int *)PLIC_SPRIORITY(g_boot_hartid) = 0;
+    __asm__ __volatile__("csrs sie, %0\n" ::"r"(SIE_SEIE)); /* sieのSEIEビットをセット (外部割り込み許可) */
+}
+/**
+ * @brief 外部割り込みの処理
+ * @param tf : トラップフレーム
+ * @details PLICから割り込み番号を取得(claim)し、デバイスの処理後に完了(complete)を通知する
+ */
+void handle_external_interrupt(struct trap_frame *tf)
+{
+    (void)tf;
+    volatile unsigned int *claim = (volatile unsigned int *)PLIC_SCLAIM(g_boot_hartid);
+    unsigned int irq = *claim;
+    if (irq == UART_IRQ)
+    {
+        uart_handle_interrupt();
+    }
+    if (irq != 0)
+    {
+        *claim = irq;
+    }
+}
+/**
+ * @brief コンソール出力(グローバル変数)
+ * @note 表示する文字をリングバッファに溜め、改行時・バッファが一杯の時・console_flush呼び出し時に
+ *       まとめて出力する (head/tailは剰余を取る前の通し番号)
+ */
+char g_console_buf[CONSOLE_BUF_SIZE]; // コンソール出力のリングバッファ
+unsigned int g_console_head;          // 次に書き込む位置
+unsigned int g_console_tail;          // 次に出力する位置
+int g_console_buffered;               // 1ならリングバッファに溜めて出力する
+int g_console_dbcn;                   // 1ならSBI Debug Console Extensionが使える
+int g_console_uart;                   // 1ならUARTへ直接出力する (SBIを経由しない)
+struct spinlock g_console_lock;       // コンソール出力のリングバッファのロック
+/**
+ * @brief 1文字表示処理 (SBI Legacy Extension)
+ * @param ch : 表示する文字
+ * @details １文字を表示するシステムコールを呼び出す (1文字ごとにMモードとの切り替えが発生する)
+ */
+void sbi_console_putchar(char ch)
+{
+    sbi_call(SBI_EXT_LEGACY_CONSOLE_PUTCHAR, 0, ch, 0, 0, 0);
+}
+/**
+ * @brief 文字列表示処理 (SBI Debug Console Extension)
+ * @param buf : 表示する文字列 (物理アドレス)
+ * @param len : 表示するバイト数
+ * @return 表示したバイト数 (エラーの場合は-1)
+ * @details 1回のSBI呼び出しで文字列をまとめて表示する (全て表示されない場合もある)
+ *          物理アドレスを上位/下位に分けて渡すが、RV32のカーネルは仮想アドレス=物理アドレスのため上位は0
+ */
+int sbi_debug_console_write(const char *buf, unsigned int len)
+{
+    struct sbiret ret = sbi_call(SBI_EXT_DBCN, SBI_DBCN_CONSOLE_WRITE, len, (long)buf, 0, 0);
+    return (ret.error != 0) ? -1 : ret.value;
+}
+/**
+ * @brief 文字列の出力
+ * @param buf : 表示する文字列
+ * @param len : 表示するバイト数
+ * @details UARTを使う場合は送信のリングバッファへ追加する
+ *          SBI経由の場合は、Debug Console Extensionが使えればまとめて出力し、使えない場合は1文字ずつ出力する
+ */
+void console_write(const char *buf, unsigned int len)
+{
+    if (g_console_uart)
+    {
+        uart_write(buf, len);
+        return;
+    }
+    while (len > 0)
+    {
+        if (g_console_dbcn)
+        {
+            int written = sbi_debug_console_write(buf, len);
+            if (written > 0)
+            {
+                buf += written;
+                len -= written;
+                continue;
+            }
+            // エラーの場合は1文字ずつの出力に切り替える
+            g_console_dbcn = 0;
+        }
+        sbi_console_putchar(*buf);
+        buf++;
+        len--;
+    }
+}
+/**
+ * @brief コンソール出力のフラッシュ (ロック取得済み)
+ * @details リングバッファに溜まっている文字を全て出力する
+ *          リングバッファの末尾で折り返している場合は、末尾までと先頭からの2回に分けて出力する
+ * @note 割り込みを禁止し、コンソールのロックを取った状態で呼び出すこと
+ */
+void console_flush_locked(void)
+{
+    while (g_console_tail != g_console_head)
+    {
+        unsigned int index = g_console_tail % CONSOLE_BUF_SIZE;
+        unsigned int len = g_console_head - g_console_tail;
+        if (len > CONSOLE_BUF_SIZE - index)
+        {
+            len = CONSOLE_BUF_SIZE - index;
+        }
+        console_write(&g_console_buf[index], len);
+        g_console_tail += len;
+    }
+}
+/**
+ * @brief コンソール出力のフラッシュ
+ */
+void console_flush(void)
+{
+    unsigned int sie = spin_lock_irqsave(&g_console_lock);
+    console_flush_locked();
+    spin_unlock_irqrestore(&g_console_lock, sie);
+}
+/**
+ * @brief コンソール出力の完了待ち
+ * @details リングバッファをフラッシュし、UARTを使う場合は送信完了まで待つ
+ */
+void console_sync(void)
+{
+    console_flush();
+    if (g_console_uart)
+    {
+        uart_sync();
+    }
+}
+/**
+ * @brief コンソールの初期化
+ * @details SBI Debug Console Extensionが使えるかを確認し、バッファリングを有効にする
+ *          UARTとPLICを初期化し、以降の出力はUARTへ直接行う
+ */
+void init_console(void)
+{
+    struct sbiret ret = sbi_call(SBI_EXT_BASE, SBI_BASE_PROBE_EXTENSION, SBI_EXT_DBCN, 0, 0, 0);
+    g_console_dbcn = (ret.error == 0) && (ret.value != 0);
+    g_console_head = 0;
+    g_console_tail = 0;
+    g_console_buffered = 1;
+    init_uart();
+    init_plic();
+    g_console_uart = 1;
+}
+/**
+ * @brief 1文字表示処理
+ * @param ch : 表示する文字
+ * @details リングバッファに1文字追加し、改行の場合はフラッシュする
+ *          バッファリングが無効(コンソールの初期化前)の場合は、そのまま1文字表示する
+ */
+void putchar(char ch)
+{
+    if (!g_console_buffered)
+    {
+        sbi_console_putchar(ch);
+        return;
+    }
+    unsigned int sie = spin_lock_irqsave(&g_console_lock);
+    if (g_console_head - g_console_tail == CONSOLE_BUF_SIZE)
+    {
+        console_flush_locked();
+    }
+    g_console_buf[g_console_head % CONSOLE_BUF_SIZE] = ch;
+    g_console_head++;
+    if (ch == '\n')
+    {
+        console_flush_locked();
+    }
+    spin_unlock_irqrestore(&g_console_lock, sie);
+}
+/**
+ * @brief 文字列表示処理
+ * @param buf : 表示する文字列
+ * @param len : 表示するバイト数
+ * @details putcharと同様にリングバッファへ追加するが、ロックの取得・解放は文字列ごとに1回で済ませる
+ *          (複数のハートのprintfが混ざるのは、printfの作業領域の単位までとなる)
+ */
+void console_puts(const char *buf, unsigned int len)
+{
+    if (!g_console_buffered)
+    {
+        for (unsigned int i = 0; i < len; i++)
+        {
+            sbi_console_putchar(buf[i]);
+        }
+        return;
+    }
+    unsigned int sie = spin_lock_irqsave(&g_console_lock);
+    for (unsigned int i = 0; i < len; i++)
+    {
+        if (g_console_head - g_console_tail == CONSOLE_BUF_SIZE)
+        {
+            console_flush_locked();
+        }
+        g_console_buf[g_console_head % CONSOLE_BUF_SIZE] = buf[i];
+        g_console_head++;
+        if (buf[i] == '\n')
+        {
+            console_flush_locked();
+        }
+    }
+    spin_unlock_irqrestore(&g_console_lock, sie);
+}
+/**
+ * @brief コンパイラが提供する組み込み関数や型
+ * @details __builtinは、特定のコンパイラ（特にGCCやClang）が提供するものであり、
+ *          標準C/C++言語仕様には含まれていません。
+ *          特定のコンパイラに依存するため、他のコンパイラでは利用できない場合があります。
+ */
+#define va_list __builtin_va_list
+#define va_start __builtin_va_start
+#define va_end __builtin_va_end
+#define va_arg __builtin_va_arg
+/**
+ * @brief 書式変換のフラグ
+ */
+#define FORMAT_LEFT (1 << 0)  // '-' : 左詰め
+#define FORMAT_ZERO (1 << 1)  // '0' : 0で埋める
+#define FORMAT_UPPER (1 << 2) // 'X' : 16進数を大文字で表示
+#define FORMAT_NUM_BUF 24     // 数値を文字列に変換する作業領域のサイズ (64ビットの10進数は20桁)
+#define PRINTF_BUF_SIZE 128   // printfで書式変換した文字列を溜める領域のサイズ
+/**
+ * @brief 2桁の10進数の表
+ * @note 100で割った余りを2文字まとめて変換し、除算の回数を半分にする
+ */
+const char g_digit_pairs[200] = "00010203040506070809"
+                                "10111213141516171819"
+                                "20212223242526272829"
+                                "30313233343536373839"
+                                "40414243444546474849"
+                                "50515253545556575859"
+                                "60616263646566676869"
+                                "70717273747576777879"
+                                "80818283848586878889"
+                                "90919293949596979899";
+/**
+ * @brief 書式変換の出力先
+ * @note バッファが一杯になった時、flushがあればそこで出力して続け、なければ以降を切り捨てる
+ *       (totalは切り捨てた分も含めた文字数)
+ */
+struct format_output
+{
+    char *buf;                                         // 書き込み先
+    unsigned int size;                                 // 書き込み先のサイズ (終端文字を含む)
+    unsigned int pos;                                  // 次に書き込む位置
+    unsigned int total;                                // 変換した文字数
+    void (*flush)(const char *buf, unsigned int len); // バッファが一杯の時の出力処理 (NULLなら切り捨て)
+};
+/**
+ * @brief 書式変換の出力先へ1文字追加
+ * @param out : 出力先
+ * @param ch  : 追加する文字
+ */
+void format_putc(struct format_output *out, char ch)
+{
+    if (out->pos + 1 >= out->size && out->flush != NULL)
+    {
+        out->flush(out->buf, out->pos);
+        out->pos = 0;
+    }
+    if (out->pos + 1 < out->size)
+    {
+        out->buf[out->pos++] = ch;
+    }
+    out->total++;
+}
+/**
+ * @brief 64ビットの値を32ビットの値で割る
+ * @param n : 割られる数 (商で上書きする)
+ * @param d : 割る数 (2^31未満)
+ * @return 余り
+ * @details RV32には64ビットの除算命令がなく、-nostdlibのため__udivdi3も使えないので、
+ *          上位32ビットは32ビットの除算で、下位32ビットは1ビットずつの筆算で求める
+ */
+unsigned int div64_u32(unsigned long long *n, unsigned int d)
+{
+    unsigned int hi = (unsigned int)(*n >> 32);
+    unsigned int lo = (unsigned int)*n;
+    unsigned int q_hi = hi / d;
+    unsigned int r = hi % d;
+    unsigned int q_lo = 0;
+
+    for (int i = 31; i >= 0; i--)
+    {
+        r = (r << 1) | ((lo >> i) & 1);
+        q_lo <<= 1;
+        if (r >= d)
+        {
+            r -= d;
+            q_lo |= 1;
+        }
+    }
+    *n = ((unsigned long long)q_hi << 32) | q_lo;
+    return r;
+}
+/**
+ * @brief 32ビットの符号なし整数を10進数の文字列に変換
+ * @param end   : 作業領域の末尾 (後ろから書き込む)
+ * @param value : 変換する値
+ * @return 変換した文字列の先頭
+ */
+char *format_u32(char *end, unsigned int value)
+{
+    while (value >= 100)
+    {
+        unsigned int q = value / 100;
+        unsigned int r = value - q * 100;
+        end -= 2;
+        end[0] = g_digit_pairs[r * 2];
+        end[1] = g_digit_pairs[r * 2 + 1];
+        value = q;
+    }
+    if (value >= 10)
+    {
+        end -= 2;
+        end[0] = g_digit_pairs[value * 2];
+        end[1] = g_digit_pairs[value * 2 + 1];
+    }
+    else
+    {
+        *--end = '0' + value;
+    }
+    return end;
+}
+/**
+ * @brief 64ビットの符号なし整数を10進数の文字列に変換
+ * @param end   : 作業領域の末尾 (後ろから書き込む)
+ * @param value : 変換する値
+ * @return 変換した文字列の先頭
+ * @details 32ビットに収まらない間は10^9で割り、余りを9桁(上位は0で埋める)ずつ変換する
+ */
+char *format_u64(char *end, unsigned long long value)
+{
+    while (value >> 32)
+    {
+        char *start = format_u32(end, div64_u32(&value, 1000000000));
+        while (start > end - 9)
+        {
+            *--start = '0';
+        }
+        end = start;
+    }
+    return format_u32(end, (unsigned int)value);
+}
+/**
+ * @brief 符号なし整数を16進数の文字列に変換
+ * @param end   : 作業領域の末尾 (後ろから書き込む)
+ * @param value : 変換する値
+ * @param upper : 1なら大文字で変換
+ * @return 変換した文字列の先頭
+ */
+char *format_hex(char *end, unsigned long long value, int upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do
+    {
+        *--end = digits[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+    return end;
+}
+/**
+ * @brief フィールド幅に合わせた出力
+ * @param out    : 出力先
+ * @param s      : 出力する文字列
+ * @param len    : 出力する文字列の長さ
+ * @param prefix : 符号・"0x"などの接頭辞 (なしの場合は空文字列)
+ * @param width  : フィールド幅
+ * @param flags  : 書式変換のフラグ
+ * @details 0で埋める場合は接頭辞と数値の間に、空白で埋める場合は接頭辞の前(左詰めでは末尾)に詰め物を入れる
+ */
+void format_field(struct format_output *out, const char *s, int len, const char *prefix, int width, int flags)
+{
+    int prefix_len = 0;
+    while (prefix[prefix_len])
+    {
+        prefix_len++;
+    }
+    int pad = width - len - prefix_len;
+
+    if (!(flags & (FORMAT_LEFT | FORMAT_ZERO)))
+    {
+        for (; pad > 0; pad--)
+        {
+            format_putc(out, ' ');
+        }
+    }
+    for (int i = 0; i < prefix_len; i++)
+    {
+        format_putc(out, prefix[i]);
+    }
+    if (flags & FORMAT_ZERO)
+    {
+        for (; pad > 0; pad--)
+        {
+            format_putc(out, '0');
+        }
+    }
+    for (int i = 0; i < len; i++)
+    {
+        format_putc(out, s[i]);
+    }
+    for (; pad > 0; pad--)
+    {
+        format_putc(out, ' ');
+    }
+}
+/**
+ * @brief 書式変換処理
+ * @param out  : 出力先
+ * @param fmt  : 表示する文字列データ もしくは フォーマット指定子の設定
+ * @param args : 可変長引数 (表示データ)
+ * @details %[フラグ(-,0)][フィールド幅(数値,*)][長さ(l,ll)]変換指定子(d,i,u,x,X,p,c,s,%) に対応する
+ *          lはRV32ではintと同じ32ビット、llは64ビットとして扱う
+ */
+void format_vprint(struct format_output *out, const char *fmt, va_list args)
+{
+    char num[FORMAT_NUM_BUF];         // 数値を文字列に変換する作業領域
+    char *end = &num[FORMAT_NUM_BUF]; // 作業領域の末尾
+
+    while (*fmt)
+    {
+        // フォーマット指定子でない場合は、文字をそのまま出力
+        if (*fmt != '%')
+        {
+            format_putc(out, *fmt++);
+            continue;
+        }
+        fmt++;
+        // フラグ
+        int flags = 0;
+        for (;; fmt++)
+        {
+            if (*fmt == '-')
+                flags |= FORMAT_LEFT;
+            else if (*fmt == '0')
+                flags |= FORMAT_ZERO;
+            else
+                break;
+        }
+        // フィールド幅
+        int width = 0;
+        if (*fmt == '*')
+        {
+            width = va_arg(args, int);
+            if (width < 0)
+            {
+                flags |= FORMAT_LEFT;
+                width = -width;
+            }
+            fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+        {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        if (flags & FORMAT_LEFT)
+        {
+            flags &= ~FORMAT_ZERO;
+        }
+        // 長さ
+        int is_long_long = 0;
+        if (*fmt == 'l')
+        {
+            fmt++;
+            if (*fmt == 'l')
+            {
+                is_long_long = 1;
+                fmt++;
+            }
+        }
+        // 変換指定子
+        const char *s = NULL;
+        const char *prefix = "";
+        unsigned long long value = 0;
+        switch (*fmt)
+        {
+        case '\0': // 終端文字の場合
+            format_putc(out, '%');
+            return;
+        case '%': // %表示の場合
+            format_putc(out, '%');
+            break;
+        case 'c': // 1文字表示の場合
+            num[0] = (char)va_arg(args, int);
+            format_field(out, num, 1, "", width, flags & ~FORMAT_ZERO);
+            break;
+        case 's': // 文字列表示の場合
+            s = va_arg(args, const char *);
+            if (s == NULL)
+            {
+                s = "(null)";
+            }
+            {
+                int len = 0;
+                while (s[len])
+                {
+                    len++;
+                }
+                format_field(out, s, len, "", width, flags & ~FORMAT_ZERO);
+            }
+            break;
+        case 'd': // 符号付き整数の場合
+        case 'i':
+        {
+            long long sval = is_long_long ? va_arg(args, long long) : va_arg(args, int);
+            // INT_MIN(LLONG_MIN)でも桁あふれしないように、符号なしで正の値にする
+            value = (unsigned long long)sval;
+            if (sval < 0)
+            {
+                value = 0 - value;
+                prefix = "-";
+            }
+            s = format_u64(end, value);
+            format_field(out, s, end - s, prefix, width, flags);
+            break;
+        }
+        case 'u': // 符号なし整数の場合
+            value = is_long_long ? va_arg(args, unsigned long long) : va_arg(args, unsigned int);
+            s = format_u64(end, value);
+            format_field(out, s, end - s, "", width, flags);
+            break;
+        case 'x': // 16進数表示の場合 (標準と同じく最小の桁数。固定幅は%08xのように指定する)
+        case 'X':
+            value = is_long_long ? va_arg(args, unsigned long long) : va_arg(args, unsigned int);
+            s = format_hex(end, value, *fmt == 'X');
+            format_field(out, s, end - s, "", width, flags);
+            break;
+        case 'p': // ポインタ表示の場合 (0xと8桁の16進数)
+            value = (unsigned int)va_arg(args, void *);
+            s = format_hex(end, value, 0);
+            format_field(out, s, end - s, "0x", 10, FORMAT_ZERO);
+            break;
+        default: // 未対応の変換指定子はそのまま表示
+            format_putc(out, '%');
+            format_putc(out, *fmt);
+            break;
+        }
+        fmt++;
+    }
+}
+/**
+ * @brief 書式変換した文字列の書き込み
+ * @param buf  : 書き込み先
+ * @param size : 書き込み先のサイズ (終端文字を含む)
+ * @param fmt  : フォーマット指定子の設定
+ * @param args : 可変長引数
+ * @return 切り捨てずに書き込んだ場合の文字数 (終端文字を除く)
+ * @details 書き込み先に収まらない部分は切り捨て、size > 0なら必ず終端文字を付ける
+ */
+int vsnprintf(char *buf, unsigned int size, const char *fmt, va_list args)
+{
+    struct format_output out = {buf, size, 0, 0, NULL};
+    format_vprint(&out, fmt, args);
+    if (size > 0)
+    {
+        buf[out.pos] = '\0';
+    }
+    return out.total;
+}
+/**
+ * @brief 書式変換した文字列の書き込み
+ * @param buf  : 書き込み先
+ * @param size : 書き込み先のサイズ (終端文字を含む)
+ * @param fmt  : フォーマット指定子の設定
+ * @param ...  : 可変長引数
+ * @return 切り捨てずに書き込んだ場合の文字数 (終端文字を除く)
+ */
+int snprintf(char *buf, unsigned int size, const char *fmt, ...)
+{
+    va_list vargs;
+    va_start(vargs, fmt);
+    int len = vsnprintf(buf, size, fmt, vargs);
+    va_end(vargs);
+    return len;
+}
+/**
+ * @brief 文字列表示処理
+ * @param fmt   : 表示する文字列データ もしくは フォーマット指定子の設定
+ * @param ...   : 可変長引数 (表示データ)
+ * @details スタック上の作業領域に書式変換し、一杯になる度・最後にまとめてコンソールへ出力する
+ */
+void printf(const char *fmt, ...)
+{
+    char buf[PRINTF_BUF_SIZE];
+    struct format_output out = {buf, sizeof(buf), 0, 0, console_puts};
+    PROFILE_BEGIN(start);
+
+    // 可変長引数の設定
+    // 第1引数は、可変長の情報をまとめるための変数
+    // 第2引数は、第1引数のアドレス位置を設定。通常は、可変引数の情報が始まる1つ前のアドレス位置を設定
+    va_list vargs;        // 可変長リストを格納できる型(va_list)
+    va_start(vargs, fmt); // 可変長引数の情報を1つの変数にまとめる
+    format_vprint(&out, fmt, vargs);
+    console_puts(buf, out.pos);
+    // 可変長引数の取得を終了
+    va_end(vargs);
+    PROFILE_END(PROFILE_PRINTF, start);
+}
+/**
+ * @brief プロファイル用のカウンタの表示
+ * @details カウンタごとに計測回数・平均・最小・最大のサイクル数と、計測回数が0でないヒストグラムのバケットを表示する
+ *          表示中のprintfも計測されるため、表示前に全カウンタの値を写し取っておく
+ */
+void profile_dump(void)
+{
+#if PROFILE_ENABLE
+    struct profile_counter counters[PROFILE_ID_NUM];
+    unsigned int sie = spin_lock_irqsave(&g_profile_lock);
+    for (int id = 0; id < PROFILE_ID_NUM; id++)
+    {
+        counters[id] = g_profile_counters[id];
+    }
+    spin_unlock_irqrestore(&g_profile_lock, sie);
+
+    printf("profile: %-16s %8s %8s %8s %8s (cycles)\n", "name", "count", "avg", "min", "max");
+    for (int id = 0; id < PROFILE_ID_NUM; id++)
+    {
+        struct profile_counter *counter = &counters[id];
+        unsigned long long avg = counter->total;
+        if (counter->count == 0)
+        {
+            printf("profile: %-16s %8u\n", counter->name, 0);
+            continue;
+        }
+        div64_u32(&avg, counter->count);
+        printf("profile: %-16s %8u %8u %8u %8u\n", counter->name, counter->count, (unsigned int)avg, counter->min, counter->max);
+        printf("profile:   hist");
+        for (int i = 0; i < PROFILE_HIST_NUM; i++)
+        {
+            if (counter->hist[i] != 0)
+            {
+                printf(" %s2^%d:%u", (i == PROFILE_HIST_NUM - 1) ? ">=" : "", i, counter->hist[i]);
+            }
+        }
+        printf("\n");
+    }
+#else
+    printf("profile: disabled (PROFILE_ENABLE=0)\n");
+#endif
+}
+/**
+ * @brief トラップフレーム
+ * @note トラップ発生時の全汎用レジスタ(x1〜x31)とCSRを保存する領域
+ *       トラップ発生時のスレッドのスタック上に作成し、スレッドのtrap_frameから参照する
+ *       メンバの並びはtrap_entryのオフセット(4バイト単位)と一致させること
+ */
+struct trap_frame
+{
+    unsigned int ra;       //  0 : x1
+    unsigned int sp;       //  1 : x2 (トラップ発生時のスタックポインタ)
+    unsigned int gp;       //  2 : x3
+    unsigned int tp;       //  3 : x4
+    unsigned int t0;       //  4 : x5
+    unsigned int t1;       //  5 : x6
+    unsigned int t2;       //  6 : x7
+    unsigned int s0;       //  7 : x8
+    unsigned int s1;       //  8 : x9
+    unsigned int a0;       //  9 : x10
+    unsigned int a1;       // 10 : x11
+    unsigned int a2;       // 11 : x12
+    unsigned int a3;       // 12 : x13
+    unsigned int a4;       // 13 : x14
+    unsigned int a5;       // 14 : x15
+    unsigned int a6;       // 15 : x16
+    unsigned int a7;       // 16 : x17
+    unsigned int s2;       // 17 : x18
+    unsigned int s3;       // 18 : x19
+    unsigned int s4;       // 19 : x20
+    unsigned int s5;       // 20 : x21
+    unsigned int s6;       // 21 : x22
+    unsigned int s7;       // 22 : x23
+    unsigned int s8;       // 23 : x24
+    unsigned int s9;       // 24 : x25
+    unsigned int s10;      // 25 : x26
+    unsigned int s11;      // 26 : x27
+    unsigned int t3;       // 27 : x28
+    unsigned int t4;       // 28 : x29
+    unsigned int t5;       // 29 : x30
+    unsigned int t6;       // 30 : x31
+    unsigned int sepc;     // 31 : トラップ発生時のプログラムカウンタ (sretの戻り先)
+    unsigned int sstatus;  // 32 : トラップ発生時の状態
+    unsigned int scause;   // 33 : トラップの原因 (参照のみ)
+    unsigned int stval;    // 34 : トラップの付加情報 (参照のみ)
+    unsigned int reserved; // 35 : 16バイト境界に揃えるための予約領域
+};
+/**
+ * @brief ユーザーモードのスレッドのカーネルスタックの末端
+ * @note ユーザーモードで実行中はsscratchがここを指し、トラップの入口処理はこの直下にトラップフレームを作る
+ *       トラップ発生時のtpはユーザーの値のため、自ハートの管理情報はここから読み込む
+ *       (スレッドが他のハートへ移る場合があるため、ユーザーモードへ戻るたびに設定し直す)
+ */
+struct user_stack_top
+{
+    struct hart *hart;        // 自ハートの管理情報 (trap_frameの直後 : 36)
+    unsigned int reserved[3]; // 16バイト境界に揃えるための予約領域
+};
+/**
+ * @brief トラップハンドラの型
+ * @param tf : トラップフレーム (変更した内容はトラップからの復帰時にレジスタへ反映される)
+ */
+typedef void (*trap_handler_t)(struct trap_frame *tf);
+/**
+ * @brief 未対応のトラップの処理
+ * @param tf : トラップフレーム
+ * @details 継続できないトラップのため、原因を表示して停止する
+ */
+void handle_unknown_trap(struct trap_frame *tf)
+{
+    printf("trap: scause = 0x%08x, sepc = 0x%08x, stval = 0x%08x\n", tf->scause, tf->sepc, tf->stval);
+    console_sync();
+    for (;;)
+        ;
+}
+/**
+ * @brief ブレークポイント例外の処理
+ * @param tf : トラップフレーム
+ * @details ebreak命令の次の命令から再開する
+ *          C拡張ではc.ebreak(2バイト)になるため、命令の下位2ビットで命令長を判定する
+ */
+void handle_breakpoint(struct trap_frame *tf)
+{
+    unsigned short insn = *(unsigned short *)tf->sepc;
+    tf->sepc += ((insn & 0x3) == 0x3) ? 4 : 2;
+}
+/**
+ * @brief ソフトウェア割り込み(IPI)の処理
+ * @param tf : トラップフレーム
+ * @details 保留中のソフトウェア割り込みをクリアし、他のハートから追加されたスレッドを実行可能キューへ移す
+ *          (wfiで停止中のハートは、この割り込みで起きてスケジューラを呼び出す)
+ */
+void handle_software_interrupt(struct trap_frame *tf)
+{
+    (void)tf;
+    __asm__ __volatile__("csrc sip, %0\n" ::"r"(SIP_SSIP)); /* sipのSSIPビットをクリア */
+    if (current_thread() != NULL)
+    {
+        drain_inbox(this_hart());
+    }
+}
+/**
+ * @brief トラップハンドラのテーブル
+ * @note scauseの要因コードをインデックスとして、割り込みと例外それぞれのハンドラを登録する
+ *       NULLの要因はhandle_unknown_trapで処理する
+ */
+trap_handler_t g_interrupt_handlers[TRAP_CAUSE_NUM] = {
+    [SCAUSE_S_SOFTWARE_INTERRUPT] = handle_software_interrupt,
+    [SCAUSE_S_TIMER_INTERRUPT] = handle_timer_interrupt,
+    [SCAUSE_S_EXTERNAL_INTERRUPT] = handle_external_interrupt,
+};
+trap_handler_t g_exception_handlers[TRAP_CAUSE_NUM] = {
+    [SCAUSE_BREAKPOINT] = handle_breakpoint,
+};
+/**
+ * @brief トラップハンドラの登録
+ * @param scause  : 登録するトラップの要因 (割り込みの場合はSCAUSE_INTERRUPTを含める)
+ * @param handler : トラップハンドラ
+ */
+void register_trap_handler(unsigned int scause, trap_handler_t handler)
+{
+    unsigned int code = scause & ~SCAUSE_INTERRUPT;
+    if (code >= TRAP_CAUSE_NUM)
+    {
+        return;
+    }
+    if (scause & SCAUSE_INTERRUPT)
+    {
+        g_interrupt_handlers[code] = handler;
+    }
+    else
+    {
+        g_exception_handlers[code] = handler;
+    }
+}
+/**
+ * @brief スタックあふれ時に使うスタック(グローバル変数)
+ * @note スタックあふれは継続できないため、全ハートで共有する
+ */
+__attribute__((aligned(16))) char g_overflow_stack[PAGE_SIZE];
+/**
+ * @brief スタックあふれの処理
+ * @param sp    : あふれたスタックポインタ
+ * @param sepc  : トラップ発生時のプログラムカウンタ
+ * @param stval : トラップの付加情報 (ページフォルトのアドレス)
+ * @details ガードページにかかったスタック枠の番号とアドレスを表示して停止する
+ */
+void handle_stack_overflow(unsigned int sp, unsigned int sepc, unsigned int stval)
+{
+    printf("stack overflow: slot %d sp = 0x%08x, sepc = 0x%08x, stval = 0x%08x\n",
+           (sp - THREAD_STACK_AREA) >> THREAD_STACK_SLOT_SHIFT, sp, sepc, stval);
+    console_sync();
+    for (;;)
+        ;
+}
+/**
+ * @brief スタックあふれ時のトラップの入口処理
+ * @details トラップフレームをガードページに書き込むとトラップが繰り返されるため、
+ *          スタックあふれ用のスタックへ切り替えてからhandle_stack_overflowを呼び出す (戻らない)
+ */
+__attribute__((naked)) /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+void
+trap_stack_overflow(void)
+{
+    __asm__ __volatile__(
+        "mv a0, sp\n"               /* 第1引数: あふれたスタックポインタ */
+        "la sp, g_overflow_stack\n" /* スタックあふれ用のスタックの末端をスタックポインタへ設定 */
+        "li t0, %0\n"
+        "add sp, sp, t0\n"
+        "csrr a1, sepc\n"           /* 第2引数: トラップ発生時のプログラムカウンタ */
+        "csrr a2, stval\n"          /* 第3引数: トラップの付加情報 */
+        "call handle_stack_overflow\n"
+        :
+        : "i"(PAGE_SIZE)
+        :);
+}
+/**
+ * @brief トラップの入口処理
+ * @details トラップ発生時にCPUが最初に実行する処理(stvecに設定する)
+ *          全汎用レジスタとsepc/sstatus(参照用にscause/stval)をスタック上のトラップフレームに保存し、
+ *          trap_handlerを呼び出した後、トラップフレームから全て復元してsretで割り込み元へ戻る
+ *          sepc/sstatusを保存しておくことで、トラップ処理中にスレッドが切り替わっても元の状態へ戻れる
+ *          トラップフレームを書き込む前に、スレッドのスタック枠のガードページにかからないかを確認する
+ *          (スタック枠は2のべき乗のサイズに揃えているため、シフトだけで判定できる)
+ *          sscratchはSモードでは0、ユーザーモードではカーネルスタックの末端(struct user_stack_top)を指す
+ *          ユーザーモードからのトラップはカーネルスタックへ切り替え、高速パスのシステムコールは
+ *          sp/tp/gp/ra/sepc/sstatusだけを保存してシステムコールのテーブルの関数を直接呼び出す (引数はレジスタのまま)
+ *          浮動小数点レジスタを持つ場合、sstatus.FSはトラップフレームの値ではなく現在の値のまま戻る (TRAP_KEEP_FS)
+ */
+#ifdef __riscv_flen
+/**
+ * @brief sstatusの復元でFSを現在の値のままにする (t0:復元するsstatus、t1を使用)
+ * @note FSは切り替え先のスレッドが浮動小数点レジスタの持ち主かどうかを示すため(fpu_switch)、
+ *       トラップ発生時の古い値に戻すと、他のスレッドのレジスタをそのまま使わせてしまう
+ */
+#define TRAP_KEEP_FS        \
+    "csrr t1, sstatus\n"    \
+    "xor t1, t1, t0\n"      \
+    "srli t1, t1, 13\n"     \
+    "andi t1, t1, 3\n"      \
+    "slli t1, t1, 13\n"     \
+    "xor t0, t0, t1\n" /* FSのビットだけを現在の値にする */
+#else
+#define TRAP_KEEP_FS ""
+#endif
+__attribute__((naked))      /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+__attribute__((aligned(4))) /* stvecの下位2ビットはモード指定のため、4バイト境界に配置 */
+void
+trap_entry(void)
+{
+    __asm__ __volatile__(
+        /* トラップ発生元のモードの確認 */
+        "csrrw sp, sscratch, sp\n"       /* spとsscratchを入れ替える */
+        "bnez sp, trap_from_user\n"      /* ユーザーモードから (spはカーネルスタックの末端) */
+        "csrrw sp, sscratch, t0\n"       /* Sモードから: spを戻し、t0をsscratchへ退避 */
+        /* スタックあふれの確認 (トラップフレームがスレッドのスタック枠のガードページにかかる場合) */
+        "li t0, %0\n"                    /* スレッドのスタック領域の先頭 + トラップフレームのサイズ */
+        "sub t0, sp, t0\n"               /* トラップフレームの先頭の、スタック領域の先頭からのオフセット */
+        "srli t0, t0, %1\n"              /* スタック領域の外なら0以外 */
+        "bnez t0, 1f\n"
+        "li t0, %0\n"                    /* (使えるレジスタがt0だけのため、オフセットを求め直す) */
+        "sub t0, sp, t0\n"
+        "slli t0, t0, 32 - %2\n"         /* スタック枠内のオフセットだけを残す */
+        "srli t0, t0, 32 - %2 + 12\n"    /* スタック枠内のページ番号 */
+        "addi t0, t0, -%3\n"             /* ガードページの数を引き、負ならガードページ */
+        "bltz t0, trap_stack_overflow\n" /* スタックあふれ (戻らない) */
+        "1:\n"
+        "csrrw t0, sscratch, sp\n" /* t0を戻し、トラップ発生時のspをsscratchへ */
+        "j trap_save\n"
+        /* ユーザーモードからのトラップ (sscratchはユーザーのsp) */
+        "trap_from_user:\n"
+        "sw t0, (4 - 36) * 4(sp)\n"   /* t0をトラップフレームの位置へ退避 */
+        "csrr t0, scause\n"
+        "addi t0, t0, -%4\n"
+        "bnez t0, 2f\n"               /* ecall以外は通常のパス */
+        "sltiu t0, a7, %5\n"
+        "bnez t0, trap_fast_syscall\n" /* 高速パスのシステムコール */
+        "2:\n"
+        "lw t0, (4 - 36) * 4(sp)\n" /* t0を戻す */
+        /* スタック上にトラップフレーム(struct trap_frame)の領域を作る */
+        "trap_save:\n"
+        "addi sp, sp, -4 * 36\n"
+        /* 汎用レジスタの保存 (spは後で保存) */
+        "sw ra,   0 * 4(sp)\n"
+        "sw gp,   2 * 4(sp)\n"
+        "sw tp,   3 * 4(sp)\n"
+        "sw t0,   4 * 4(sp)\n"
+        "sw t1,   5 * 4(sp)\n"
+        "sw t2,   6 * 4(sp)\n"
+        "sw s0,   7 * 4(sp)\n"
+        "sw s1,   8 * 4(sp)\n"
+        "sw a0,   9 * 4(sp)\n"
+        "sw a1,  10 * 4(sp)\n"
+        "sw a2,  11 * 4(sp)\n"
+        "sw a3,  12 * 4(sp)\n"
+        "sw a4,  13 * 4(sp)\n"
+        "sw a5,  14 * 4(sp)\n"
+        "sw a6,  15 * 4(sp)\n"
+        "sw a7,  16 * 4(sp)\n"
+        "sw s2,  17 * 4(sp)\n"
+        "sw s3,  18 * 4(sp)\n"
+        "sw s4,  19 * 4(sp)\n"
+        "sw s5,  20 * 4(sp)\n"
+        "sw s6,  21 * 4(sp)\n"
+        "sw s7,  22 * 4(sp)\n"
+        "sw s8,  23 * 4(sp)\n"
+        "sw s9,  24 * 4(sp)\n"
+        "sw s10, 25 * 4(sp)\n"
+        "sw s11, 26 * 4(sp)\n"
+        "sw t3,  27 * 4(sp)\n"
+        "sw t4,  28 * 4(sp)\n"
+        "sw t5,  29 * 4(sp)\n"
+        "sw t6,  30 * 4(sp)\n"
+        /* トラップ発生時のスタックポインタを保存 (Sモードではsscratchを0に戻す) */
+        "csrrw t0, sscratch, zero\n"
+        "sw t0,   1 * 4(sp)\n"
+        /* トラップ発生時のプログラムカウンタ・状態・原因を保存 */
+        "csrr t0, sepc\n"
+        "sw t0,  31 * 4(sp)\n"
+        "csrr t0, sstatus\n"
+        "sw t0,  32 * 4(sp)\n"
+        "andi t0, t0, %6\n"
+        "bnez t0, 3f\n"
+        "lw tp,  36 * 4(sp)\n" /* ユーザーモードから: tpを自ハートの管理情報にする */
+        "3:\n"
+        "csrr t0, scause\n"
+        "sw t0,  33 * 4(sp)\n"
+        "csrr t0, stval\n"
+        "sw t0,  34 * 4(sp)\n"
+        /* トラップハンドラの呼び出し (第1引数はトラップフレーム) */
+        "mv a0, sp\n"
+        "call trap_handler\n"
+        /* トラップ発生時のプログラムカウンタと状態を復元 (sstatus.SIEは0のまま) */
+        "trap_restore:\n"
+        "lw t0,  31 * 4(sp)\n"
+        "csrw sepc, t0\n"
+        "lw t0,  32 * 4(sp)\n"
+        TRAP_KEEP_FS
+        "csrw sstatus, t0\n"
+        /* ユーザーモードへ戻る場合は、次のトラップのためにsscratchと自ハートの管理情報を設定し、ユーザーのtpを戻す */
+        /* Sモードへ戻る場合、tpは自ハートの管理情報を指すため復元しない (トラップ処理中にスレッドが他のハートへ移る場合がある) */
+        "andi t0, t0, %6\n"
+        "bnez t0, 4f\n"
+        "addi t0, sp, 4 * 36\n"
+        "sw tp, 0(t0)\n"
+        "csrw sscratch, t0\n"
+        "lw tp,   3 * 4(sp)\n"
+        "4:\n"
+        /* 汎用レジスタの復元 (spは最後に復元) */
+        "lw ra,   0 * 4(sp)\n"
+        "lw gp,   2 * 4(sp)\n"
+        "lw t0,   4 * 4(sp)\n"
+        "lw t1,   5 * 4(sp)\n"
+        "lw t2,   6 * 4(sp)\n"
+        "lw s0,   7 * 4(sp)\n"
+        "lw s1,   8 * 4(sp)\n"
+        "lw a0,   9 * 4(sp)\n"
+        "lw a1,  10 * 4(sp)\n"
+        "lw a2,  11 * 4(sp)\n"
+        "lw a3,  12 * 4(sp)\n"
+        "lw a4,  13 * 4(sp)\n"
+        "lw a5,  14 * 4(sp)\n"
+        "lw a6,  15 * 4(sp)\n"
+        "lw a7,  16 * 4(sp)\n"
+        "lw s2,  17 * 4(sp)\n"
+        "lw s3,  18 * 4(sp)\n"
+        "lw s4,  19 * 4(sp)\n"
+        "lw s5,  20 * 4(sp)\n"
+        "lw s6,  21 * 4(sp)\n"
+        "lw s7,  22 * 4(sp)\n"
+        "lw s8,  23 * 4(sp)\n"
+        "lw s9,  24 * 4(sp)\n"
+        "lw s10, 25 * 4(sp)\n"
+        "lw s11, 26 * 4(sp)\n"
+        "lw t3,  27 * 4(sp)\n"
+        "lw t4,  28 * 4(sp)\n"
+        "lw t5,  29 * 4(sp)\n"
+        "lw t6,  30 * 4(sp)\n"
+        "lw sp,   1 * 4(sp)\n"
+        /* トラップ発生元へ戻る (sstatus.SPIEがSIEへ戻される) */
+        "sret\n"
+        /* 高速パスのシステムコール (sscratchはユーザーのsp、t0はトラップフレームの位置に退避済み) */
+        "trap_fast_syscall:\n"
+        "addi sp, sp, -4 * 36\n"
+        "sw ra,   0 * 4(sp)\n"
+        "sw gp,   2 * 4(sp)\n"
+        "sw tp,   3 * 4(sp)\n"
+        "csrrw t0, sscratch, zero\n"
+        "sw t0,   1 * 4(sp)\n"
+        "csrr t0, sepc\n"
+        "addi t0, t0, 4\n"         /* ecallの次の命令へ戻る */
+        "sw t0,  31 * 4(sp)\n"
+        "csrr t0, sstatus\n"
+        "sw t0,  32 * 4(sp)\n"
+        "lw tp,  36 * 4(sp)\n"     /* 自ハートの管理情報 */
+        "la t0, g_syscall_table\n" /* システムコールのテーブルから関数を引く */
+        "slli a7, a7, 2\n"
+        "add t0, t0, a7\n"
+        "lw t0, 0(t0)\n"
+        "jalr t0\n"                /* a0〜a2はユーザーの値のまま引数になり、戻り値はa0 */
+        /* sepc/sstatusを戻す (CPUを譲った場合は他のトラップで書き換えられている) */
+        "lw t0,  31 * 4(sp)\n"
+        "csrw sepc, t0\n"
+        "lw t0,  32 * 4(sp)\n"
+        TRAP_KEEP_FS
+        "csrw sstatus, t0\n"
+        "addi t0, sp, 4 * 36\n"
+        "sw tp, 0(t0)\n"
+        "csrw sscratch, t0\n"
+        "lw ra,   0 * 4(sp)\n"
+        "lw gp,   2 * 4(sp)\n"
+        "lw tp,   3 * 4(sp)\n"
+        /* 壊れるレジスタはカーネルの値が見えないように0にする */
+        "li t0, 0\n"
+        "li t1, 0\n"
+        "li t2, 0\n"
+        "li t3, 0\n"
+        "li t4, 0\n"
+        "li t5, 0\n"
+        "li t6, 0\n"
+        "li a1, 0\n"
+        "li a2, 0\n"
+        "li a3, 0\n"
+        "li a4, 0\n"
+        "li a5, 0\n"
+        "li a6, 0\n"
+        "li a7, 0\n"
+        "lw sp,   1 * 4(sp)\n"
+        "sret\n"
+        :                                      /* 出力オペランドはなし */
+        : "i"(THREAD_STACK_AREA + 4 * 36),     /* スレッドのスタック領域の先頭 + トラップフレームのサイズ */
+          "i"(THREAD_STACK_AREA_SHIFT),        /* スレッドのスタック領域のサイズ(2のべき乗) */
+          "i"(THREAD_STACK_SLOT_SHIFT),        /* スタック枠のサイズ(2のべき乗) */
+          "i"(THREAD_STACK_GUARD_PAGES),       /* スタック枠のガードページの数 */
+          "i"(SCAUSE_ECALL_U),                 /* ユーザーモードからのecallの要因コード */
+          "i"(SYS_FAST_NUM),                   /* 高速パスで処理するシステムコールの数 */
+          "i"(SSTATUS_SPP)                     /* トラップ発生前のモード */
+        :);
+}
+/**
+ * @brief ユーザーモードへの移行 (戻らない)
+ * @param entry : ユーザーモードで最初に実行するアドレス
+ * @param sp    : ユーザーのスタックポインタ
+ * @param top   : カーネルスタックの末端 (以降のトラップで使うカーネルスタック)
+ * @details sscratchにカーネルスタックの末端を設定し、sstatus.SPP=0(ユーザーモード)・SPIE=1(割り込み許可)にしてsretする
+ *          カーネルの値が見えないように、sp以外の汎用レジスタは全て0にする (割り込み禁止で呼び出すこと)
+ */
+__attribute__((naked)) /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+void
+user_enter(unsigned int entry, unsigned int sp, struct user_stack_top *top)
+{
+    __asm__ __volatile__(
+        "sw tp, 0(a2)\n"       /* 自ハートの管理情報 */
+        "csrw sscratch, a2\n"  /* ユーザーモードからのトラップで使うカーネルスタック */
+        "csrw sepc, a0\n"      /* sretの戻り先 */
+        "li t0, %0\n"
+        "csrc sstatus, t0\n"   /* ユーザーモードへ戻る */
+        "li t0, %1\n"
+        "csrs sstatus, t0\n"   /* ユーザーモードでは割り込みを許可する */
+        "mv sp, a1\n"
+        "li ra, 0\n"
+        "li gp, 0\n"
+        "li tp, 0\n"
+        "li t0, 0\n"
+        "li t1, 0\n"
+        "li t2, 0\n"
+        "li s0, 0\n"
+        "li s1, 0\n"
+        "li a0, 0\n"
+        "li a1, 0\n"
+        "li a2, 0\n"
+        "li a3, 0\n"
+        "li a4, 0\n"
+        "li a5, 0\n"
+        "li a6, 0\n"
+        "li a7, 0\n"
+        "li s2, 0\n"
+        "li s3, 0\n"
+        "li s4, 0\n"
+        "li s5, 0\n"
+        "li s6, 0\n"
+        "li s7, 0\n"
+        "li s8, 0\n"
+        "li s9, 0\n"
+        "li s10, 0\n"
+        "li s11, 0\n"
+        "li t3, 0\n"
+        "li t4, 0\n"
+        "li t5, 0\n"
+        "li t6, 0\n"
+        "sret\n"
+        :
+        : "i"(SSTATUS_SPP), "i"(SSTATUS_SPIE)
+        :);
+}
+/**
+ * @brief トラップフレームからのユーザーモードへの移行 (戻らない)
+ * @param frame : ユーザーモードのレジスタ (sepc・sstatusを含む)
+ * @param top   : カーネルスタックの末端 (以降のトラップで使うカーネルスタック)
+ * @details trap_entryと同じ位置(カーネルスタックの末端の直下)へトラップフレームを複写し、trap_entryの復元処理からsretする
+ *          複写先は呼び出し元の関数のスタックと重なるため、スタックを使わずにレジスタだけで複写する (割り込み禁止で呼び出すこと)
+ */
+__attribute__((naked)) /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+void
+user_enter_frame(const struct trap_frame *frame, struct user_stack_top *top)
+{
+    __asm__ __volatile__(
+        "addi t1, a1, -4 * 36\n" /* トラップフレームの位置 */
+        "mv t0, t1\n"
+        "1:\n"
+        "lw t2, 0(a0)\n"
+        "sw t2, 0(t0)\n"
+        "addi a0, a0, 4\n"
+        "addi t0, t0, 4\n"
+        "bne t0, a1, 1b\n"
+        "mv sp, t1\n"
+        "j trap_restore\n"       /* sscratch・自ハートの管理情報を設定し、全レジスタを復元してsretする */
+        ::
+            :);
+}
+/**
+ * @brief コンテキストスッチの処理
+ * @param prev_sp   : 前回のスタックポインタ
+ * @param next_sp   : 次回のスタックポインタ
+ * @details 現在のレジスタの状態を保存し、新しいスタックポインタに切り替えてから、以前の状態を復元します。
+ */
+__attribute__((naked)) /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+void
+switch_context(unsigned int *prev_sp, unsigned int *next_sp)
+{
+    /*
+        switch_contextが呼ばれると、a0/a1レジスタにprev_sp/next_spが設定され、
+        スタックポインタの位置の更新、フレームポインタの設定などが行われます。
+    */
+    __asm__ __volatile__(
+        /* 新しいスタックフレームを作成して、レジスタの値を保存する領域を作る */
+        "addi sp, sp, -13 * 4 \n"
+        /* レジスタの値をスタック(メモリ)に保存 (レジスタの保存) */
+        /* s1からs11の保存レジスタは、関数の呼び出し間でデータを保持するもので、関数をまたいでもその値が保持される */
+        "sw ra,   0 * 4(sp)\n" /* 現在のspの位置にリターンアドレスを保存 */
+        "sw s0,   1 * 4(sp)\n" /* 現在のspの位置から4バイトずらした位置にフレームポインタを保存 */
+        "sw s1,   2 * 4(sp)\n" /* 現在のspの位置から8バイトずらした位置に保存レジスタを保存 */
+        "sw s2,   3 * 4(sp)\n" /* 現在のspの位置から12バイトずらした位置に保存レジスタを保存 */
+        "sw s3,   4 * 4(sp)\n" /* 現在のspの位置から16バイトずらした位置に保存レジスタを保存 */
+        "sw s4,   5 * 4(sp)\n" /* 現在のspの位置から20バイトずらした位置に保存レジスタを保存 */
+        "sw s5,   6 * 4(sp)\n" /* 現在のspの位置から24バイトずらした位置に保存レジスタを保存 */
+        "sw s6,   7 * 4(sp)\n" /* 現在のspの位置から28バイトずらした位置に保存レジスタを保存 */
+        "sw s7,   8 * 4(sp)\n" /* 現在のspの位置から32バイトずらした位置に保存レジスタを保存 */
+        "sw s8,   9 * 4(sp)\n" /* 現在のspの位置から36バイトずらした位置に保存レジスタを保存 */
+        "sw s9,  10 * 4(sp)\n" /* 現在のspの位置から40バイトずらした位置に保存レジスタを保存 */
+        "sw s10, 11 * 4(sp)\n" /* 現在のspの位置から44バイトずらした位置に保存レジスタを保存 */
+        "sw s11, 12 * 4(sp)\n" /* 現在のspの位置から48バイトずらした位置に保存レジスタを保存 */
+        /* 現在のスタックポインタの位置をa0が指すアドレスに保存 */
+        /* a0は、関数呼び出しの第1引数であり、prev_spをとなる */
+        "sw sp,  (a0)\n"
+        /* a1が指すデータを現在のスタックポインタにする */
+        /*
+            a1は、関数呼び出しの第2引数であり、next_spをとなる
+            next_spのスタックのアドレスをレジスタのスタックポインタに設定する
+            ここからnext_spのスタックをレジスタが処理する
+        */
+        "lw sp,  (a1)\n"
+        /* ここから、next_spのスタックに保存していた値をレジスタにロード (レジスタの復元) */
+        "lw ra,   0 * 4(sp)\n" /* 現在のsp位置のデータをリターンアドレスに設定 */
+        "lw s0,   1 * 4(sp)\n" /* 現在のsp位置から4バイト先のデータをフレームポインタに設定 */
+        "lw s1,   2 * 4(sp)\n" /* 現在のsp位置から8バイト先のデータを保存レジスタに設定 */
+        "lw s2,   3 * 4(sp)\n" /* 現在のsp位置から12バイト先のデータを保存レジスタに設定 */
+        "lw s3,   4 * 4(sp)\n" /* 現在のsp位置から16バイト先のデータを保存レジスタに設定 */
+        "lw s4,   5 * 4(sp)\n" /* 現在のsp位置から20バイト先のデータを保存レジスタに設定 */
+        "lw s5,   6 * 4(sp)\n" /* 現在のsp位置から24バイト先のデータを保存レジスタに設定 */
+        "lw s6,   7 * 4(sp)\n" /* 現在のsp位置から28バイト先のデータを保存レジスタに設定 */
+        "lw s7,   8 * 4(sp)\n" /* 現在のsp位置から32バイト先のデータを保存レジスタに設定 */
+        "lw s8,   9 * 4(sp)\n" /* 現在のsp位置から36バイト先のデータを保存レジスタに設定 */
+        "lw s9,  10 * 4(sp)\n" /* 現在のsp位置から40バイト先のデータを保存レジスタに設定 */
+        "lw s10, 11 * 4(sp)\n" /* 現在のsp位置から44バイト先のデータを保存レジスタに設定 */
+        "lw s11, 12 * 4(sp)\n" /* 現在のsp位置から48バイト先のデータを保存レジスタに設定 */
+        /* スタックポインタの位置を戻す */
+        "addi sp, sp, 13 * 4 \n"
+        /* 終了 */
+        "ret\n");
+}
+/**
+ * @brief ワード単位のメモリアクセス
+ * @note memset/memcpy/memmoveは任意の型の領域をワード単位で読み書きするため、may_aliasで型に基づく最適化の対象外にする
+ */
+typedef unsigned int __attribute__((may_alias)) mem_word_t;
+/**
+ * @brief メモリ領域の初期化
+ * @param buf : 初期化するメモリ領域の先頭アドレス
+ * @param c   : 設定する値 (下位8ビットを使用)
+ * @param n   : 初期化するバイト数
+ * @return bufの値
+ * @details 先頭をバイト単位で4バイト境界に揃え、32バイト(8ワード)ずつ展開したループ、ワード単位、末尾をバイト単位の順に書き込む
+ * @note コンパイラが構造体の初期化などでmemsetの呼び出しを生成することがあるため、標準ライブラリと同じ名前で定義する
+ */
+void *memset(void *buf, int c, unsigned int n)
+{
+    unsigned char *p = (unsigned char *)buf;
+    while ((n > 0) && ((unsigned int)p & 3))
+    {
+        *p++ = (unsigned char)c;
+        n--;
+    }
+    unsigned int word = (unsigned char)c * 0x01010101u;
+    mem_word_t *w = (mem_word_t *)p;
+    for (; n >= 32; n -= 32, w += 8)
+    {
+        w[0] = word;
+        w[1] = word;
+        w[2] = word;
+        w[3] = word;
+        w[4] = word;
+        w[5] = word;
+        w[6] = word;
+        w[7] = word;
+    }
+    for (; n >= 4; n -= 4)
+    {
+        *w++ = word;
+    }
+    p = (unsigned char *)w;
+    while (n--)
+    {
+        *p++ = (unsigned char)c;
+    }
+    return buf;
+}
+/**
+ * @brief メモリ領域の複写
+ * @param dst : 複写先の先頭アドレス
+ * @param src : 複写元の先頭アドレス (複写先と重ならないこと。複写先が前にある場合は重なってもよい)
+ * @param n   : 複写するバイト数
+ * @return dstの値
+ * @details 複写先をバイト単位で4バイト境界に揃えてからワード単位で複写する
+ *          複写元も揃っていれば8ワードずつ展開したループ、揃っていなければ境界に揃えた2ワードをシフトして組み合わせる
+ *          (ずれた位置のワードアクセスは実装によってトラップしてエミュレートされ、非常に遅いため使わない)
+ * @note memsetと同じく、コンパイラが構造体の代入などで呼び出しを生成することがあるため、標準ライブラリと同じ名前で定義する
+ */
+void *memcpy(void *dst, const void *src, unsigned int n)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    while ((n > 0) && ((unsigned int)d & 3))
+    {
+        *d++ = *s++;
+        n--;
+    }
+    mem_word_t *w = (mem_word_t *)d;
+    unsigned int words = n / 4;
+    if (((unsigned int)s & 3) == 0)
+    {
+        const mem_word_t *sw = (const mem_word_t *)s;
+        for (; words >= 8; words -= 8, w += 8, sw += 8)
+        {
+            w[0] = sw[0];
+            w[1] = sw[1];
+            w[2] = sw[2];
+            w[3] = sw[3];
+            w[4] = sw[4];
+            w[5] = sw[5];
+            w[6] = sw[6];
+            w[7] = sw[7];
+        }
+        while (words--)
+        {
+            *w++ = *sw++;
+        }
+    }
+    else if (words > 0)
+    {
+        // リトルエンディアンのため、前のワードの上位バイトと次のワードの下位バイトを組み合わせる
+        // (読み込むのは複写する範囲のバイトを含むワードだけのため、範囲外のページには触れない)
+        unsigned int shift = ((unsigned int)s & 3) * 8;
+        const mem_word_t *sw = (const mem_word_t *)((unsigned int)s & ~3);
+        unsigned int prev = *sw++;
+        for (unsigned int i = 0; i < words; i++)
+        {
+            unsigned int next = *sw++;
+            *w++ = (prev >> shift) | (next << (32 - shift));
+            prev = next;
+        }
+    }
+    d = (unsigned char *)w;
+    s += n & ~3u;
+    n &= 3;
+    while (n--)
+    {
+        *d++ = *s++;
+    }
+    return dst;
+}
+/**
+ * @brief メモリ領域の移動 (重なりを考慮した複写)
+ * @param dst : 複写先の先頭アドレス
+ * @param src : 複写元の先頭アドレス
+ * @param n   : 複写するバイト数
+ * @return dstの値
+ * @details 複写先が複写元より前、もしくは重ならなければmemcpy(前から複写)を使う
+ *          複写先が後ろで重なる場合は後ろから複写する (境界のずれが同じならワード単位、異なればバイト単位)
+ */
+void *memmove(void *dst, const void *src, unsigned int n)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    if ((d <= s) || (d >= s + n))
+    {
+        return memcpy(dst, src, n);
+    }
+    d += n;
+    s += n;
+    if ((((unsigned int)d ^ (unsigned int)s) & 3) == 0)
+    {
+        while ((n > 0) && ((unsigned int)d & 3))
+        {
+            *--d = *--s;
+            n--;
+        }
+        mem_word_t *w = (mem_word_t *)d;
+        const mem_word_t *sw = (const mem_word_t *)s;
+        for (; n >= 32; n -= 32)
+        {
+            w -= 8;
+            sw -= 8;
+            w[7] = sw[7];
+            w[6] = sw[6];
+            w[5] = sw[5];
+            w[4] = sw[4];
+            w[3] = sw[3];
+            w[2] = sw[2];
+            w[1] = sw[1];
+            w[0] = sw[0];
+        }
+        for (; n >= 4; n -= 4)
+        {
+            *--w = *--sw;
+        }
+        d = (unsigned char *)w;
+        s = (const unsigned char *)sw;
+    }
+    while (n--)
+    {
+        *--d = *--s;
+    }
+    return dst;
+}
+/**
+ * @brief メモリ領域の比較
+ * @param a : メモリ領域の先頭アドレス
+ * @param b : メモリ領域の先頭アドレス
+ * @param n : 比較するバイト数
+ * @return 一致すれば0、異なれば最初に異なるバイトの差
+ */
+int memcmp(const void *a, const void *b, unsigned int n)
+{
+    const unsigned char *p = (const unsigned char *)a;
+    const unsigned char *q = (const unsigned char *)b;
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if (p[i] != q[i])
+        {
+            return p[i] - q[i];
+        }
+    }
+    return 0;
+}
+/**
+ * @brief 文字列の長さ
+ * @param s : 文字列
+ * @return 終端の'\0'を除いたバイト数
+ */
+unsigned int strlen(const char *s)
+{
+    unsigned int len = 0;
+    while (s[len] != '\0')
+    {
+        len++;
+    }
+    return len;
+}
+/**
+ * @brief 文字列の比較
+ * @param a : 文字列
+ * @param b : 文字列
+ * @return 一致すれば0、異なれば最初に異なる文字の差
+ */
+int strcmp(const char *a, const char *b)
+{
+    while ((*a != '\0') && (*a == *b))
+    {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+/**
+ * @brief リンカスクリプトで定義した空きメモリ領域のシンボル
+ * @note 配列として宣言することで、シンボルのアドレスをそのまま領域の先頭/末尾として扱える
+ */
+extern char __free_ram[];     // 空きメモリ領域の先頭 (ページ境界)
+extern char __free_ram_end[]; // 空きメモリ領域の末尾
+/**
+ * @brief 空きブロック
+ * @note 空きブロックの先頭ページに書き込み、次数(order)ごとの双方向リストにつなぐ
+ *       双方向にすることで、結合するバディをリストからO(1)で外せる
+ */
+struct free_block
+{
+    struct free_block *next; // 次の空きブロック
+    struct free_block *prev; // 前の空きブロック
+};
+/**
+ * @brief ページ割り当て(バディシステム)(グローバル変数)
+ * @note 2^order ページのブロックを次数ごとの空きリストで管理する
+ *       ブロックは物理アドレスで 2^order ページ境界に揃えるため、バディはページ番号の
+ *       order番目のビットを反転するだけで求められる
+ *       g_page_infoはページごとの情報で、空きブロックの先頭ページには次数とPAGE_INFO_FREEを、
+ *       割り当て中のブロックの先頭ページには次数を設定する
+ *       g_page_shareはページごとの共有数で、コピーオンライトで複数のプロセスが対応付けているページの、
+ *       自分以外に対応付けているプロセスの数を持つ (0なら1つのプロセスだけが持つ)
+ */
+struct free_block g_free_area[PAGE_ORDER_NUM];   // 次数ごとの空きリスト (番兵)
+unsigned int g_free_block_count[PAGE_ORDER_NUM]; // 次数ごとの空きブロック数
+unsigned char *g_page_info;                      // ページごとの情報 (次数とPAGE_INFO_FREE)
+unsigned int *g_page_share;                      // ページごとの共有数 (コピーオンライト)
+unsigned int g_first_pfn;                        // 管理する最初のページ番号 (物理アドレス / PAGE_SIZE)
+unsigned int g_end_pfn;                          // 管理する最後のページ番号の次
+unsigned int g_total_page_count;                 // 管理するページ数
+unsigned int g_free_page_count;                  // 空きページ数
+struct spinlock g_page_lock;                     // 空きリストのロック
+/**
+ * @brief 空きリストへの追加
+ * @param pfn   : ブロックの先頭のページ番号
+ * @param order : ブロックの次数
+ */
+void push_free_block(unsigned int pfn, int order)
+{
+    struct free_block *head = &g_free_area[order];
+    struct free_block *block = (struct free_block *)(pfn * PAGE_SIZE);
+
+    block->next = head->next;
+    block->prev = head;
+    head->next->prev = block;
+    head->next = block;
+    g_page_info[pfn - g_first_pfn] = order | PAGE_INFO_FREE;
+    g_free_block_count[order]++;
+}
+/**
+ * @brief 空きリストからの削除
+ * @param pfn   : ブロックの先頭のページ番号
+ * @param order : ブロックの次数
+ */
+void remove_free_block(unsigned int pfn, int order)
+{
+    struct free_block *block = (struct free_block *)(pfn * PAGE_SIZE);
+
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+    g_page_info[pfn - g_first_pfn] = order;
+    g_free_block_count[order]--;
+}
+/**
+ * @brief ページ数から次数への変換
+ * @param n : ページ数
+ * @return n ページ以上を含む最小のブロックの次数
+ */
+int pages_to_order(unsigned int n)
+{
+    int order = 0;
+    while ((1u << order) < n)
+    {
+        order++;
+    }
+    return order;
+}
+/**
+ * @brief ページ割り当ての初期化
+ * @details 空きメモリ領域の先頭にページごとの共有数と情報を置き、残りの領域を
+ *          境界が揃う最大の大きさのブロックに分けて空きリストへ追加する
+ */
+void init_pages(void)
+{
+    unsigned int start_pfn = (unsigned int)__free_ram / PAGE_SIZE;
+    unsigned int end_pfn = (unsigned int)__free_ram_end / PAGE_SIZE;
+    unsigned int info_size = sizeof(unsigned int) + sizeof(unsigned char); // 1ページ当たりの共有数と情報のバイト数
+    unsigned int info_pages = ((end_pfn - start_pfn) * info_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    // ページごとの共有数と情報の領域 (共有数は4バイト境界に揃えるため先に置く)
+    g_page_share = (unsigned int *)__free_ram;
+    g_page_info = (unsigned char *)&g_page_share[end_pfn - start_pfn];
+    g_first_pfn = start_pfn + info_pages;
+    g_end_pfn = end_pfn;
+    g_total_page_count = g_end_pfn - g_first_pfn;
+    g_free_page_count = 0;
+    memset(g_page_share, 0, g_total_page_count * sizeof(unsigned int));
+    memset(g_page_info, 0, g_total_page_count);
+    // 空きリストの初期化
+    for (int order = 0; order < PAGE_ORDER_NUM; order++)
+    {
+        g_free_area[order].next = &g_free_area[order];
+        g_free_area[order].prev = &g_free_area[order];
+        g_free_block_count[order] = 0;
+    }
+    // 境界が揃う最大のブロックごとに空きリストへ追加
+    unsigned int pfn = g_first_pfn;
+    while (pfn < g_end_pfn)
+    {
+        int order = PAGE_ORDER_NUM - 1;
+        while ((pfn & ((1u << order) - 1)) || (pfn + (1u << order) > g_end_pfn))
+        {
+            order--;
+        }
+        push_free_block(pfn, order);
+        g_free_page_count += 1u << order;
+        pfn += 1u << order;
+    }
+}
+/**
+ * @brief ページの割り当て (次数指定)
+ * @param order : 割り当てるブロックの次数 (2^order ページ)
+ * @return 割り当てたページ領域の先頭アドレス (空きメモリがない場合はNULL)
+ * @details 必要な次数以上で最小の空きブロックを取り出し、余った半分ずつを下の次数の空きリストへ戻す
+ *          次数の段階数分しか処理しないため O(log n)
+ */
+void *alloc_pages_order(int order)
+{
+    void *paddr = NULL;
+    int current = order;
+
+    if ((order < 0) || (order >= PAGE_ORDER_NUM))
+    {
+        return NULL;
+    }
+    PROFILE_BEGIN(start);
+    unsigned int sie = spin_lock_irqsave(&g_page_lock);
+    // 空きブロックのある次数を探す
+    while ((current < PAGE_ORDER_NUM) && (g_free_area[current].next == &g_free_area[current]))
+    {
+        current++;
+    }
+    if (current < PAGE_ORDER_NUM)
+    {
+        unsigned int pfn = (unsigned int)g_free_area[current].next / PAGE_SIZE;
+        remove_free_block(pfn, current);
+        // 大きいブロックを分割し、後ろ半分(バディ)を空きリストへ戻す
+        while (current > order)
+        {
+            current--;
+            push_free_block(pfn + (1u << current), current);
+        }
+        g_page_info[pfn - g_first_pfn] = order;
+        g_free_page_count -= 1u << order;
+        paddr = (void *)(pfn * PAGE_SIZE);
+    }
+    spin_unlock_irqrestore(&g_page_lock, sie);
+    PROFILE_END(PROFILE_ALLOC_PAGES, start);
+    return paddr;
+}
+/**
+ * @brief ページの解放 (次数指定)
+ * @param paddr : alloc_pages_orderで割り当てたページ領域の先頭アドレス
+ * @param order : 割り当て時の次数
+ * @details バディが空いている間は結合して上の次数へ進み、最後に空きリストへ追加する (O(log n))
+ */
+void free_pages_order(void *paddr, int order)
+{
+    unsigned int pfn = (unsigned int)paddr / PAGE_SIZE;
+
+    unsigned int sie = spin_lock_irqsave(&g_page_lock);
+    g_free_page_count += 1u << order;
+    while (order < PAGE_ORDER_NUM - 1)
+    {
+        unsigned int buddy = pfn ^ (1u << order);
+        // バディが管理範囲外、もしくは同じ次数の空きブロックでなければ結合できない
+        if ((buddy < g_first_pfn) || (buddy + (1u << order) > g_end_pfn) ||
+            (g_page_info[buddy - g_first_pfn] != (order | PAGE_INFO_FREE)))
+        {
+            break;
+        }
+        remove_free_block(buddy, order);
+        g_page_info[buddy - g_first_pfn] = 0;
+        pfn &= ~(1u << order);
+        order++;
+    }
+    push_free_block(pfn, order);
+    spin_unlock_irqrestore(&g_page_lock, sie);
+}
+/**
+ * @brief ページの割り当て
+ * @param n : ページ数
+ * @return 割り当てたページ領域の先頭アドレス (空きメモリがない場合はNULL)
+ * @note n ページ以上を含む 2^order ページのブロックを割り当てる
+ */
+void *alloc_pages(unsigned int n)
+{
+    return alloc_pages_order(pages_to_order(n));
+}
+/**
+ * @brief ページの解放
+ * @param paddr : alloc_pagesで割り当てたページ領域の先頭アドレス
+ * @param n     : 割り当て時のページ数
+ */
+void free_pages(void *paddr, unsigned int n)
+{
+    free_pages_order(paddr, pages_to_order(n));
+}
+/**
+ * @brief 空きページの統計情報の表示
+ * @details 次数ごとの空きブロック数と空きページ数を表示する
+ */
+void print_page_stats(void)
+{
+    printf("pages: free %d / total %d\n", g_free_page_count, g_total_page_count);
+    for (int order = 0; order < PAGE_ORDER_NUM; order++)
+    {
+        printf("  order%d (%d KB): %d blocks, %d pages\n",
+               order, (PAGE_SIZE << order) / 1024, g_free_block_count[order], g_free_block_count[order] << order);
+    }
+}
+/**
+ * @brief リンカスクリプトで定義したカーネルイメージのシンボル
+ */
+extern char __kernel_base[]; // カーネルイメージの先頭
+/**
+ * @brief ページテーブル(グローバル変数)
+ * @note 仮想アドレスと物理アドレスが同じになるようにカーネルとRAM全体を対応付ける(ダイレクトマップ)
+ */
+unsigned int *g_kernel_page_table; // カーネルのページテーブル(1段目)
+unsigned int g_mapped_megapages;   // メガページ(4MB)で対応付けた数
+unsigned int g_mapped_pages;       // ページ(4KB)で対応付けた数
+/**
+ * @brief ページテーブル用のページの割り当て
+ * @return 0クリアしたページ (空きメモリがない場合はNULL)
+ */
+unsigned int *alloc_page_table(void)
+{
+    unsigned int *table = alloc_pages(1);
+    if (table != NULL)
+    {
+        memset(table, 0, PAGE_SIZE);
+    }
+    return table;
+}
+/**
+ * @brief ページ(4KB)の対応付け
+ * @param table1 : ページテーブル(1段目)
+ * @param vaddr  : 仮想アドレス (ページ境界)
+ * @param paddr  : 物理アドレス (ページ境界)
+ * @param flags  : ページテーブルエントリのフラグ (PAGE_R/PAGE_W/PAGE_X/PAGE_U)
+ * @retval 0     : 成功
+ * @retval -1    : 2段目のページテーブルを確保できない
+ * @details Sv32は2段のページテーブルで、仮想アドレスの上位10ビット(VPN[1])で1段目、
+ *          次の10ビット(VPN[0])で2段目のエントリを選ぶ
+ */
+int map_page(unsigned int *table1, unsigned int vaddr, unsigned int paddr, unsigned int flags)
+{
+    unsigned int vpn1 = (vaddr >> 22) & 0x3ff;
+    unsigned int vpn0 = (vaddr >> 12) & 0x3ff;
+
+    // 2段目のページテーブルがなければ作成する
+    if ((table1[vpn1] & PAGE_V) == 0)
+    {
+        unsigned int *table0 = alloc_page_table();
+        if (table0 == NULL)
+        {
+            return -1;
+        }
+        table1[vpn1] = (((unsigned int)table0 / PAGE_SIZE) << 10) | PAGE_V;
+    }
+    // 2段目のページテーブルのエントリを設定 (A/Dビットはあらかじめセットしておく)
+    unsigned int *table0 = (unsigned int *)((table1[vpn1] >> 10) * PAGE_SIZE);
+    table0[vpn0] = ((paddr / PAGE_SIZE) << 10) | flags | PAGE_A | PAGE_D | PAGE_V;
+    g_mapped_pages++;
+    return 0;
+}
+/**
+ * @brief ページテーブルエントリの検索
+ * @param table1 : ページテーブル(1段目)
+ * @param vaddr  : 仮想アドレス
+ * @return 仮想アドレスを対応付けているリーフのエントリ (2段目のページテーブルがない場合はNULL)
+ * @details メガページで対応付けている場合は1段目のエントリを返す (エントリが無効かどうかは呼び出し元で確認する)
+ */
+unsigned int *walk_page(unsigned int *table1, unsigned int vaddr)
+{
+    unsigned int *pte1 = &table1[(vaddr >> 22) & 0x3ff];
+    if ((*pte1 & PAGE_V) == 0)
+    {
+        return NULL;
+    }
+    if (*pte1 & (PAGE_R | PAGE_W | PAGE_X))
+    {
+        return pte1;
+    }
+    unsigned int *table0 = (unsigned int *)((*pte1 >> 10) * PAGE_SIZE);
+    return &table0[(vaddr >> 12) & 0x3ff];
+}
+/**
+ * @brief メガページ(4MB)の対応付け
+ * @param table1 : ページテーブル(1段目)
+ * @param vaddr  : 仮想アドレス (4MB境界)
+ * @param paddr  : 物理アドレス (4MB境界)
+ * @param flags  : ページテーブルエントリのフラグ (PAGE_R/PAGE_W/PAGE_X/PAGE_U)
+ * @details 1段目のエントリをリーフ(R/W/Xのいずれかがセット)にすると、4MBをまとめて対応付けられる
+ *          TLBの1エントリで4MBを扱えるため、TLBミスが減る
+ */
+void map_megapage(unsigned int *table1, unsigned int vaddr, unsigned int paddr, unsigned int flags)
+{
+    unsigned int vpn1 = (vaddr >> 22) & 0x3ff;
+    table1[vpn1] = ((paddr / PAGE_SIZE) << 10) | flags | PAGE_A | PAGE_D | PAGE_V;
+    g_mapped_megapages++;
+}
+/**
+ * @brief 領域の対応付け
+ * @param table1        : ページテーブル(1段目)
+ * @param vaddr         : 仮想アドレス (ページ境界)
+ * @param paddr         : 物理アドレス (ページ境界)
+ * @param size          : サイズ (ページ境界)
+ * @param flags         : ページテーブルエントリのフラグ
+ * @param use_megapages : 1ならアドレスが4MB境界に揃う部分をメガページで対応付ける
+ * @retval 0            : 成功
+ * @retval -1           : ページテーブルを確保できない
+ */
+int map_range(unsigned int *table1, unsigned int vaddr, unsigned int paddr, unsigned int size, unsigned int flags, int use_megapages)
+{
+    unsigned int end = vaddr + size;
+
+    while (vaddr < end)
+    {
+        if (use_megapages && ((vaddr % MEGAPAGE_SIZE) == 0) && ((paddr % MEGAPAGE_SIZE) == 0) &&
+            (end - vaddr >= MEGAPAGE_SIZE))
+        {
+            map_megapage(table1, vaddr, paddr, flags);
+            vaddr += MEGAPAGE_SIZE;
+            paddr += MEGAPAGE_SIZE;
+        }
+        else
+        {
+            if (map_page(table1, vaddr, paddr, flags) < 0)
+            {
+                return -1;
+            }
+            vaddr += PAGE_SIZE;
+            paddr += PAGE_SIZE;
+        }
+    }
+    return 0;
+}
+/**
+ * @brief ページテーブルの解放
+ * @param table1 : ページテーブル(1段目)
+ * @details 2段目のページテーブルと1段目のページテーブルを解放する (対応付けた先のページは解放しない)
+ */
+void free_page_table(unsigned int *table1)
+{
+    for (int vpn1 = 0; vpn1 < 1024; vpn1++)
+    {
+        // リーフでない(R/W/Xがない)有効なエントリは2段目のページテーブルを指す
+        if ((table1[vpn1] & PAGE_V) && ((table1[vpn1] & (PAGE_R | PAGE_W | PAGE_X)) == 0))
+        {
+            free_pages((void *)((table1[vpn1] >> 10) * PAGE_SIZE), 1);
+        }
+    }
+    free_pages(table1, 1);
+}
+/**
+ * @brief カーネルのページテーブルの作成
+ * @param use_megapages : 1なら4MB境界に揃う部分をメガページで対応付ける
+ * @return ページテーブル(1段目) (空きメモリがない場合はNULL)
+ * @details カーネルイメージとRAM全体(空きメモリ領域の末尾まで)を仮想アドレス=物理アドレスで対応付ける
+ *          UARTとPLICのレジスタ(MMIO)も同様に対応付ける (実行は不可)
+ */
+unsigned int *create_kernel_page_table(int use_megapages)
+{
+    unsigned int *table1 = alloc_page_table();
+    if (table1 == NULL)
+    {
+        return NULL;
+    }
+    unsigned int start = (unsigned int)__kernel_base;
+    unsigned int end = (unsigned int)__free_ram_end;
+    if (map_range(table1, start, start, end - start, PAGE_R | PAGE_W | PAGE_X, use_megapages) < 0 ||
+        map_range(table1, UART_BASE, UART_BASE, PAGE_SIZE, PAGE_R | PAGE_W, 0) < 0 ||
+        map_range(table1, PLIC_BASE, PLIC_BASE, PLIC_SIZE, PAGE_R | PAGE_W, use_megapages) < 0)
+    {
+        free_page_table(table1);
+        return NULL;
+    }
+    return table1;
+}
+/**
+ * @brief ページテーブルの切り替え
+ * @param table1 : ページテーブル(1段目)
+ * @details satpにSv32のモードとページテーブルの物理ページ番号を設定し、TLBを全て無効化する
+ */
+void switch_page_table(unsigned int *table1)
+{
+    unsigned int satp = SATP_SV32 | ((unsigned int)table1 / PAGE_SIZE);
+    __asm__ __volatile__(
+        "sfence.vma\n"     /* ページテーブルへの書き込みを反映 */
+        "csrw satp, %0\n"  /* ページテーブルを切り替え */
+        "sfence.vma\n"     /* 古い変換結果(TLB)を無効化 */
+        ::"r"(satp)        /* 入力オペランド: satpの値 */
+        : "memory");
+}
+/**
+ * @brief ASID(アドレス空間ID)(グローバル変数)
+ * @note TLBのエントリはsatpのASIDで区別されるため、プロセスごとにASIDを割り当てれば、切り替え時にTLBを無効化しなくてよい
+ *       ASIDは世代(generation)ごとに1から順に割り当て、使い切ったら世代を進めて全ハートのTLBを無効化し、1から割り当て直す
+ *       カーネルのページテーブルはASID 0を使う
+ */
+int g_asid_enable;                  // 1ならプロセスの切り替えでASIDを使う (0ならTLBを全て無効化する)
+unsigned int g_asid_max;            // 割り当てるASIDの最大値 (0ならASIDは実装されていない)
+unsigned int g_asid_generation = 1; // ASIDの世代
+unsigned int g_asid_next = 1;       // 次に割り当てるASID
+unsigned int g_asid_rollover_count; // ASIDを使い切って世代を進めた回数
+struct spinlock g_asid_lock;        // ASIDの割り当てのロック
+/**
+ * @brief ASIDのビット数の確認
+ * @details satpのASIDのフィールドに全て1を書き込んで読み返し、実装されているビットを調べる
+ *          (カーネルのページテーブルのままASIDだけを変えるため、戻した後にTLBを無効化する)
+ */
+void init_asid(void)
+{
+    unsigned int satp = 0;
+    unsigned int probe = 0;
+    __asm__ __volatile__("csrr %0, satp\n" : "=r"(satp));
+    __asm__ __volatile__(
+        "csrw satp, %1\n" /* ASIDのフィールドに全て1を書き込む */
+        "csrr %0, satp\n" /* 実装されているビットだけが1で読める */
+        "csrw satp, %2\n" /* 元に戻す */
+        "sfence.vma\n"
+        : "=&r"(probe)
+        : "r"(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT)), "r"(satp)
+        : "memory");
+    g_asid_max = (probe >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+    g_asid_enable = (g_asid_max != 0);
+    printf("asid: max %d (%s)\n", g_asid_max, g_asid_enable ? "enabled" : "not implemented");
+}
+/**
+ * @brief ページングの有効化
+ * @details カーネルのページテーブルを作成し、satpに設定して仮想アドレスを有効にする
+ */
+void init_paging(void)
+{
+    g_mapped_megapages = 0;
+    g_mapped_pages = 0;
+    g_kernel_page_table = create_kernel_page_table(1);
+    switch_page_table(g_kernel_page_table);
+    printf("paging: kernel 0x%08x-0x%08x, %d megapages, %d pages\n",
+           __kernel_base, __free_ram_end, g_mapped_megapages, g_mapped_pages);
+    init_asid();
+}
+/**
+ * @brief リモートハートのTLBの無効化 (SBI RFENCE Extension)
+ * @param start : 無効化する仮想アドレスの先頭
+ * @param size  : 無効化する領域のサイズ
+ * @details 自ハートを含む全てのハートでsfence.vmaを実行させる
+ */
+void sbi_remote_sfence_vma(unsigned int start, unsigned int size)
+{
+    sbi_call(SBI_EXT_RFENCE, SBI_RFENCE_REMOTE_SFENCE_VMA, 0, -1, start, size); /* hart_mask_base=-1で全ハート */
+}
+/**
+ * @brief スレッドのスタック枠(グローバル変数)
+ * @note スタック領域を2のべき乗のサイズの枠に分け、各枠の上端にスタックを対応付け、下側はガードページとして対応付けない
+ *       スタックの下端を越えるとガードページでページフォルトになり、上端を越えると上の枠のガードページにかかる
+ *       一度対応付けた枠は解放後も対応付けたまま再利用し、TLBの無効化(全ハートへの通知)を最初の1回だけにする
+ *       対応付けたままの空き枠がTHREAD_STACK_CACHED_SLOTSに達したら、以降に解放した枠は対応付けを解除して物理ページを返す
+ */
+struct spinlock g_stack_slot_lock;                       // スタック枠の空きリストのロック
+int g_stack_slot_next[THREAD_STACK_SLOTS];               // 空きリストで次の空き枠の番号
+unsigned char g_stack_slot_mapped[THREAD_STACK_SLOTS];   // 1なら物理ページを対応付け済み
+int g_stack_slot_free;                                   // 空きリストの先頭の枠の番号 (-1なら空)
+int g_stack_slot_used;                                   // 一度でも使用した枠の数
+int g_stack_slot_cached;                                 // 空きリストのうち物理ページを対応付けたままの枠の数
+/**
+ * @brief スレッドのスタック領域の初期化
+ * @retval 0  : 成功
+ * @retval -1 : 空きページがない (作成できた2段目のページテーブルはそのまま残す)
+ * @details スタック領域の2段目のページテーブルをあらかじめ作成しておく
+ *          (複数のハートが同時にスタックを割り当てても、1段目のページテーブルを書き換えないようにする)
+ */
+int init_thread_stacks(void)
+{
+    g_stack_slot_free = -1;
+    g_stack_slot_used = 0;
+    g_stack_slot_cached = 0;
+    for (unsigned int vaddr = THREAD_STACK_AREA; vaddr - THREAD_STACK_AREA < (1u << THREAD_STACK_AREA_SHIFT); vaddr += MEGAPAGE_SIZE)
+    {
+        unsigned int *table0 = alloc_page_table();
+        if (table0 == NULL)
+        {
+            return -1;
+        }
+        g_kernel_page_table[(vaddr >> 22) & 0x3ff] = (((unsigned int)table0 / PAGE_SIZE) << 10) | PAGE_V;
+    }
+    return 0;
+}
+/**
+ * @brief スタック枠の対応付けの解除
+ * @param base  : スタックの下端の仮想アドレス
+ * @param pages : 対応付けた物理ページの先頭
+ * @param n     : 対応付けたページ数 (下端から)
+ * @details ページテーブルのエントリを消して全ハートのTLBを無効化してから、物理ページを解放する
+ *          (2段目のページテーブルはinit_thread_stacksで作成したものを残す)
+ */
+void unmap_thread_stack(unsigned int base, char *pages, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        *walk_page(g_kernel_page_table, base + i * PAGE_SIZE) = 0;
+    }
+    if (n > 0)
+    {
+        sbi_remote_sfence_vma(base, THREAD_STACK_SIZE);
+    }
+    free_pages(pages, THREAD_STACK_PAGES);
+}
+/**
+ * @brief スタック枠を空きリストへ戻す
+ * @param slot : 枠の番号
+ */
+void put_stack_slot(int slot)
+{
+    unsigned int sie = spin_lock_irqsave(&g_stack_slot_lock);
+    g_stack_slot_next[slot] = g_stack_slot_free;
+    g_stack_slot_free = slot;
+    if (g_stack_slot_mapped[slot])
+    {
+        g_stack_slot_cached++;
+    }
+    spin_unlock_irqrestore(&g_stack_slot_lock, sie);
+}
+/**
+ * @brief スレッドのスタックの解放
+ * @param stack : alloc_thread_stackで割り当てたスタック
+ * @details 枠を空きリストへ戻す (物理ページは対応付けたまま次の割り当てで再利用する)
+ *          対応付けたままの空き枠が上限に達している場合は、先に対応付けを解除して物理ページを返す
+ *          (空きリストへ戻す前に解除し、他のハートが解除中の枠を割り当てないようにする)
+ */
+void free_thread_stack(void *stack)
+{
+    int slot = ((unsigned int)stack - THREAD_STACK_AREA) >> THREAD_STACK_SLOT_SHIFT;
+    if (__atomic_load_n(&g_stack_slot_cached, __ATOMIC_RELAXED) >= THREAD_STACK_CACHED_SLOTS)
+    {
+        unsigned int base = (unsigned int)stack;
+        unmap_thread_stack(base, (char *)((*walk_page(g_kernel_page_table, base) >> 10) * PAGE_SIZE), THREAD_STACK_PAGES);
+        g_stack_slot_mapped[slot] = 0;
+    }
+    put_stack_slot(slot);
+}
+/**
+ * @brief スレッドのスタックの割り当て
+ * @return スタックの下端の仮想アドレス (空き枠またはメモリがない場合はNULL)
+ * @details 空き枠を取り出し、まだ対応付けていなければ物理ページを割り当てて対応付ける
+ */
+void *alloc_thread_stack(void)
+{
+    int slot = -1;
+    unsigned int sie = spin_lock_irqsave(&g_stack_slot_lock);
+    if (g_stack_slot_free >= 0)
+    {
+        slot = g_stack_slot_free;
+        g_stack_slot_free = g_stack_slot_next[slot];
+        if (g_stack_slot_mapped[slot])
+        {
+            g_stack_slot_cached--;
+        }
+    }
+    else if (g_stack_slot_used < THREAD_STACK_SLOTS)
+    {
+        slot = g_stack_slot_used++;
+    }
+    spin_unlock_irqrestore(&g_stack_slot_lock, sie);
+    if (slot < 0)
+    {
+        return NULL;
+    }
+    unsigned int base = THREAD_STACK_AREA + (slot << THREAD_STACK_SLOT_SHIFT) + THREAD_STACK_GUARD_PAGES * PAGE_SIZE;
+    if (!g_stack_slot_mapped[slot])
+    {
+        char *pages = alloc_pages(THREAD_STACK_PAGES);
+        if (pages == NULL)
+        {
+            put_stack_slot(slot);
+            return NULL;
+        }
+        for (int i = 0; i < THREAD_STACK_PAGES; i++)
+        {
+            if (map_page(g_kernel_page_table, base + i * PAGE_SIZE, (unsigned int)pages + i * PAGE_SIZE, PAGE_R | PAGE_W) < 0)
+            {
+                unmap_thread_stack(base, pages, i);
+                put_stack_slot(slot);
+                return NULL;
+            }
+        }
+        g_stack_slot_mapped[slot] = 1;
+        sbi_remote_sfence_vma(base, THREAD_STACK_SIZE);
+    }
+    return (void *)base;
+}
+/**
+ * @brief スラブキャッシュ
+ * @note 同じサイズのオブジェクトを割り当てるためのキャッシュ
+ *       ページを同じサイズのオブジェクトに分割しておき、空きオブジェクトのリストから割り当てる
+ */
+struct slab_object
+{
+    struct slab_object *next; // 次の空きオブジェクト (空きオブジェクトの先頭に書き込む)
+};
+struct slab_cache
+{
+    const char *name;               // キャッシュの名前
+    unsigned int object_size;       // オブジェクトのサイズ (4バイト境界)
+    struct slab_object *free_list;  // 空きオブジェクトのリスト
+    unsigned char page_tag;         // 確保したページのページごとの情報に書き込む値 (0なら書き込まない)
+    unsigned int page_count;        // キャッシュが確保したページ数
+    unsigned int object_count;      // キャッシュが確保したオブジェクト数
+    unsigned int used_count;        // 使用中のオブジェクト数
+    struct spinlock lock;           // 空きオブジェクトのリストのロック
+};
+/**
+ * @brief スラブキャッシュの初期化
+ * @param cache : スラブキャッシュ
+ * @param name  : キャッシュの名前
+ * @param size  : オブジェクトのサイズ
+ */
+void init_slab_cache(struct slab_cache *cache, const char *name, unsigned int size)
+{
+    cache->name = name;
+    cache->object_size = (size + 3) & ~3;
+    cache->free_list = NULL;
+    cache->page_tag = 0;
+    cache->page_count = 0;
+    cache->object_count = 0;
+    cache->used_count = 0;
+    cache->lock.locked = 0;
+}
+/**
+ * @brief スラブキャッシュの拡張
+ * @param cache : スラブキャッシュ
+ * @retval 0    : 成功
+ * @retval -1   : 空きページがない
+ * @details 1ページを確保して、オブジェクトに分割して空きオブジェクトのリストへつなぐ
+ */
+int grow_slab_cache(struct slab_cache *cache)
+{
+    char *page = alloc_pages(1);
+    if (page == NULL)
+    {
+        return -1;
+    }
+    for (unsigned int offset = 0; offset + cache->object_size <= PAGE_SIZE; offset += cache->object_size)
+    {
+        struct slab_object *object = (struct slab_object *)(page + offset);
+        object->next = cache->free_list;
+        cache->free_list = object;
+        cache->object_count++;
+    }
+    if (cache->page_tag != 0)
+    {
+        g_page_info[(unsigned int)page / PAGE_SIZE - g_first_pfn] = cache->page_tag;
+    }
+    cache->page_count++;
+    return 0;
+}
+/**
+ * @brief スラブキャッシュからの割り当て
+ * @param cache : スラブキャッシュ
+ * @return 割り当てたオブジェクト (空きページがない場合はNULL)
+ * @details 空きオブジェクトのリストの先頭を取り出す
+ *          リストが空の場合は1ページ分だけ拡張する (どちらも割り当て済みのオブジェクト数によらず一定時間)
+ */
+void *slab_alloc(struct slab_cache *cache)
+{
+    unsigned int sie = spin_lock_irqsave(&cache->lock);
+    struct slab_object *object = NULL;
+
+    if ((cache->free_list != NULL) || (grow_slab_cache(cache) == 0))
+    {
+        object = cache->free_list;
+        cache->free_list = object->next;
+        cache->used_count++;
+    }
+    spin_unlock_irqrestore(&cache->lock, sie);
+    return object;
+}
+/**
+ * @brief スラブキャッシュへの解放
+ * @param cache  : スラブキャッシュ
+ * @param object : slab_allocで割り当てたオブジェクト
+ */
+void slab_free(struct slab_cache *cache, void *object)
+{
+    unsigned int sie = spin_lock_irqsave(&cache->lock);
+    ((struct slab_object *)object)->next = cache->free_list;
+    cache->free_list = (struct slab_object *)object;
+    cache->used_count--;
+    spin_unlock_irqrestore(&cache->lock, sie);
+}
+/**
+ * @brief 実行状態の定義
+ * @note スレッドやプロセスの状態を示す
+ */
+typedef enum
+{
+    READY,     // 実行可能プロセス
+    RUNNING,   // 実行中
+    WAITING,   // 実行待ち
+    TERMINATED // ターミネート(終了状態/未設定状態)
+} ExecutionState;
+/**
+ * @brief 実行管理エンティティを示す構造体
+ * @note スレッドやプロセスの状態とIDを管理する
+ */
+typedef struct
+{
+    ExecutionState status; // 状態
+    int id;                // ID (プロセスやスレッドの識別)
+} Execution;
+/**
+ * @brief 浮動小数点レジスタの保存領域
+ * @note Fエクステンション(__riscv_flen=32)またはDエクステンション(__riscv_flen=64)を有効にしてコンパイルした場合だけ使用する
+ */
+#ifdef __riscv_flen
+#if __riscv_flen == 64
+#define FPU_STORE "fsd"  // 浮動小数点レジスタの保存命令
+#define FPU_LOAD "fld"   // 浮動小数点レジスタの読み込み命令
+#define FPU_REG_SIZE "8" // 浮動小数点レジスタのサイズ(バイト)
+typedef unsigned long long fpu_reg_t;
+#else
+#define FPU_STORE "fsw"  // 浮動小数点レジスタの保存命令
+#define FPU_LOAD "flw"   // 浮動小数点レジスタの読み込み命令
+#define FPU_REG_SIZE "4" // 浮動小数点レジスタのサイズ(バイト)
+typedef unsigned int fpu_reg_t;
+#endif
+struct fpu_state
+{
+    fpu_reg_t f[32];   // f0〜f31
+    unsigned int fcsr; // 浮動小数点の制御・状態レジスタ
+};
+#endif
+/**
+ * @brief スレッドの統計情報
+ * @note タイムスライスのずれ(ジッタ)やコンテキストスイッチの回数を計測する
+ */
+struct thread_stats
+{
+    unsigned int switch_count;  // コンテキストスイッチで実行状態になった回数
+    unsigned int preempt_count; // タイマー割り込みで横取り(プリエンプション)された回数
+    unsigned int jitter_sum;    // タイムスライスのずれ(tick)の合計
+    unsigned int jitter_max;    // タイムスライスのずれ(tick)の最大値
+};
+/**
+ * @brief 待ち行列
+ * @note WAITING状態のスレッドをnextでつなぐFIFOで、追加・取り出しとも一定時間で行う
+ *       待っているスレッドは実行可能キューにないため、スケジューラが探索することはない
+ *       ロックは割り込み禁止(spin_lock_irqsave)で取る
+ */
+struct wait_queue
+{
+    struct spinlock lock; // 待ち行列と、待ち行列を使う同期機構の状態のロック
+    struct thread *head;  // 先頭 (次に起こすスレッド)
+    struct thread *tail;  // 末尾
+};
+/**
+ * @brief 待ち行列の初期化
+ * @param wq : 待ち行列
+ */
+void init_wait_queue(struct wait_queue *wq)
+{
+    wq->lock.locked = 0;
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+/**
+ * @brief スレッド
+ * @note joinableのスレッドは、終了後もthread_joinで合流するまでスレッド自体を解放しない (スタックは終了時に解放する)
+ */
+struct thread
+{
+    Execution execution;            // 実行管理エンティティ
+    unsigned int sp;                // スレッドのスタックポインタ
+    void (*entry)(void *arg);       // スレッドのエントリー関数
+    void *arg;                      // エントリー関数に渡す引数
+    struct trap_frame *trap_frame;  // 処理中のトラップのトラップフレーム (トラップ処理中でなければNULL)
+    unsigned long long slice_start; // タイムスライスの開始時刻
+    int priority;                   // 優先度 (0が最高優先度)
+    struct thread *next;            // inbox・待ち行列で次のスレッド (スリープ中のヒープでは次の兄弟)
+    struct thread *sleep_child;     // スリープ中のヒープで最初の子
+    unsigned long long wake_time;   // スリープから起きる時刻
+    struct hart *hart;              // スレッドを実行するハート (実行可能キューを持つハート)
+    unsigned long long create_time; // スレッドの作成時刻
+    struct thread_stats stats;      // 統計情報
+#ifdef __riscv_flen
+    struct fpu_state fpu;           // 浮動小数点レジスタの保存領域
+    struct hart *fpu_hart;          // 浮動小数点レジスタを最後に読み込んだハート
+#endif
+    char *stack;                    // スレッドのスタック領域 (ページ割り当てで確保)
+    unsigned int stack_size;        // スレッドのスタックサイズ
+    int joinable;                   // 1ならthread_joinで合流する (終了後もスレッドを解放しない)
+    int exited;                     // 1なら終了してスタックを解放済み (join_wqのロックで保護)
+    struct wait_queue join_wq;      // 終了を待つ(合流する)スレッドの待ち行列
+    struct process *process;        // スレッドを実行するプロセス (カーネルのスレッドはNULL)
+};
+/**
+ * @brief ユーザー領域の予約した領域
+ * @note ページは最初のアクセスのページフォルトで割り当てる
+ */
+struct user_region
+{
+    unsigned int start; // 先頭の仮想アドレス (ページ境界)
+    unsigned int end;   // 末尾の仮想アドレス (ページ境界)
+    unsigned int flags; // ページテーブルエントリのフラグ (PAGE_R/PAGE_W/PAGE_U)
+};
+/**
+ * @brief プロセス
+ * @note ユーザーモードで実行するプログラムと、専用のアドレス空間(ページテーブル)を持つ
+ *       ページテーブルはカーネルの対応付けを共有し(ユーザーモードからはアクセス不可)、ユーザー領域だけをプロセスごとに持つ
+ *       プロセスは1つのスレッドで実行し、スレッドが終了するとアドレス空間と共に解放する
+ *       forkで作成した子プロセスが全て終了するまで、親プロセスは終了しない (子プロセスは親プロセスを参照する)
+ */
+struct process
+{
+    Execution execution;                     // 実行管理エンティティ (IDはプロセスID)
+    unsigned int *page_table;                // ページテーブル(1段目)
+    struct thread *thread;                   // プロセスを実行するスレッド
+    unsigned int entry;                      // ユーザーモードで最初に実行するアドレス
+    unsigned int user_sp;                    // ユーザーモードの最初のスタックポインタ
+    int exit_code;                           // 終了コード
+    struct process *parent;                  // 親プロセス (forkで作成したプロセスのみ)
+    int children;                            // 終了していない子プロセスの数 (child_wqのロックで保護)
+    struct wait_queue child_wq;              // 子プロセスの終了を待つ待ち行列
+    int forked;                              // 1ならforkで作成し、frameから実行を始める
+    struct trap_frame frame;                 // forkした時の親のユーザーモードのレジスタ (a0は0)
+    unsigned int heap_end;                   // ヒープの末尾 (sbrkで伸縮する)
+    unsigned int mmap_next;                  // 次に無名の対応付けに割り当てる仮想アドレス
+    int mmap_count;                          // 無名の対応付けの領域の数
+    struct user_region mmaps[USER_MMAP_MAX]; // 無名の対応付けの領域
+    unsigned int asid;                       // 割り当てたASID
+    unsigned int asid_generation;            // ASIDを割り当てた世代 (g_asid_generationと異なれば割り当て直す)
+    struct hart *asid_hart;                  // 最後に実行したハート (他のハートから移ってきたらASIDのTLBを無効化する)
+};
+/**
+ * @brief スレッド(グローバル変数)
+ * @note　各種スレッド関連のデータ
+ */
+struct slab_cache g_thread_cache;       // スレッドのスラブキャッシュ
+int g_next_thread_id;                  // 次に作成するスレッドのID
+int g_report_thread_stats;             // スレッドの終了時に統計情報を表示するかどうか
+unsigned long long g_sched_start_time; // スケジューラの開始時刻
+struct slab_cache g_process_cache;     // プロセスのスラブキャッシュ
+int g_next_pid;                        // 次に作成するプロセスのID
+/**
+ * @brief 実行可能キュー (ワークスティーリング用の両端キュー)
+ * @note 優先度ごと・ハートごとにREADY状態のスレッドを持つリングバッファ
+ *       末尾(bottom)への追加は持ち主のハートだけが行い、先頭(top)からの取り出しは持ち主と他のハート(盗む側)が
+ *       compare-and-swapで行う (どちらもロックを使わない)
+ *       持ち主もtopから取り出すことで、同じ優先度のスレッドを追加した順(FIFO)に実行する
+ *       top/bottomは剰余を取る前の通し番号で、bottom - topがキュー内のスレッド数になる
+ */
+struct ready_queue
+{
+    struct thread **slots;        // スレッドを格納するリングバッファ (READY_QUEUE_SIZE要素)
+    volatile unsigned int top;    // 先頭 (次に取り出す位置)
+    volatile unsigned int bottom; // 末尾 (次に追加する位置)
+};
+/**
+ * @brief ハート(CPUコア)ごとの管理情報
+ * @note 各ハートはtpレジスタに自ハートの管理情報のアドレスを設定し、this_hartで参照する
+ *       ready_bitmapのビットnは、優先度nのキューが空でないかもしれないことを示す (持ち主のハートだけが更新する)
+ *       最下位のセットされたビットを探すことで、最も優先度の高いキューを一定時間で選べる
+ *       他のハートからのスレッドの追加はinbox(スレッドのnextでつなぐスタック)へ行い、持ち主が実行可能キューへ移す
+ */
+struct hart
+{
+    unsigned int hartid;                                 // ハートID
+    int online;                                          // 1なら起動済み (-1なら初期化に失敗して停止する)
+    struct ready_queue ready_queue[THREAD_PRIORITY_NUM]; // 優先度ごとの実行可能キュー
+    unsigned int ready_bitmap;                           // 空でない実行可能キューのビットマップ
+    struct thread *inbox;                                // 他のハートから追加されたスレッド
+    struct thread *current_thread;                       // 現在実行中のスレッド
+    struct thread *idle_thread;                          // アイドル(何もしない)スレッド
+    struct thread *dead_thread;                          // 終了して解放待ちのスレッド
+    struct thread *requeue_thread;                       // 切り替え後に実行可能キューへ戻すスレッド
+    struct spinlock *release_lock;                       // 切り替え後に解放するロック (待ち行列のロック)
+    unsigned int switch_start_cycle;                     // コンテキストスイッチの開始時のサイクル数 (プロファイル用)
+    unsigned int completed_count;                        // このハートで終了したスレッドの数
+    unsigned int steal_count;                            // 他のハートから盗んだスレッドの数
+    unsigned int busy_ticks;                             // アイドルスレッド以外を実行した時間(tick)
+    struct thread *sleep_heap;                           // スリープ中のスレッドのペアリングヒープ (根が最も早く起きる)
+    unsigned long long timer_deadline;                   // 設定済みのタイマーの時刻 (0なら次回必ず設定し直す)
+    unsigned int idle_ticks;                             // wfiで停止していた時間(tick)
+    unsigned int wfi_count;                              // wfiで停止した回数
+    unsigned int timer_count;                            // タイマー割り込みの回数
+    unsigned int *page_table;                            // satpに設定しているページテーブル
+    unsigned int asid_generation;                        // TLBを全て無効化した時のASIDの世代
+#ifdef __riscv_flen
+    struct thread *fpu_owner;                            // 浮動小数点レジスタに状態が読み込まれているスレッド
+#endif
+};
+/**
+ * @brief ハート(グローバル変数)
+ * @note g_hartsはハートIDで、g_online_hartsは起動した順番で参照する
+ */
+struct hart g_harts[HART_MAX];         // ハートごとの管理情報
+unsigned int g_online_harts[HART_MAX]; // 起動済みのハートのID (起動した順)
+int g_hart_count;                      // 起動済みのハートの数
+unsigned int g_next_hart;              // 次にスレッドを割り当てるハート (ラウンドロビン)
+int g_thread_count;                    // 終了していないスレッドの数 (アイドルスレッドを除く、全ハートの合計)
+unsigned int g_idle_harts;             // wfiで停止中のハートのビットマップ (ビットnはハートIDn)
+int g_work_stealing = 1;               // 1なら空いたハートが他のハートのスレッドを盗む
+/**
+ * @brief 自ハートの管理情報の取得
+ * @return 自ハートの管理情報 (tpレジスタの値)
+ */
+struct hart *this_hart(void)
+{
+    struct hart *hart = NULL;
+    __asm__ __volatile__("mv %0, tp\n" : "=r"(hart)); /* tpレジスタを読み込む */
+    return hart;
+}
+/**
+ * @brief 実行中のスレッドの取得
+ * @return 自ハートで実行中のスレッド (スレッドの初期化前はNULL)
+ * @details tpの読み込みと実行中のスレッドの読み込みの間に他のハートへ移らないように、割り込みを禁止して読み込む
+ */
+struct thread *current_thread(void)
+{
+    unsigned int sie = intr_disable();
+    struct thread *thread = this_hart()->current_thread;
+    intr_restore(sie);
+    return thread;
+}
+/**
+ * @brief カーネルのヒープ(kmalloc)(グローバル変数)
+ * @note 2の累乗と、その間(1.5倍)のサイズクラスごとにスラブキャッシュを持ち、要求サイズ以上で最小のクラスから割り当てる
+ *       KMALLOC_MAX_SIZEより大きい領域はページ割り当てから直接割り当てる
+ *       ハートごと・クラスごとのマガジン(空きオブジェクトの小さなスタック)を先に使い、
+ *       空・満杯の時だけスラブキャッシュのロックを取って半分ずつ補充・返却する
+ *       kfreeはページごとの情報(スラブのページならサイズクラス、それ以外は次数)から、解放先を判断する
+ */
+struct kmalloc_magazine
+{
+    unsigned int count;                   // マガジンに置いているオブジェクトの数
+    unsigned int alloc_count;             // このハートで割り当てた回数
+    unsigned int free_count;              // このハートで解放した回数
+    void *objects[KMALLOC_MAGAZINE_SIZE]; // 空きオブジェクト
+};
+/**
+ * @brief kmallocのサイズクラスごとのオブジェクトのサイズ
+ * @note 小さい順に並べる (g_kmalloc_indexは、この順で要求サイズ以上の最小のクラスを選ぶ)
+ */
+const unsigned int g_kmalloc_sizes[KMALLOC_CLASS_NUM] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048};
+/**
+ * @brief kmallocのサイズクラスごとのスラブキャッシュの名前
+ */
+const char *const g_kmalloc_names[KMALLOC_CLASS_NUM] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96", "kmalloc-128", "kmalloc-192",
+    "kmalloc-256", "kmalloc-384", "kmalloc-512", "kmalloc-768", "kmalloc-1024", "kmalloc-1536", "kmalloc-2048"};
+struct slab_cache g_kmalloc_caches[KMALLOC_CLASS_NUM];                    // サイズクラスごとのスラブキャッシュ
+unsigned char g_kmalloc_index[KMALLOC_MAX_SIZE / 16 + 1];                 // 16バイト単位のサイズからサイズクラスへの変換表
+struct kmalloc_magazine g_kmalloc_magazines[HART_MAX][KMALLOC_CLASS_NUM]; // ハートごと・サイズクラスごとのマガジン
+int g_kmalloc_magazine_enable = 1;                                        // 1ならマガジンを使う (0なら毎回スラブキャッシュのロックを取る)
+unsigned int g_kmalloc_large_count;                                       // ページ単位で割り当て中の領域の数
+unsigned int g_kmalloc_large_pages;                                       // ページ単位で割り当て中のページ数
+/**
+ * @brief kmallocの初期化
+ * @details サイズクラスごとのスラブキャッシュと、サイズからサイズクラスへの変換表を作成する
+ *          スラブのページには、ページごとの情報にPAGE_INFO_SLABとサイズクラスを書き込む
+ */
+void init_kmalloc(void)
+{
+    unsigned int index = 0;
+    for (int i = 0; i < KMALLOC_CLASS_NUM; i++)
+    {
+        init_slab_cache(&g_kmalloc_caches[i], g_kmalloc_names[i], g_kmalloc_sizes[i]);
+        g_kmalloc_caches[i].page_tag = PAGE_INFO_SLAB | i;
+    }
+    for (unsigned int i = 0; i <= KMALLOC_MAX_SIZE / 16; i++)
+    {
+        while (g_kmalloc_sizes[index] < i * 16)
+        {
+            index++;
+        }
+        g_kmalloc_index[i] = index;
+    }
+}
+/**
+ * @brief マガジンの補充
+ * @param cache    : スラブキャッシュ
+ * @param magazine : 自ハートのマガジン (割り込み禁止で呼び出す)
+ * @details スラブキャッシュのロックを1回取り、マガジンの半分までオブジェクトを移す
+ */
+void kmalloc_refill(struct slab_cache *cache, struct kmalloc_magazine *magazine)
+{
+    spin_lock(&cache->lock);
+    while ((magazine->count < KMALLOC_MAGAZINE_SIZE / 2) && ((cache->free_list != NULL) || (grow_slab_cache(cache) == 0)))
+    {
+        struct slab_object *object = cache->free_list;
+        cache->free_list = object->next;
+        cache->used_count++;
+        magazine->objects[magazine->count++] = object;
+    }
+    spin_unlock(&cache->lock);
+}
+/**
+ * @brief マガジンの返却
+ * @param cache    : スラブキャッシュ
+ * @param magazine : 自ハートのマガジン (割り込み禁止で呼び出す)
+ * @param keep     : マガジンに残すオブジェクトの数
+ * @details スラブキャッシュのロックを1回取り、残す数を超えたオブジェクトを空きオブジェクトのリストへ戻す
+ */
+void kmalloc_flush(struct slab_cache *cache, struct kmalloc_magazine *magazine, unsigned int keep)
+{
+    spin_lock(&cache->lock);
+    while (magazine->count > keep)
+    {
+        struct slab_object *object = magazine->objects[--magazine->count];
+        object->next = cache->free_list;
+        cache->free_list = object;
+        cache->used_count--;
+    }
+    spin_unlock(&cache->lock);
+}
+/**
+ * @brief カーネルのヒープからの割り当て
+ * @param size : バイト数
+ * @return 割り当てた領域 (16バイト境界。空きメモリがない場合はNULL)
+ * @details 自ハートのマガジンから取り出し、空ならスラブキャッシュから補充する
+ *          (割り込み禁止の間は他のハートへ移らないため、マガジンはロックなしで操作できる)
+ *          KMALLOC_MAX_SIZEより大きい場合はページ単位で割り当てる
+ */
+void *kmalloc(unsigned int size)
+{
+    if (size > KMALLOC_MAX_SIZE)
+    {
+        void *pages = alloc_pages((size + PAGE_SIZE - 1) / PAGE_SIZE);
+        if (pages != NULL)
+        {
+            __atomic_fetch_add(&g_kmalloc_large_count, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&g_kmalloc_large_pages, 1u << g_page_info[(unsigned int)pages / PAGE_SIZE - g_first_pfn], __ATOMIC_RELAXED);
+        }
+        return pages;
+    }
+    unsigned int index = g_kmalloc_index[(size + 15) / 16];
+    struct slab_cache *cache = &g_kmalloc_caches[index];
+    void *object = NULL;
+    unsigned int sie = intr_disable();
+    struct kmalloc_magazine *magazine = &g_kmalloc_magazines[this_hart()->hartid][index];
+    if (g_kmalloc_magazine_enable)
+    {
+        if (magazine->count == 0)
+        {
+            kmalloc_refill(cache, magazine);
+        }
+        if (magazine->count > 0)
+        {
+            object = magazine->objects[--magazine->count];
+        }
+    }
+    else
+    {
+        spin_lock(&cache->lock);
+        if ((cache->free_list != NULL) || (grow_slab_cache(cache) == 0))
+        {
+            object = cache->free_list;
+            cache->free_list = ((struct slab_object *)object)->next;
+            cache->used_count++;
+        }
+        spin_unlock(&cache->lock);
+    }
+    magazine->alloc_count += (object != NULL);
+    intr_restore(sie);
+    return object;
+}
+/**
+ * @brief カーネルのヒープへの解放
+ * @param ptr : kmallocで割り当てた領域 (NULLなら何もしない)
+ * @details 自ハートのマガジンへ戻し、満杯ならスラブキャッシュへ半分を返却する
+ *          他のハートで割り当てた領域も、解放したハートのマガジンへ戻す
+ */
+void kfree(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    unsigned int info = g_page_info[(unsigned int)ptr / PAGE_SIZE - g_first_pfn];
+    if ((info & PAGE_INFO_SLAB) == 0)
+    {
+        __atomic_fetch_sub(&g_kmalloc_large_count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&g_kmalloc_large_pages, 1u << info, __ATOMIC_RELAXED);
+        free_pages_order(ptr, info);
+        return;
+    }
+    unsigned int index = info & ~PAGE_INFO_SLAB;
+    struct slab_cache *cache = &g_kmalloc_caches[index];
+    unsigned int sie = intr_disable();
+    struct kmalloc_magazine *magazine = &g_kmalloc_magazines[this_hart()->hartid][index];
+    if (g_kmalloc_magazine_enable)
+    {
+        if (magazine->count == KMALLOC_MAGAZINE_SIZE)
+        {
+            kmalloc_flush(cache, magazine, KMALLOC_MAGAZINE_SIZE / 2);
+        }
+        magazine->objects[magazine->count++] = ptr;
+    }
+    else
+    {
+        spin_lock(&cache->lock);
+        ((struct slab_object *)ptr)->next = cache->free_list;
+        cache->free_list = (struct slab_object *)ptr;
+        cache->used_count--;
+        spin_unlock(&cache->lock);
+    }
+    magazine->free_count++;
+    intr_restore(sie);
+}
+/**
+ * @brief 自ハートのマガジンの返却
+ * @details マガジンを無効にする前や、使用量を確認する前に、各ハートで呼び出す
+ */
+void kmalloc_drain(void)
+{
+    unsigned int sie = intr_disable();
+    for (int i = 0; i < KMALLOC_CLASS_NUM; i++)
+    {
+        kmalloc_flush(&g_kmalloc_caches[i], &g_kmalloc_magazines[this_hart()->hartid][i], 0);
+    }
+    intr_restore(sie);
+}
+/**
+ * @brief 使用中の領域の数
+ * @return kmallocで割り当てて、まだ解放していない領域の数 (全ハート・全サイズクラスとページ単位の合計)
+ * @note 他のハートで割り当てて自ハートで解放した分もあるため、ハートごとの回数の合計で数える
+ */
+unsigned int kmalloc_used_count(void)
+{
+    unsigned int used = g_kmalloc_large_count;
+    for (int h = 0; h < HART_MAX; h++)
+    {
+        for (int i = 0; i < KMALLOC_CLASS_NUM; i++)
+        {
+            used += g_kmalloc_magazines[h][i].alloc_count - g_kmalloc_magazines[h][i].free_count;
+        }
+    }
+    return used;
+}
+/**
+ * @brief kmallocの使用量の表示
+ * @details サイズクラスごとに、確保したページ数・オブジェクト数、使用中(リーク候補)の数、
+ *          マガジンに置いている数、割り当て・解放の回数の合計と、ページの利用率を表示する
+ *          (利用率は、確保したページのうちオブジェクトとして切り出せたバイト数の割合)
+ */
+void print_kmalloc_stats(void)
+{
+    printf("kmalloc: %d in use, large %d blocks (%d pages)\n", kmalloc_used_count(), g_kmalloc_large_count, g_kmalloc_large_pages);
+    for (int i = 0; i < KMALLOC_CLASS_NUM; i++)
+    {
+        struct slab_cache *cache = &g_kmalloc_caches[i];
+        unsigned int allocs = 0;
+        unsigned int frees = 0;
+        unsigned int cached = 0;
+        for (int h = 0; h < HART_MAX; h++)
+        {
+            allocs += g_kmalloc_magazines[h][i].alloc_count;
+            frees += g_kmalloc_magazines[h][i].free_count;
+            cached += g_kmalloc_magazines[h][i].count;
+        }
+        if (cache->page_count == 0)
+        {
+            continue;
+        }
+        printf("  %-12s: %d pages, %d objects (%d%% of pages), in use %d, cached %d, allocs %u, frees %u\n",
+               cache->name, cache->page_count, cache->object_count,
+               cache->object_count * cache->object_size * 100 / (cache->page_count * PAGE_SIZE),
+               allocs - frees, cached, allocs, frees);
+    }
+}
+/**
+ * @brief ハートの初期化
+ * @param hartid : ハートID (HART_MAX未満)
+ * @return ハートの管理情報
+ * @details tpレジスタに自ハートの管理情報のアドレスを設定し、他のハートからのIPI(ソフトウェア割り込み)を許可する
+ *          (他の処理より先に呼び出すこと)
+ */
+struct hart *init_hart(unsigned int hartid)
+{
+    struct hart *hart = &g_harts[hartid];
+    hart->hartid = hartid;
+    __asm__ __volatile__("mv tp, %0\n" ::"r"(hart));        /* tpレジスタに自ハートの管理情報のアドレスを設定 */
+    __asm__ __volatile__("csrs sie, %0\n" ::"r"(SIE_SSIE)); /* sieのSSIEビットをセット (ソフトウェア割り込み許可) */
+    __asm__ __volatile__("csrw sscratch, zero\n");          /* Sモードで実行中はsscratchを0にしておく (トラップの入口処理で判定する) */
+    __asm__ __volatile__("csrw scounteren, %0\n" ::"r"(SCOUNTEREN_CY_TM_IR)); /* ユーザーモードからcycle/time/instretを読めるようにする */
+#ifdef __riscv_flen
+    __asm__ __volatile__("csrc sstatus, %0\n" ::"r"(SSTATUS_FS)); /* FS=Off (最初の浮動小数点命令で例外にして、レジスタを読み込む) */
+    hart->fpu_owner = NULL;
+#endif
+    return hart;
+}
+/**
+ * @brief 実行可能キューの初期化
+ * @param hart : ハート
+ * @retval 0    : 成功
+ * @retval -1   : 空きページがない (確保済みのリングバッファは解放する)
+ * @details 優先度ごとのリングバッファをページ割り当てで確保する (起動するハートの分だけ確保する)
+ */
+int init_ready_queues(struct hart *hart)
+{
+    for (int i = 0; i < THREAD_PRIORITY_NUM; i++)
+    {
+        struct ready_queue *queue = &hart->ready_queue[i];
+        queue->slots = alloc_pages(READY_QUEUE_PAGES);
+        if (queue->slots == NULL)
+        {
+            while (--i >= 0)
+            {
+                free_pages(hart->ready_queue[i].slots, READY_QUEUE_PAGES);
+                hart->ready_queue[i].slots = NULL;
+            }
+            return -1;
+        }
+        queue->top = 0;
+        queue->bottom = 0;
+    }
+    hart->ready_bitmap = 0;
+    hart->inbox = NULL;
+    hart->dead_thread = NULL;
+    hart->requeue_thread = NULL;
+    hart->release_lock = NULL;
+    hart->sleep_heap = NULL;
+    hart->timer_deadline = 0;
+    hart->page_table = g_kernel_page_table;
+    hart->asid_generation = 0;
+    return 0;
+}
+/**
+ * @brief 実行可能キューの解放
+ * @param hart : ハート (init_ready_queuesで初期化したハート)
+ * @details 起動に失敗したハートのリングバッファを解放する
+ */
+void free_ready_queues(struct hart *hart)
+{
+    for (int i = 0; i < THREAD_PRIORITY_NUM; i++)
+    {
+        free_pages(hart->ready_queue[i].slots, READY_QUEUE_PAGES);
+        hart->ready_queue[i].slots = NULL;
+    }
+}
+/**
+ * @brief スレッド管理の初期設定
+ * @details スレッドのスラブキャッシュとスタック領域を初期化する (実行可能キューはハートの起動時に初期化する)
+ *          スタック領域のページテーブルを作成できなければ、スレッドを実行できないため停止する
+ */
+void init_threads(void)
+{
+    init_slab_cache(&g_thread_cache, "thread", sizeof(struct thread));
+#ifdef __riscv_flen
+    register_trap_handler(SCAUSE_ILLEGAL_INSTRUCTION, handle_fpu_disabled);
+#endif
+    if (init_thread_stacks() < 0)
+    {
+        printf("threads: out of memory for the stack area page tables\n");
+        console_sync();
+        for (;;)
+            ;
+    }
+    g_next_thread_id = 1;
+    g_thread_count = 0;
+    return;
+}
+/**
+ * @brief 実行可能キューのスレッド数
+ * @param queue : 実行可能キュー
+ * @return キュー内のスレッド数 (他のハートのキューの場合は目安)
+ */
+unsigned int ready_queue_length(struct ready_queue *queue)
+{
+    unsigned int top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+    unsigned int bottom = __atomic_load_n(&queue->bottom, __ATOMIC_ACQUIRE);
+    return bottom - top;
+}
+/**
+ * @brief 実行可能キューの末尾への追加 (持ち主のハートのみ)
+ * @param queue  : 自ハートの実行可能キュー
+ * @param thread : READY状態にしたスレッド
+ * @retval 0    : 成功
+ * @retval -1   : キューが一杯
+ * @details スレッドを書き込んでからbottomを進めるため、盗む側は書き込み済みのスレッドだけを取り出す
+ *          topが進まない限り上書きしないため、取り出し中のスレッドを上書きすることはない
+ */
+int ready_queue_push(struct ready_queue *queue, struct thread *thread)
+{
+    unsigned int bottom = queue->bottom;
+    unsigned int top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= READY_QUEUE_SIZE)
+    {
+        return -1;
+    }
+    queue->slots[bottom % READY_QUEUE_SIZE] = thread;
+    __atomic_store_n(&queue->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+/**
+ * @brief 実行可能キューの先頭からの取り出し (持ち主・盗む側の両方)
+ * @param queue : 実行可能キュー
+ * @return 取り出したスレッド (キューが空の場合はNULL)
+ * @details 先頭のスレッドを読み込み、topをcompare-and-swapで進められた場合だけ取り出せたものとする
+ *          (他のハートと同時に取り出そうとして失敗した場合は、やり直す)
+ */
+struct thread *ready_queue_take(struct ready_queue *queue)
+{
+    for (;;)
+    {
+        unsigned int top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+        unsigned int bottom = __atomic_load_n(&queue->bottom, __ATOMIC_ACQUIRE);
+        if (top == bottom)
+        {
+            return NULL;
+        }
+        struct thread *thread = queue->slots[top % READY_QUEUE_SIZE];
+        if (__atomic_compare_exchange_n(&queue->top, &top, top + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return thread;
+        }
+    }
+}
+/**
+ * @brief IPI(ソフトウェア割り込み)の送信 (SBI IPI Extension)
+ * @param hartid : 送信先のハートID
+ */
+void sbi_send_ipi(unsigned int hartid)
+{
+    sbi_call(SBI_EXT_IPI, SBI_IPI_SEND_IPI, 1, hartid, 0, 0);
+}
+/**
+ * @brief 停止中のハートを1つ起こす
+ * @param self : 自ハート
+ * @details wfiで停止中のハートのビットを1つ落とし、落とせたハートへIPIを送る (盗めるスレッドがあることを知らせる)
+ */
+void wake_idle_hart(struct hart *self)
+{
+    unsigned int idle = __atomic_load_n(&g_idle_harts, __ATOMIC_ACQUIRE) & ~(1u << self->hartid);
+    while (idle != 0)
+    {
+        unsigned int hartid = __builtin_ctz(idle);
+        unsigned int bit = 1u << hartid;
+        if (__atomic_fetch_and(&g_idle_harts, ~bit, __ATOMIC_ACQ_REL) & bit)
+        {
+            sbi_send_ipi(hartid);
+            return;
+        }
+        idle &= ~bit;
+    }
+}
+/**
+ * @brief inboxへの追加
+ * @param hart   : 追加先のハート
+ * @param thread : READY状態にしたスレッド
+ * @details 複数のハートから同時に追加できるように、compare-and-swapで先頭につなぐ
+ */
+void push_inbox(struct hart *hart, struct thread *thread)
+{
+    struct thread *head = __atomic_load_n(&hart->inbox, __ATOMIC_RELAXED);
+    do
+    {
+        thread->next = head;
+    } while (!__atomic_compare_exchange_n(&hart->inbox, &head, thread, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+/**
+ * @brief 実行可能キューへの追加 (持ち主のハートのみ)
+ * @param hart   : 自ハート
+ * @param thread : READY状態にしたスレッド
+ * @details スレッドの優先度のキューの末尾に追加する (割り込み禁止で呼び出すこと)
+ *          キューが一杯の場合はinboxへ回し、後で追加し直す
+ *          ワークスティーリングが有効で停止中のハートがあれば、盗みに来るように起こす
+ */
+void enqueue_ready_thread(struct hart *hart, struct thread *thread)
+{
+    thread->hart = hart;
+    if (ready_queue_push(&hart->ready_queue[thread->priority], thread) < 0)
+    {
+        push_inbox(hart, thread);
+        return;
+    }
+    hart->ready_bitmap |= (1u << thread->priority);
+    // キューへの書き込みを、停止中のハートのビットの読み込みより先に反映する (停止する側と対になる)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (g_work_stealing && (g_idle_harts & ~(1u << hart->hartid)))
+    {
+        wake_idle_hart(hart);
+    }
+}
+/**
+ * @brief 他のハートからのスレッドの追加
+ * @param hart   : 追加先のハート
+ * @param thread : READY状態にしたスレッド
+ * @details 追加先のinboxへつなぎ、IPIで追加先のハートに知らせる (追加先のハートが割り込み処理で実行可能キューへ移す)
+ */
+void send_ready_thread(struct hart *hart, struct thread *thread)
+{
+    thread->hart = hart;
+    push_inbox(hart, thread);
+    sbi_send_ipi(hart->hartid);
+}
+/**
+ * @brief スレッドを実行可能にする
+ * @param thread : READY状態にしたスレッド
+ * @param hart   : スレッドを実行するハート
+ * @details 自ハートなら実行可能キューへ直接、他のハートならinboxとIPIで追加する (割り込み禁止で呼び出すこと)
+ */
+void ready_thread_on(struct thread *thread, struct hart *hart)
+{
+    if (hart == this_hart())
+    {
+        enqueue_ready_thread(hart, thread);
+    }
+    else
+    {
+        send_ready_thread(hart, thread);
+    }
+}
+/**
+ * @brief inboxのスレッドを実行可能キューへ移す (持ち主のハートのみ)
+ * @param hart : 自ハート
+ * @details inboxを丸ごと取り出し、追加された順に戻してから実行可能キューへ追加する (割り込み禁止で呼び出すこと)
+ */
+void drain_inbox(struct hart *hart)
+{
+    if (__atomic_load_n(&hart->inbox, __ATOMIC_RELAXED) == NULL)
+    {
+        return;
+    }
+    struct thread *list = __atomic_exchange_n(&hart->inbox, NULL, __ATOMIC_ACQUIRE);
+    struct thread *reversed = NULL;
+    while (list != NULL)
+    {
+        struct thread *next = list->next;
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+    while (reversed != NULL)
+    {
+        struct thread *next = reversed->next;
+        reversed->next = NULL;
+        enqueue_ready_thread(hart, reversed);
+        reversed = next;
+    }
+}
+/**
+ * @brief 実行可能キューからの取り出し (持ち主のハートのみ)
+ * @param hart  : 自ハート
+ * @param limit : 取り出す優先度の下限 (この値以下の優先度のキューだけを対象にする)
+ * @return 最も優先度が高いキューの先頭のスレッド (実行可能なスレッドがない場合はNULL)
+ * @details ビットマップの最下位のセットされたビット(find first set)で優先度を決めるため、
+ *          スレッド数によらず一定時間で次のスレッドを選ぶ (割り込み禁止で呼び出すこと)
+ *          他のハートに盗まれて空になっていたキューは、ここでビットを落とす
+ */
+struct thread *dequeue_ready_thread(struct hart *hart, int limit)
+{
+    unsigned int bitmap = hart->ready_bitmap & ((2u << limit) - 1);
+    while (bitmap != 0)
+    {
+        int priority = __builtin_ctz(bitmap); // 最下位のセットされたビットの位置
+        struct thread *thread = ready_queue_take(&hart->ready_queue[priority]);
+        if (thread != NULL)
+        {
+            return thread;
+        }
+        hart->ready_bitmap &= ~(1u << priority);
+        bitmap &= ~(1u << priority);
+    }
+    return NULL;
+}
+/**
+ * @brief 他のハートのスレッドを盗む
+ * @param hart : 自ハート
+ * @return 盗んだスレッド (盗めるスレッドがない場合はNULL)
+ * @details 実行可能キューで待っているスレッドが最も多いハートから、最も優先度の高いスレッドを取り出す
+ */
+struct thread *steal_thread(struct hart *hart)
+{
+    struct hart *victim = NULL;
+    unsigned int victim_length = 0;
+
+    if (!g_work_stealing)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < g_hart_count; i++)
+    {
+        struct hart *other = &g_harts[g_online_harts[i]];
+        unsigned int length = 0;
+        if (other == hart)
+        {
+            continue;
+        }
+        for (int priority = 0; priority < THREAD_PRIORITY_NUM; priority++)
+        {
+            length += ready_queue_length(&other->ready_queue[priority]);
+        }
+        if (length > victim_length)
+        {
+            victim = other;
+            victim_length = length;
+        }
+    }
+    if (victim == NULL)
+    {
+        return NULL;
+    }
+    for (int priority = 0; priority < THREAD_PRIORITY_NUM; priority++)
+    {
+        struct thread *thread = ready_queue_take(&victim->ready_queue[priority]);
+        if (thread != NULL)
+        {
+            hart->steal_count++;
+            return thread;
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief 実行できるスレッドがあるかどうか
+ * @param hart : 自ハート
+ * @retval 0 : 実行できるスレッドなし
+ * @retval 1 : 自ハートのキュー・inbox、または(ワークスティーリングが有効なら)他のハートのキューにスレッドあり
+ */
+int has_ready_thread(struct hart *hart)
+{
+    if ((hart->ready_bitmap != 0) || (__atomic_load_n(&hart->inbox, __ATOMIC_RELAXED) != NULL))
+    {
+        return 1;
+    }
+    if (g_work_stealing)
+    {
+        for (int i = 0; i < g_hart_count; i++)
+        {
+            struct hart *other = &g_harts[g_online_harts[i]];
+            for (int priority = 0; (other != hart) && (priority < THREAD_PRIORITY_NUM); priority++)
+            {
+                if (ready_queue_length(&other->ready_queue[priority]) != 0)
+                {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+/**
+ * @brief リンカスクリプトで定義したユーザーモードのプログラムのシンボル
+ * @note __user_baseはユーザー領域での先頭(実行時の仮想アドレス)、__user_image〜__user_image_endはカーネルイメージ内の実体
+ */
+extern char __user_base[];      // ユーザー領域でのプログラムの先頭 (ページ境界)
+extern char __user_image[];     // カーネルイメージ内のプログラムの先頭 (ページ境界)
+extern char __user_image_end[]; // カーネルイメージ内のプログラムの末尾
+/**
+ * @brief コピーオンライトの統計情報(グローバル変数)
+ */
+int g_fork_cow = 1;               // 1ならforkでページを共有し(コピーオンライト)、0なら全て複写する
+unsigned int g_fork_page_count;   // forkで割り当てたページ数の合計 (ページテーブルと複写したページ)
+unsigned int g_cow_copy_count;    // 書き込み時に複写したページ数
+unsigned int g_cow_reuse_count;   // 書き込み時に共有が終わっていて、複写せずに書き込み可に戻したページ数
+/**
+ * @brief ユーザーのページの共有数の追加
+ * @param paddr : 空きメモリ領域のページの物理アドレス
+ * @details 他のプロセスのページテーブルにも対応付ける前に呼び出す
+ */
+void get_user_page(unsigned int paddr)
+{
+    __atomic_fetch_add(&g_page_share[paddr / PAGE_SIZE - g_first_pfn], 1, __ATOMIC_RELAXED);
+}
+/**
+ * @brief ユーザーのページの対応付けの解除
+ * @param paddr : 空きメモリ領域のページの物理アドレス
+ * @details 共有数を1つ減らし、他に対応付けているプロセスがなければページを解放する
+ *          共有数が0の場合は自プロセスだけが持つため、他のハートが同時に共有数を変えることはない
+ */
+void put_user_page(unsigned int paddr)
+{
+    unsigned int *share = &g_page_share[paddr / PAGE_SIZE - g_first_pfn];
+    unsigned int count = __atomic_load_n(share, __ATOMIC_ACQUIRE);
+    do
+    {
+        if (count == 0)
+        {
+            free_pages((void *)paddr, 1);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(share, &count, count - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+/**
+ * @brief プロセスのページテーブルの解放
+ * @param table1 : create_user_page_tableで作成したページテーブル(1段目)
+ * @details ユーザー領域に対応付けたページ(他のプロセスと共有していない場合)と2段目のページテーブルを解放する
+ *          カーネルイメージ内のページ(プログラム・初期RAMディスクを直接対応付けたもの)と、
+ *          カーネルの対応付けの2段目のページテーブルは共有しているため解放しない
+ */
+void free_user_page_table(unsigned int *table1)
+{
+    for (unsigned int vpn1 = (unsigned int)__user_base >> 22; vpn1 < (USER_END >> 22); vpn1++)
+    {
+        if ((table1[vpn1] & PAGE_V) == 0)
+        {
+            continue;
+        }
+        unsigned int *table0 = (unsigned int *)((table1[vpn1] >> 10) * PAGE_SIZE);
+        for (int vpn0 = 0; vpn0 < 1024; vpn0++)
+        {
+            unsigned int paddr = (table0[vpn0] >> 10) * PAGE_SIZE;
+            if ((table0[vpn0] & PAGE_V) && (paddr >= (unsigned int)__free_ram))
+            {
+                put_user_page(paddr);
+            }
+        }
+        free_pages(table0, 1);
+    }
+    free_pages(table1, 1);
+}
+/**
+ * @brief ユーザー領域への読み書き可のページ(0クリア)の対応付け
+ * @param table1 : プロセスのページテーブル(1段目)
+ * @param vaddr  : 仮想アドレス (ページ境界)
+ * @param n      : ページ数
+ * @retval 0     : 成功
+ * @retval -1    : メモリが不足している (対応付けたページはページテーブルと共に解放する)
+ */
+int map_user_pages(unsigned int *table1, unsigned int vaddr, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+    {
+        void *page = alloc_page_table();
+        if (page == NULL)
+        {
+            return -1;
+        }
+        if (map_page(table1, vaddr + i * PAGE_SIZE, (unsigned int)page, PAGE_R | PAGE_W | PAGE_U) < 0)
+        {
+            free_pages(page, 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+/**
+ * @brief プロセスのページテーブルの割り当て
+ * @return ページテーブル(1段目) (空きメモリがない場合はNULL)
+ * @details カーネルのページテーブルの1段目を複写してカーネルの対応付けを共有する (ユーザー領域は空)
+ */
+unsigned int *alloc_user_page_table(void)
+{
+    unsigned int *table1 = alloc_page_table();
+    if (table1 == NULL)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < 1024; i++)
+    {
+        table1[i] = g_kernel_page_table[i];
+    }
+    return table1;
+}
+/**
+ * @brief プロセスのページテーブルの作成
+ * @return ページテーブル(1段目) (空きメモリがない場合はNULL)
+ * @details カーネルの対応付けを共有し、ユーザー領域の末尾にスタック(0クリア)を対応付ける (プログラムは呼び出し元で対応付ける)
+ */
+unsigned int *create_user_page_table(void)
+{
+    unsigned int *table1 = alloc_user_page_table();
+    if (table1 == NULL)
+    {
+        return NULL;
+    }
+    if (map_user_pages(table1, USER_END - USER_STACK_PAGES * PAGE_SIZE, USER_STACK_PAGES) < 0)
+    {
+        free_user_page_table(table1);
+        return NULL;
+    }
+    return table1;
+}
+/**
+ * @brief ユーザー領域の複製
+ * @param dst : 子プロセスのページテーブル(1段目) (ユーザー領域は空)
+ * @param src : 親プロセスのページテーブル(1段目)
+ * @param cow : 1ならページを共有し(コピーオンライト)、0なら全て複写する
+ * @retval 0  : 成功
+ * @retval -1 : メモリが不足している (対応付けたページはページテーブルと共に解放する)
+ * @details コピーオンライトの場合、書き込み可のページは親子とも書き込み不可にしてPAGE_COWを付け、共有数を増やす
+ *          (読み込みのみのページも共有数を増やして共有する)
+ *          カーネルイメージ内のページは解放されないため、共有数を数えずに対応付ける
+ *          親のエントリを書き換えるため、呼び出し元で自ハートのTLBを無効化すること
+ */
+int copy_user_pages(unsigned int *dst, unsigned int *src, int cow)
+{
+    for (unsigned int vpn1 = (unsigned int)__user_base >> 22; vpn1 < (USER_END >> 22); vpn1++)
+    {
+        if ((src[vpn1] & PAGE_V) == 0)
+        {
+            continue;
+        }
+        unsigned int *table0 = (unsigned int *)((src[vpn1] >> 10) * PAGE_SIZE);
+        for (unsigned int vpn0 = 0; vpn0 < 1024; vpn0++)
+        {
+            unsigned int *pte = &table0[vpn0];
+            unsigned int vaddr = (vpn1 << 22) | (vpn0 << 12);
+            unsigned int paddr = (*pte >> 10) * PAGE_SIZE;
+            unsigned int flags = *pte & (PAGE_R | PAGE_W | PAGE_X | PAGE_U | PAGE_COW);
+            if ((*pte & PAGE_V) == 0)
+            {
+                continue;
+            }
+            if (paddr < (unsigned int)__free_ram)
+            {
+                if (map_page(dst, vaddr, paddr, flags) < 0)
+                {
+                    return -1;
+                }
+                continue;
+            }
+            if (cow)
+            {
+                if (flags & PAGE_W)
+                {
+                    flags = (flags & ~PAGE_W) | PAGE_COW;
+                    *pte = (*pte & ~PAGE_W) | PAGE_COW;
+                }
+                get_user_page(paddr);
+                if (map_page(dst, vaddr, paddr, flags) < 0)
+                {
+                    put_user_page(paddr);
+                    return -1;
+                }
+                continue;
+            }
+            void *page = alloc_pages(1);
+            if (page == NULL)
+            {
+                return -1;
+            }
+            memcpy(page, (void *)paddr, PAGE_SIZE);
+            // 共有中のページも、複写したページは子プロセスだけが持つため書き込み可にする
+            if (flags & PAGE_COW)
+            {
+                flags = (flags & ~PAGE_COW) | PAGE_W;
+            }
+            if (map_page(dst, vaddr, (unsigned int)page, flags) < 0)
+            {
+                free_pages(page, 1);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+/**
+ * @brief カーネルに組み込んだプログラムの対応付け
+ * @param table1 : プロセスのページテーブル(1段目)
+ * @retval 0     : 成功
+ * @retval -1    : ページテーブルを確保できない
+ * @details カーネルイメージ内のUSER_TEXT/USER_RODATAのページを、__user_baseへ読み込み・実行のみで対応付ける (全プロセスで共有)
+ */
+int map_builtin_programs(unsigned int *table1)
+{
+    unsigned int size = (unsigned int)(__user_image_end - __user_image);
+    for (unsigned int offset = 0; offset < size; offset += PAGE_SIZE)
+    {
+        if (map_page(table1, (unsigned int)__user_base + offset, (unsigned int)__user_image + offset, PAGE_R | PAGE_X | PAGE_U) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+/**
+ * @brief プロセスの解放
+ * @param process : 終了したスレッドのプロセス
+ * @details アドレス空間を解放し、親プロセスがあれば終了を知らせる (どのハートもこのプロセスのページテーブルを使っていないこと)
+ */
+void free_process(struct process *process)
+{
+    struct process *parent = process->parent;
+    free_user_page_table(process->page_table);
+    slab_free(&g_process_cache, process);
+    // 親プロセスへ終了を知らせる (親プロセスは子プロセスが全て終了するまで終了しない)
+    if (parent != NULL)
+    {
+        spin_lock(&parent->child_wq.lock);
+        parent->children--;
+        wait_queue_wake_one(&parent->child_wq);
+        spin_unlock(&parent->child_wq.lock);
+    }
+}
+/**
+ * @brief スレッドの解放
+ * @param thread : 終了したスレッド
+ * @details スタックをスタック枠の空きリストへ、スレッドをスラブキャッシュへ返す
+ *          解放するスレッドのスタック上で実行中でないこと
+ */
+void free_thread(struct thread *thread)
+{
+    free_thread_stack(thread->stack);
+    slab_free(&g_thread_cache, thread);
+}
+/**
+ * @brief スレッドのスタックの使用量(最大値)
+ * @param thread : スレッド
+ * @return これまでに使用したスタックのバイト数 (ハイウォーターマーク)
+ * @details 作成時に書き込んだ値が残っている部分を下端から数え、残っていない最初の位置までを使用済みとする
+ *          (スタック全体を走査せず、未使用の部分だけを読む)
+ */
+unsigned int thread_stack_usage(struct thread *thread)
+{
+    unsigned int *p = (unsigned int *)thread->stack;
+    unsigned int *end = (unsigned int *)&thread->stack[thread->stack_size];
+    while ((p < end) && (*p == STACK_PAINT))
+    {
+        p++;
+    }
+    return (unsigned int)((char *)end - (char *)p);
+}
+/**
+ * @brief 終了したスレッドの解放
+ * @param hart : 自ハート
+ * @details 終了したスレッドは自分のスタック上で実行中のため自身では解放できない
+ *          スケジューラで切り替えた後に、同じハートで次に実行するスレッドが解放する
+ *          joinableのスレッドはスタックだけを解放し、合流を待つスレッドを起こす (スレッドは合流したスレッドが解放する)
+ *          切り替えを終えた後のため、合流したスレッドがすぐに解放しても保存途中のコンテキストを壊さない
+ *          終了していないスレッドの数は解放を終えてから減らす (全スレッドの終了を待つ側が、解放前の空きページ数を見ないようにする)
+ */
+void reap_dead_thread(struct hart *hart)
+{
+    struct thread *thread = hart->dead_thread;
+    if (thread == NULL)
+    {
+        return;
+    }
+    hart->dead_thread = NULL;
+    // 終了したスレッドから切り替え済みのため、プロセスのページテーブルはどのハートも使っていない
+    if (thread->process != NULL)
+    {
+        free_process(thread->process);
+        thread->process = NULL;
+    }
+    if (!thread->joinable)
+    {
+        free_thread(thread);
+    }
+    else
+    {
+        free_thread_stack(thread->stack);
+        spin_lock(&thread->join_wq.lock);
+        thread->exited = 1;
+        wait_queue_wake_one(&thread->join_wq);
+        spin_unlock(&thread->join_wq.lock);
+    }
+    // 最後のスレッドが終了したら、終了を待って停止しているかもしれないブートしたハートを起こす
+    if ((__atomic_fetch_sub(&g_thread_count, 1, __ATOMIC_RELEASE) == 1) && (hart->hartid != g_boot_hartid))
+    {
+        sbi_send_ipi(g_boot_hartid);
+    }
+}
+/**
+ * @brief コンテキストスイッチの後処理
+ * @details 切り替え先のスレッドで、切り替え前のスレッドを実行可能キューへ戻し、終了したスレッドを解放する
+ *          (切り替え前のスレッドのコンテキストを保存し終えるまでキューへ戻さないことで、
+ *           保存途中のスレッドを他のハートが盗んで実行しないようにする)
+ *          待ち行列で待つスレッドの場合は、同じ理由で待ち行列のロックもここで解放する
+ */
+void finish_switch(void)
+{
+    struct hart *hart = this_hart();
+    PROFILE_END(PROFILE_SWITCH_CONTEXT, hart->switch_start_cycle);
+    if (hart->requeue_thread != NULL)
+    {
+        enqueue_ready_thread(hart, hart->requeue_thread);
+        hart->requeue_thread = NULL;
+    }
+    if (hart->release_lock != NULL)
+    {
+        spin_unlock(hart->release_lock);
+        hart->release_lock = NULL;
+    }
+    reap_dead_thread(hart);
+}
+/**
+ * @brief スレッドの統計情報の表示
+ * @param thread  : 統計情報を表示するスレッド
+ * @param elapsed : 計測期間 (tick)
+ * @details クォンタムのジッタ(平均/最大)と1秒当たりのコンテキストスイッチ回数を表示する
+ */
+void print_thread_stats(struct thread *thread, unsigned int elapsed)
+{
+    struct thread_stats *stats = &thread->stats;
+    unsigned int elapsed_ms = elapsed / TICKS_PER_MS;
+    unsigned int jitter_avg = (stats->preempt_count > 0) ? (stats->jitter_sum / stats->preempt_count) : 0;
+
+    if (elapsed_ms == 0)
+    {
+        elapsed_ms = 1;
+    }
+    printf("thread%d: %d ms switches=%d (%d/s) preempted=%d jitter avg=%d us max=%d us (quantum %d us) stack %d/%d bytes\n",
+           thread->execution.id,
+           elapsed_ms,
+           stats->switch_count,
+           stats->switch_count * 1000 / elapsed_ms,
+           stats->preempt_count,
+           jitter_avg / TICKS_PER_US,
+           stats->jitter_max / TICKS_PER_US,
+           TIME_SLICE_TICKS / TICKS_PER_US,
+           thread_stack_usage(thread),
+           thread->stack_size);
+}
+/**
+ * @brief スレッドの終了
+ * @details 実行中のスレッドを終了状態にして他のスレッドへ切り替える (呼び出し元へは戻らない)
+ *          スタックの解放と合流を待つスレッドを起こす処理、終了していないスレッドの数を減らす処理は、
+ *          同じハートで次に実行するスレッドが行う (reap_dead_thread)
+ */
+void thread_exit(void)
+{
+    intr_disable();
+    struct hart *hart = this_hart();
+    struct thread *thread = hart->current_thread;
+    if (g_report_thread_stats)
+    {
+        print_thread_stats(thread, (unsigned int)(get_time() - thread->create_time));
+    }
+    thread->execution.status = TERMINATED;
+    hart->completed_count++;
+    schedule_threads();
+}
+/**
+ * @brief スレッドの開始処理 (トランポリン)
+ * @details 新しいスレッドが最初にコンテキストスイッチされたときに実行される
+ *          スケジューラは割り込み禁止の状態で切り替えるため、ここで割り込みを許可してから
+ *          エントリー関数を引数付きで呼び出し、エントリー関数から戻ったらthread_exitでスレッドを終了する
+ */
+void thread_start(void)
+{
+    // 新しいスレッドはswitch_contextから戻らずにここから始まるため、ここで切り替えの後処理を行う
+    finish_switch();
+    // タイマー割り込みによるプリエンプションを有効化
+    intr_enable();
+    // スレッドのエントリー関数を実行
+    struct thread *thread = current_thread();
+    thread->entry(thread->arg);
+    thread_exit();
+}
+/**
+ * @brief スレッドの管理情報の初期化
+ * @param thread : スラブキャッシュから確保したスレッド
+ * @param entry  : スレッドのエントリー関数のポインタ
+ * @param arg    : エントリー関数に渡す引数
+ * @details スタックとコンテキスト(sp)以外の項目を初期化する
+ */
+void init_thread_struct(struct thread *thread, void (*entry)(void *arg), void *arg)
+{
+    thread->execution.id = __atomic_fetch_add(&g_next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->execution.status = TERMINATED;
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->trap_frame = NULL;
+    thread->slice_start = 0;
+    thread->priority = THREAD_PRIORITY_DEFAULT;
+    thread->next = NULL;
+    thread->hart = NULL;
+    thread->create_time = get_time();
+    thread->stats = (struct thread_stats){0};
+    thread->joinable = 0;
+    thread->exited = 0;
+    init_wait_queue(&thread->join_wq);
+    thread->process = NULL;
+#ifdef __riscv_flen
+    memset(&thread->fpu, 0, sizeof(thread->fpu));
+    thread->fpu_hart = NULL;
+#endif
+}
+/**
+ * @brief スレッドの割り当て
+ * @param entry : スレッドのエントリー関数のポインタ
+ * @param arg   : エントリー関数に渡す引数
+ * @return 割り当てたスレッド (メモリが不足している場合はNULL)
+ * @details スラブキャッシュからスレッドを、ページ割り当てからスタックを確保し、
+ *          コンテキストスイッチできる状態に初期化する (実行可能キューへは追加しない)
+ */
+struct thread *alloc_thread(void (*entry)(void *arg), void *arg)
+{
+    // スレッドとスタックの確保
+    struct thread *thread = slab_alloc(&g_thread_cache);
+    if (thread == NULL)
+    {
+        return NULL;
+    }
+    thread->stack = alloc_thread_stack();
+    if (thread->stack == NULL)
+    {
+        slab_free(&g_thread_cache, thread);
+        return NULL;
+    }
+    thread->stack_size = THREAD_STACK_SIZE;
+    // 使用量を確認できるように、スタック全体に決まった値を書き込んでおく
+    for (unsigned int *p = (unsigned int *)thread->stack; p < (unsigned int *)&thread->stack[thread->stack_size]; p++)
+    {
+        *p = STACK_PAINT;
+    }
+    // コンテキストスイッチ用のレジスタの初期設定
+    // スタックの末端はページ境界 (RISC-Vの呼び出し規約の16バイト境界を満たす)
+    unsigned int *sp = (unsigned int *)&thread->stack[thread->stack_size];
+    *--sp = 0;                          // s11
+    *--sp = 0;                          // s10
+    *--sp = 0;                          // s9
+    *--sp = 0;                          // s8
+    *--sp = 0;                          // s7
+    *--sp = 0;                          // s6
+    *--sp = 0;                          // s5
+    *--sp = 0;                          // s4
+    *--sp = 0;                          // s3
+    *--sp = 0;                          // s2
+    *--sp = 0;                          // s1
+    *--sp = 0;                          // s0
+    *--sp = (unsigned int)thread_start; // ra (スレッドの開始処理からエントリー関数を呼び出す)
+    // スレッドの初期設定
+    init_thread_struct(thread, entry, arg);
+    thread->sp = (unsigned int)sp;
+    return thread;
+}
+/**
+ * @brief 割り当てたスレッドの開始
+ * @param thread : alloc_threadで割り当てたスレッド (NULLの場合は何もしない)
+ * @param hart   : スレッドを実行するハート
+ * @return threadの値
+ * @details 指定したハートの実行可能キューへ追加してスレッドを使用可能な状態にする
+ *          他のハートの場合は、そのハートのinboxを経由する
+ */
+struct thread *start_thread_on(struct thread *thread, struct hart *hart)
+{
+    if (thread == NULL)
+    {
+        return NULL;
+    }
+    // 終了時の減算より先に数える
+    __atomic_fetch_add(&g_thread_count, 1, __ATOMIC_RELAXED);
+    // 実行可能キューへ追加
+    unsigned int sie = intr_disable();
+    thread->execution.status = READY;
+    ready_thread_on(thread, hart);
+    intr_restore(sie);
+    return thread;
+}
+/**
+ * @brief スレッドの作成 (ハート指定)
+ * @param entry : スレッドのエントリー関数のポインタ
+ * @param arg   : エントリー関数に渡す引数
+ * @param hart  : スレッドを実行するハート
+ * @return 作成したスレッド (メモリが不足している場合はNULL)
+ * @details 終了時に解放されるスレッド(合流しないスレッド)を作成する
+ */
+struct thread *create_thread_on(void (*entry)(void *arg), void *arg, struct hart *hart)
+{
+    return start_thread_on(alloc_thread(entry, arg), hart);
+}
+/**
+ * @brief スレッドを割り当てるハートの選択
+ * @return 起動済みのハート (ラウンドロビン)
+ */
+struct hart *next_thread_hart(void)
+{
+    unsigned int n = __atomic_fetch_add(&g_next_hart, 1, __ATOMIC_RELAXED);
+    return &g_harts[g_online_harts[n % g_hart_count]];
+}
+/**
+ * @brief スレッドの作成
+ * @param entry : スレッドのエントリー関数のポインタ
+ * @param arg   : エントリー関数に渡す引数
+ * @return 作成したスレッド (メモリが不足している場合はNULL)
+ * @details 起動済みのハートへラウンドロビンで割り当てる
+ */
+struct thread *create_thread(void (*entry)(void *arg), void *arg)
+{
+    return create_thread_on(entry, arg, next_thread_hart());
+}
+/**
+ * @brief 合流するスレッドの作成
+ * @param entry : スレッドのエントリー関数のポインタ
+ * @param arg   : エントリー関数に渡す引数
+ * @return 作成したスレッド (メモリが不足している場合はNULL)
+ * @details 作成したスレッドは、必ずthread_joinで一度だけ合流すること (合流するまでスレッドを解放しない)
+ */
+struct thread *create_joinable_thread(void (*entry)(void *arg), void *arg)
+{
+    struct thread *thread = alloc_thread(entry, arg);
+    if (thread != NULL)
+    {
+        thread->joinable = 1;
+    }
+    return start_thread_on(thread, next_thread_hart());
+}
+/**
+ * @brief スレッドの優先度の変更
+ * @param thread   : 優先度を変更するスレッド
+ * @param priority : 優先度 (0が最高優先度)
+ * @details 実行可能キューにつながっているスレッドは(他のハートが盗む場合があり途中から外せないため)、
+ *          次に実行可能キューへ戻す時から新しい優先度のキューにつなぐ
+ */
+void set_thread_priority(struct thread *thread, int priority)
+{
+    __atomic_store_n(&thread->priority, priority, __ATOMIC_RELAXED);
+}
+/**
+ * @brief 全てのスレッドが終了状態であるかどうか
+ * @retval  0   :   動作中のスレッドあり
+ * @retval  1   :   全てのスレッドが終了状態である
+ * @details スレッドの作成・終了時に更新する終了していないスレッドの数で判定する
+ */
+int are_all_threads_terminated(void)
+{
+    return __atomic_load_n(&g_thread_count, __ATOMIC_ACQUIRE) == 0;
+}
+/**
+ * @brief 次のタイマー割り込みの設定 (ティックレス)
+ * @param hart : 自ハート
+ * @details 実行中のスレッドのタイムスライスの終了と、最も早く起きるスリープ中のスレッドの時刻のうち、
+ *          早い方だけにタイマーを設定する (アイドル中でスリープ中のスレッドもなければ、タイマーを止める)
+ *          設定済みの時刻と同じ場合は、SBIの呼び出し(Mモードへのトラップ)を省く (割り込み禁止で呼び出すこと)
+ */
+void program_timer(struct hart *hart)
+{
+    unsigned long long deadline = TIMER_NEVER;
+    struct thread *thread = hart->current_thread;
+    if (thread != hart->idle_thread)
+    {
+        deadline = thread->slice_start + TIME_SLICE_TICKS;
+    }
+    if ((hart->sleep_heap != NULL) && (hart->sleep_heap->wake_time < deadline))
+    {
+        deadline = hart->sleep_heap->wake_time;
+    }
+    if (deadline != hart->timer_deadline)
+    {
+        hart->timer_deadline = deadline;
+        sbi_set_timer(deadline);
+    }
+}
+/**
+ * @brief タイムスライスの開始
+ * @param thread : これから実行するスレッド (自ハートのcurrent_threadに設定済みであること)
+ * @details 実行を開始する時刻を記録し、タイムスライス経過後にタイマー割り込みが発生するように設定する
+ *          スレッドを切り替えるたびに設定し直すことで、各スレッドは1クォンタム分の時間を必ず使える
+ *          アイドルスレッドにはタイムスライスを設定しない (スリープ中のスレッドが起きる時刻だけを設定する)
+ */
+void start_time_slice(struct thread *thread)
+{
+    thread->slice_start = get_time();
+    program_timer(thread->hart);
+}
+#ifdef __riscv_flen
+/**
+ * @brief 浮動小数点レジスタの保存
+ * @param fpu : 保存先 (a0)
+ */
+__attribute__((naked)) /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+void
+fpu_save(struct fpu_state *fpu)
+{
+    __asm__ __volatile__(
+        FPU_STORE " f0,  0 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f1,  1 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f2,  2 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f3,  3 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f4,  4 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f5,  5 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f6,  6 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f7,  7 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f8,  8 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f9,  9 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f10, 10 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f11, 11 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f12, 12 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f13, 13 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f14, 14 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f15, 15 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f16, 16 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f17, 17 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f18, 18 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f19, 19 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f20, 20 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f21, 21 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f22, 22 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f23, 23 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f24, 24 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f25, 25 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f26, 26 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f27, 27 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f28, 28 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f29, 29 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f30, 30 * " FPU_REG_SIZE "(a0)\n"
+        FPU_STORE " f31, 31 * " FPU_REG_SIZE "(a0)\n"
+        "frcsr t0\n"                        /* fcsrを読み込む */
+        "sw t0, 32 * " FPU_REG_SIZE "(a0)\n" /* fcsrを保存 */
+        "ret\n");
+}
+/**
+ * @brief 浮動小数点レジスタの復元
+ * @param fpu : 保存した領域 (a0)
+ */
+__attribute__((naked)) /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+void
+fpu_restore(struct fpu_state *fpu)
+{
+    __asm__ __volatile__(
+        FPU_LOAD " f0,  0 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f1,  1 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f2,  2 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f3,  3 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f4,  4 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f5,  5 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f6,  6 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f7,  7 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f8,  8 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f9,  9 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f10, 10 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f11, 11 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f12, 12 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f13, 13 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f14, 14 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f15, 15 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f16, 16 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f17, 17 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f18, 18 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f19, 19 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f20, 20 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f21, 21 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f22, 22 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f23, 23 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f24, 24 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f25, 25 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f26, 26 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f27, 27 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f28, 28 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f29, 29 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f30, 30 * " FPU_REG_SIZE "(a0)\n"
+        FPU_LOAD " f31, 31 * " FPU_REG_SIZE "(a0)\n"
+        "lw t0, 32 * " FPU_REG_SIZE "(a0)\n" /* fcsrを読み込む */
+        "fscsr t0\n"                        /* fcsrを復元 */
+        "ret\n");
+}
+/**
+ * @brief 浮動小数点レジスタの切り替え (遅延保存・遅延読み込み)
+ * @param hart : 自ハート
+ * @param prev : 切り替え前のスレッド
+ * @param next : 切り替え後のスレッド
+ * @details FSがOff以外なら、レジスタは切り替え前のスレッド(hart->fpu_owner)の状態を持っている
+ *          FSがDirty(書き換えられた)の場合だけ保存し、持ち主はそのままにしてレジスタの内容を残す
+ *          切り替え後のスレッドが持ち主ならFSをCleanにして、読み込まずにそのまま使う
+ *          持ち主でなければFSをOffにし、最初に浮動小数点命令を実行した時に読み込む (handle_fpu_disabled)
+ *          浮動小数点命令を使わないスレッド(アイドルスレッドなど)を挟んでも、持ち主の状態は読み込み直さない
+ *          (他のハートで読み込まれた後は、そのハートで変更されているかもしれないため、持ち主でも読み込み直す)
+ */
+void fpu_switch(struct hart *hart, struct thread *prev, struct thread *next)
+{
+    unsigned int sstatus = 0;
+    __asm__ __volatile__("csrr %0, sstatus\n" : "=r"(sstatus)); /* sstatusを読み込む */
+    if ((sstatus & SSTATUS_FS) == SSTATUS_FS_DIRTY)
+    {
+        fpu_save(&prev->fpu);
+    }
+    __asm__ __volatile__("csrc sstatus, %0\n" ::"r"(SSTATUS_FS)); /* FSをOffにする */
+    if ((hart->fpu_owner == next) && (next->fpu_hart == hart))
+    {
+        __asm__ __volatile__("csrs sstatus, %0\n" ::"r"(SSTATUS_FS_CLEAN)); /* FSをCleanに設定 */
+    }
+}
+/**
+ * @brief 浮動小数点命令の例外処理 (FS=Off)
+ * @param tf : トラップフレーム
+ * @details FSがOffの状態で浮動小数点命令を実行すると不正命令例外になるため、
+ *          実行中のスレッドの状態をレジスタへ読み込んで持ち主にし、FSをCleanにして同じ命令から再開する
+ *          (前の持ち主の状態は、書き換えていればfpu_switchで保存済み)
+ *          FSがOff以外での不正命令例外は、浮動小数点命令以外の不正命令として扱う
+ */
+void handle_fpu_disabled(struct trap_frame *tf)
+{
+    struct hart *hart = this_hart();
+    struct thread *thread = hart->current_thread;
+    unsigned int sstatus = 0;
+    __asm__ __volatile__("csrr %0, sstatus\n" : "=r"(sstatus)); /* sstatusを読み込む */
+    if (((sstatus & SSTATUS_FS) != 0) || (thread == NULL))
+    {
+        if ((tf->sstatus & SSTATUS_SPP) == 0)
+        {
+            handle_user_fault(tf);
+        }
+        else
+        {
+            handle_unknown_trap(tf);
+        }
+        return;
+    }
+    __asm__ __volatile__("csrs sstatus, %0\n" ::"r"(SSTATUS_FS_CLEAN)); /* 浮動小数点命令を使えるようにする */
+    fpu_restore(&thread->fpu);
+    __asm__ __volatile__(
+        "csrc sstatus, %0\n" /* FSをクリア */
+        "csrs sstatus, %1\n" /* 読み込みでDirtyになるため、Cleanに戻す */
+        ::"r"(SSTATUS_FS), "r"(SSTATUS_FS_CLEAN));
+    thread->fpu_hart = hart;
+    hart->fpu_owner = thread;
+}
+#endif
+/**
+ * @brief プロセスのASIDの取得
+ * @param process : プロセス
+ * @return 現在の世代で割り当てたASID
+ * @details 世代が古ければ割り当て直し、使い切っていれば世代を進める
+ *          (各ハートは次にプロセスへ切り替える時に世代の変化を見て、TLBを全て無効化する)
+ */
+unsigned int get_process_asid(struct process *process)
+{
+    if (process->asid_generation == __atomic_load_n(&g_asid_generation, __ATOMIC_ACQUIRE))
+    {
+        return process->asid;
+    }
+    spin_lock(&g_asid_lock);
+    if (process->asid_generation != g_asid_generation)
+    {
+        if (g_asid_next > g_asid_max)
+        {
+            __atomic_store_n(&g_asid_generation, g_asid_generation + 1, __ATOMIC_RELEASE);
+            g_asid_next = 1;
+            g_asid_rollover_count++;
+        }
+        process->asid = g_asid_next++;
+        process->asid_generation = g_asid_generation;
+    }
+    spin_unlock(&g_asid_lock);
+    return process->asid;
+}
+/**
+ * @brief アドレス空間の切り替え
+ * @param hart    : 自ハート
+ * @param process : 切り替え先のプロセス (カーネルのスレッドはNULL)
+ * @details ASIDを使う場合はsatpを書き換えるだけでTLBを無効化しない
+ *          ただし、ASIDの世代が進んでいれば全て、プロセスが他のハートから移ってきた場合はそのASIDのエントリだけを無効化する
+ *          (他のハートで実行中に書き換えたページテーブルの古い変換結果が、このハートのTLBに残っている場合がある)
+ *          同じハートで続けて実行したプロセスのページテーブルは、書き換えた時点で自ハートのTLBを無効化(sfence.vma)している
+ */
+void switch_address_space(struct hart *hart, struct process *process)
+{
+    unsigned int *table1 = (process != NULL) ? process->page_table : g_kernel_page_table;
+    if (!g_asid_enable)
+    {
+        switch_page_table(table1);
+        return;
+    }
+    unsigned int asid = (process != NULL) ? get_process_asid(process) : 0;
+    unsigned int satp = SATP_SV32 | (asid << SATP_ASID_SHIFT) | ((unsigned int)table1 / PAGE_SIZE);
+    __asm__ __volatile__("csrw satp, %0\n" ::"r"(satp) : "memory");
+    if (hart->asid_generation != __atomic_load_n(&g_asid_generation, __ATOMIC_ACQUIRE))
+    {
+        hart->asid_generation = g_asid_generation;
+        __asm__ __volatile__("sfence.vma\n" ::: "memory");
+    }
+    else if ((process != NULL) && (process->asid_hart != hart))
+    {
+        __asm__ __volatile__("sfence.vma zero, %0\n" ::"r"(asid) : "memory");
+    }
+    if (process != NULL)
+    {
+        process->asid_hart = hart;
+    }
+}
+/**
+ * @brief スレッドスケジューラ
+ * @details 現在のスレッドを休ませて、次に動作するスレッドを探索し、スレッドを動作させる
+ *          スレッドの切り替えを行うスケジュール関数
+ *          スレッドからの呼び出し(自発的な切り替え)とタイマー割り込みからの呼び出し(プリエンプション)の
+ *          両方があるため、切り替え中は割り込みを禁止する
+ */
+void schedule_threads(void)
+{
+    unsigned int sie = intr_disable(); // 割り込み禁止 (元の状態はスレッドごとのスタックに保持される)
+    struct hart *hart = this_hart();
+    struct thread *prev = hart->current_thread;
+    struct thread *next = NULL;
+    PROFILE_BEGIN(start);
+
+    // 他のハートから追加されたスレッドを実行可能キューへ移す
+    drain_inbox(hart);
+    // 実行中のスレッドがまだ動作できる場合は、同じ優先度以上のスレッドだけと交代する
+    // (同じ優先度のスレッドで順番に実行し、低い優先度のスレッドには譲らない)
+    int runnable = (prev->execution.status == RUNNING) && (prev != hart->idle_thread);
+    next = dequeue_ready_thread(hart, runnable ? prev->priority : THREAD_PRIORITY_NUM - 1);
+    // 自ハートに実行可能なスレッドがない場合は、他のハートから盗む
+    if ((next == NULL) && !runnable)
+    {
+        next = steal_thread(hart);
+    }
+    // それでもない場合は、実行中のスレッドを続けるか、アイドルスレッドに設定
+    if (next == NULL)
+    {
+        next = runnable ? prev : hart->idle_thread;
+    }
+    // アイドルスレッド以外を実行していた時間を数える (ハートの使用率)
+    if (prev != hart->idle_thread)
+    {
+        hart->busy_ticks += (unsigned int)(get_time() - prev->slice_start);
+    }
+    // 同じスレッドを続ける場合は、タイムスライスだけを設定し直して戻る
+    // (コンテキストスイッチと、状態・統計情報の書き込みを省く)
+    if (next == prev)
+    {
+        start_time_slice(prev);
+        PROFILE_END(PROFILE_SCHEDULE_THREADS, start);
+        intr_restore(sie);
+        return;
+    }
+    // 実行中のスレッドは、切り替え後に実行可能キューの末尾に戻す (finish_switch)
+    if (prev->execution.status == RUNNING)
+    {
+        prev->execution.status = READY;
+        if (prev != hart->idle_thread)
+        {
+            hart->requeue_thread = prev;
+        }
+    }
+    // 終了したスレッドは、切り替え後に次のスレッドで解放する
+    if (prev->execution.status == TERMINATED)
+    {
+        hart->dead_thread = prev;
+    }
+    // コンテキストスイッチを行う
+    next->execution.status = RUNNING;
+    next->hart = hart;
+    next->stats.switch_count++;
+    hart->current_thread = next;
+    start_time_slice(next);
+#ifdef __riscv_flen
+    fpu_switch(hart, prev, next);
+#endif
+    // プロセスのスレッドはプロセスのページテーブル、カーネルのスレッドはカーネルのページテーブルへ切り替える
+    // (カーネルのスレッドで終了したプロセスのページテーブルを使い続けないようにする)
+    unsigned int *page_table = (next->process != NULL) ? next->process->page_table : g_kernel_page_table;
+    if (page_table != hart->page_table)
+    {
+        switch_address_space(hart, next->process);
+        hart->page_table = page_table;
+    }
+    PROFILE_END(PROFILE_SCHEDULE_THREADS, start);
+    PROFILE_MARK(hart->switch_start_cycle);
+    switch_context(&prev->sp, &next->sp);
+    finish_switch();
+    // 再びこのスレッドが選ばれたら、切り替え前の割り込み状態に戻す
+    intr_restore(sie);
+}
+/**
+ * @brief スリープ中のヒープの併合
+ * @param a : ヒープの根 (NULLなら空)
+ * @param b : ヒープの根 (NULLなら空)
+ * @return 併合したヒープの根
+ * @details 起きる時刻の遅い方の根を、早い方の根の最初の子にする (O(1))
+ *          根のnextはNULLであること
+ */
+struct thread *sleep_heap_meld(struct thread *a, struct thread *b)
+{
+    if (a == NULL)
+    {
+        return b;
+    }
+    if (b == NULL)
+    {
+        return a;
+    }
+    if (b->wake_time < a->wake_time)
+    {
+        struct thread *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    b->next = a->sleep_child;
+    a->sleep_child = b;
+    return a;
+}
+/**
+ * @brief スリープ中のヒープの根の取り出し
+ * @param hart : 自ハート
+ * @return 最も早く起きるスレッド
+ * @details 根の子を左から2つずつ併合し、できたヒープを右から順に併合する (ペアリングヒープの2パス併合)
+ *          償却計算量はO(log n)
+ */
+struct thread *sleep_heap_pop(struct hart *hart)
+{
+    struct thread *root = hart->sleep_heap;
+    struct thread *list = root->sleep_child;
+    struct thread *pairs = NULL; // 2つずつ併合したヒープ (逆順につなぐ)
+    while (list != NULL)
+    {
+        struct thread *a = list;
+        struct thread *b = a->next;
+        list = (b != NULL) ? b->next : NULL;
+        a->next = NULL;
+        if (b != NULL)
+        {
+            b->next = NULL;
+        }
+        struct thread *heap = sleep_heap_meld(a, b);
+        heap->next = pairs;
+        pairs = heap;
+    }
+    hart->sleep_heap = NULL;
+    while (pairs != NULL)
+    {
+        struct thread *heap = pairs;
+        pairs = heap->next;
+        heap->next = NULL;
+        hart->sleep_heap = sleep_heap_meld(hart->sleep_heap, heap);
+    }
+    root->sleep_child = NULL;
+    return root;
+}
+/**
+ * @brief 指定した時刻までのスリープ
+ * @param deadline : 起きる時刻 (timeレジスタの値)
+ * @details 実行中のスレッドを自ハートのスリープ中のヒープへ追加し、WAITING状態にして他のスレッドへ切り替える
+ *          ヒープは起きる時刻の最小ヒープ(ペアリングヒープ)で、追加はO(1)、最も早いスレッドの取り出しは償却O(log n)
+ *          ヒープは自ハートだけが割り込み禁止で操作するため、ロックは使わない
+ *          (起きたスレッドは自ハートの実行可能キューへ戻り、他のハートに盗まれることはある)
+ */
+void thread_sleep_until(unsigned long long deadline)
+{
+    unsigned int sie = intr_disable();
+    struct hart *hart = this_hart();
+    struct thread *thread = hart->current_thread;
+
+    thread->wake_time = deadline;
+    thread->next = NULL;
+    thread->sleep_child = NULL;
+    hart->sleep_heap = sleep_heap_meld(hart->sleep_heap, thread);
+    thread->execution.status = WAITING;
+    schedule_threads();
+    intr_restore(sie);
+}
+/**
+ * @brief ミリ秒単位のスリープ
+ * @param ms : スリープする時間(ms)
+ */
+void sleep_ms(unsigned int ms)
+{
+    thread_sleep_until(get_time() + (unsigned long long)ms * TICKS_PER_MS);
+}
+/**
+ * @brief 起きる時刻になったスレッドを実行可能キューへ戻す
+ * @param hart : 自ハート
+ * @param now  : 現在時刻
+ * @details スリープ中のヒープの根は最も早く起きるスレッドのため、根の時刻を過ぎている間だけ取り出す (割り込み禁止で呼び出すこと)
+ */
+void wake_sleeping_threads(struct hart *hart, unsigned long long now)
+{
+    while ((hart->sleep_heap != NULL) && (hart->sleep_heap->wake_time <= now))
+    {
+        struct thread *thread = sleep_heap_pop(hart);
+        thread->execution.status = READY;
+        enqueue_ready_thread(hart, thread);
+    }
+}
+/**
+ * @brief 待ち行列で待つ
+ * @param wq  : 待ち行列 (spin_lock_irqsaveでロックを取得済みであること)
+ * @param sie : spin_lock_irqsaveで取得したsstatus.SIEの値
+ * @details 実行中のスレッドを末尾に追加してWAITING状態にし、他のスレッドへ切り替える
+ *          ロックは切り替えの後処理(finish_switch)で解放するため、起こす側はコンテキストの保存が終わったスレッドだけを見る
+ *          起こされて戻った時はロックを持っておらず、割り込み状態をsieに戻している
+ */
+void wait_queue_sleep(struct wait_queue *wq, unsigned int sie)
+{
+    struct hart *hart = this_hart();
+    struct thread *thread = hart->current_thread;
+    thread->next = NULL;
+    if (wq->tail != NULL)
+    {
+        wq->tail->next = thread;
+    }
+    else
+    {
+        wq->head = thread;
+    }
+    wq->tail = thread;
+    thread->execution.status = WAITING;
+    hart->release_lock = &wq->lock;
+    schedule_threads();
+    intr_restore(sie);
+}
+/**
+ * @brief 待ち行列の先頭のスレッドを起こす
+ * @param wq : 待ち行列 (ロックを取得済みであること)
+ * @return 起こしたスレッド (待っているスレッドがない場合はNULL)
+ * @details 最後に実行したハートで実行可能にする (他のハートの場合はIPIで知らせる)
+ */
+struct thread *wait_queue_wake_one(struct wait_queue *wq)
+{
+    struct thread *thread = wq->head;
+    if (thread == NULL)
+    {
+        return NULL;
+    }
+    wq->head = thread->next;
+    if (wq->head == NULL)
+    {
+        wq->tail = NULL;
+    }
+    thread->next = NULL;
+    thread->execution.status = READY;
+    ready_thread_on(thread, thread->hart);
+    return thread;
+}
+/**
+ * @brief ミューテックス
+ * @note 取得できない場合は待ち行列で待ち、解放するスレッドが先頭の待っているスレッドへ所有権を直接渡す
+ *       (起こされたスレッドが取り直す必要がなく、後から来たスレッドに横取りされない)
+ */
+struct mutex
+{
+    struct wait_queue wq; // 取得を待つスレッドの待ち行列
+    int locked;           // 1なら取得されている
+    struct thread *owner; // 取得しているスレッド
+};
+/**
+ * @brief ミューテックスの初期化
+ * @param mutex : ミューテックス
+ */
+void init_mutex(struct mutex *mutex)
+{
+    init_wait_queue(&mutex->wq);
+    mutex->locked = 0;
+    mutex->owner = NULL;
+}
+/**
+ * @brief ミューテックスの取得
+ * @param mutex : ミューテックス
+ */
+void mutex_lock(struct mutex *mutex)
+{
+    unsigned int sie = spin_lock_irqsave(&mutex->wq.lock);
+    if (!mutex->locked)
+    {
+        mutex->locked = 1;
+        mutex->owner = this_hart()->current_thread;
+        spin_unlock_irqrestore(&mutex->wq.lock, sie);
+        return;
+    }
+    // 解放するスレッドから所有権を渡されるまで待つ
+    wait_queue_sleep(&mutex->wq, sie);
+}
+/**
+ * @brief ミューテックスの解放
+ * @param mutex : ミューテックス
+ */
+void mutex_unlock(struct mutex *mutex)
+{
+    unsigned int sie = spin_lock_irqsave(&mutex->wq.lock);
+    struct thread *thread = wait_queue_wake_one(&mutex->wq);
+    mutex->owner = thread;
+    mutex->locked = (thread != NULL);
+    spin_unlock_irqrestore(&mutex->wq.lock, sie);
+}
+/**
+ * @brief 計数セマフォ
+ * @note countが0の間はdownで待ち、upは待っているスレッドがあれば(countを増やさずに)直接起こす
+ */
+struct semaphore
+{
+    struct wait_queue wq; // countが0で待つスレッドの待ち行列
+    int count;            // 残りの数
+};
+/**
+ * @brief セマフォの初期化
+ * @param sem   : セマフォ
+ * @param count : 初期値
+ */
+void init_semaphore(struct semaphore *sem, int count)
+{
+    init_wait_queue(&sem->wq);
+    sem->count = count;
+}
+/**
+ * @brief セマフォの獲得 (P操作)
+ * @param sem : セマフォ
+ */
+void sem_down(struct semaphore *sem)
+{
+    unsigned int sie = spin_lock_irqsave(&sem->wq.lock);
+    if (sem->count > 0)
+    {
+        sem->count--;
+        spin_unlock_irqrestore(&sem->wq.lock, sie);
+        return;
+    }
+    wait_queue_sleep(&sem->wq, sie);
+}
+/**
+ * @brief セマフォの解放 (V操作)
+ * @param sem : セマフォ
+ */
+void sem_up(struct semaphore *sem)
+{
+    unsigned int sie = spin_lock_irqsave(&sem->wq.lock);
+    if (wait_queue_wake_one(&sem->wq) == NULL)
+    {
+        sem->count++;
+    }
+    spin_unlock_irqrestore(&sem->wq.lock, sie);
+}
+/**
+ * @brief 条件変数
+ * @note ミューテックスと組み合わせて、条件が成り立つまで待つ
+ *       (起こされても条件が成り立っているとは限らないため、呼び出し元はループで条件を確認し直す)
+ */
+struct condvar
+{
+    struct wait_queue wq; // 条件を待つスレッドの待ち行列
+};
+/**
+ * @brief 条件変数の初期化
+ * @param cond : 条件変数
+ */
+void init_condvar(struct condvar *cond)
+{
+    init_wait_queue(&cond->wq);
+}
+/**
+ * @brief 条件変数で待つ
+ * @param cond  : 条件変数
+ * @param mutex : 取得済みのミューテックス (待つ間は解放し、戻る前に取得し直す)
+ * @details 条件変数のロックを取ってからミューテックスを解放するため、その間に送られたシグナルを見落とさない
+ */
+void cond_wait(struct condvar *cond, struct mutex *mutex)
+{
+    unsigned int sie = spin_lock_irqsave(&cond->wq.lock);
+    mutex_unlock(mutex);
+    wait_queue_sleep(&cond->wq, sie);
+    mutex_lock(mutex);
+}
+/**
+ * @brief 条件変数で待つスレッドを1つ起こす
+ * @param cond : 条件変数
+ */
+void cond_signal(struct condvar *cond)
+{
+    unsigned int sie = spin_lock_irqsave(&cond->wq.lock);
+    wait_queue_wake_one(&cond->wq);
+    spin_unlock_irqrestore(&cond->wq.lock, sie);
+}
+/**
+ * @brief 条件変数で待つスレッドを全て起こす
+ * @param cond : 条件変数
+ */
+void cond_broadcast(struct condvar *cond)
+{
+    unsigned int sie = spin_lock_irqsave(&cond->wq.lock);
+    while (wait_queue_wake_one(&cond->wq) != NULL)
+        ;
+    spin_unlock_irqrestore(&cond->wq.lock, sie);
+}
+/**
+ * @brief スレッドとの合流
+ * @param thread : create_joinable_threadで作成したスレッド
+ * @details スレッドが終了するまで(スタックを解放するまで)WAITING状態で待ち、終了したスレッドを解放する
+ *          起こしたハートがロックを解放し終えるまで待ってから解放する
+ *          (アイドルスレッドは実行可能なスレッドがないと待たずに戻るため、スレッドから呼び出すこと)
+ */
+void thread_join(struct thread *thread)
+{
+    unsigned int sie = spin_lock_irqsave(&thread->join_wq.lock);
+    if (!thread->exited)
+    {
+        wait_queue_sleep(&thread->join_wq, sie);
+        sie = spin_lock_irqsave(&thread->join_wq.lock);
+    }
+    spin_unlock_irqrestore(&thread->join_wq.lock, sie);
+    slab_free(&g_thread_cache, thread);
+}
+/**
+ * @brief プロセスのスレッドのエントリー関数処理
+ * @param arg : プロセス
+ * @details スケジューラがプロセスのページテーブルへ切り替えた後に実行され、カーネルスタックの末端を
+ *          ユーザーモードからのトラップ用に空けてユーザーモードへ移る (戻らない)
+ *          forkで作成したプロセスは、親のforkのシステムコールから戻る位置とレジスタで始める
+ */
+void entry_user_thread(void *arg)
+{
+    struct process *process = arg;
+    struct thread *thread = current_thread();
+    struct user_stack_top *top = (struct user_stack_top *)&thread->stack[thread->stack_size] - 1;
+
+    intr_disable();
+    process->execution.status = RUNNING;
+    if (process->forked)
+    {
+        user_enter_frame(&process->frame, top);
+    }
+    user_enter(process->entry, process->user_sp, top);
+}
+/**
+ * @brief プロセスの割り当て
+ * @param table1 : プロセスのページテーブル(1段目)
+ * @return プロセス (メモリが不足している場合はNULL、ページテーブルは解放する)
+ * @details プロセスIDを割り当て、プロセスを実行するスレッドを作成する (スレッドは開始しない)
+ */
+struct process *alloc_process(unsigned int *table1)
+{
+    struct process *process = slab_alloc(&g_process_cache);
+    struct thread *thread = (process != NULL) ? alloc_thread(entry_user_thread, process) : NULL;
+    if (thread == NULL)
+    {
+        if (process != NULL)
+        {
+            slab_free(&g_process_cache, process);
+        }
+        free_user_page_table(table1);
+        return NULL;
+    }
+    process->execution.id = __atomic_fetch_add(&g_next_pid, 1, __ATOMIC_RELAXED);
+    process->execution.status = READY;
+    process->page_table = table1;
+    process->thread = thread;
+    process->entry = 0;
+    process->user_sp = 0;
+    process->exit_code = 0;
+    process->parent = NULL;
+    process->children = 0;
+    init_wait_queue(&process->child_wq);
+    process->forked = 0;
+    process->heap_end = USER_HEAP_BASE;
+    process->mmap_next = USER_MMAP_BASE;
+    process->mmap_count = 0;
+    process->asid = 0;
+    process->asid_generation = 0;
+    process->asid_hart = NULL;
+    thread->process = process;
+    return process;
+}
+/**
+ * @brief プロセスの開始
+ * @param table1  : プログラムとスタックを対応付けたページテーブル(1段目)
+ * @param entry   : ユーザーモードで最初に実行するアドレス
+ * @param user_sp : ユーザーモードの最初のスタックポインタ
+ * @param hart    : プロセスを実行するハート
+ * @return 作成したプロセスのID (メモリが不足している場合は-1、ページテーブルは解放する)
+ * @details プロセスはスレッドの終了時に解放され、作成から戻る前に終了している場合もあるため、IDを返す
+ */
+int start_process(unsigned int *table1, unsigned int entry, unsigned int user_sp, struct hart *hart)
+{
+    struct process *process = alloc_process(table1);
+    if (process == NULL)
+    {
+        return -1;
+    }
+    int pid = process->execution.id;
+    process->entry = entry;
+    process->user_sp = user_sp;
+    start_thread_on(process->thread, hart);
+    return pid;
+}
+/**
+ * @brief プロセスの作成 (カーネルに組み込んだプログラム、ハート指定)
+ * @param entry : ユーザーモードで最初に実行する関数 (USER_TEXTの関数)
+ * @param hart  : プロセスを実行するハート
+ * @return 作成したプロセスのID (メモリが不足している場合は-1)
+ */
+int create_process_on(void (*entry)(void), struct hart *hart)
+{
+    unsigned int *table1 = create_user_page_table();
+    if (table1 == NULL)
+    {
+        return -1;
+    }
+    if (map_builtin_programs(table1) < 0)
+    {
+        free_user_page_table(table1);
+        return -1;
+    }
+    return start_process(table1, (unsigned int)entry, USER_END, hart);
+}
+/**
+ * @brief プロセスの作成 (カーネルに組み込んだプログラム)
+ * @param entry : ユーザーモードで最初に実行する関数 (USER_TEXTの関数)
+ * @return 作成したプロセスのID (メモリが不足している場合は-1)
+ * @details プロセスを起動済みのハートへラウンドロビンで割り当てる
+ */
+int create_process(void (*entry)(void))
+{
+    return create_process_on(entry, next_thread_hart());
+}
+/**
+ * @brief 初期RAMディスク
+ * @note run.shでビルドしたユーザープログラム(user.elf)を.initrdセクションへそのまま取り込む
+ *       PT_LOADのセグメントをページ単位で直接対応付けられるように、ELFイメージの先頭をページ境界に揃える
+ */
+__asm__(
+    ".section .initrd, \"a\"\n"
+    ".balign 4096\n"
+    ".globl g_initrd_user_elf\n"
+    "g_initrd_user_elf:\n"
+    ".incbin \"user.elf\"\n"
+    ".globl g_initrd_user_elf_end\n"
+    "g_initrd_user_elf_end:\n"
+    ".previous\n");
+extern const char g_initrd_user_elf[];     // user.elfの先頭
+extern const char g_initrd_user_elf_end[]; // user.elfの末尾
+extern char __initrd[];                    // 初期RAMディスクの先頭 (リンカスクリプトで定義)
+extern char __initrd_end[];                // 初期RAMディスクの末尾 (リンカスクリプトで定義)
+/**
+ * @brief 初期RAMディスクのファイル
+ */
+struct initrd_file
+{
+    const char *name;  // ファイル名
+    const char *start; // 先頭 (ページ境界)
+    const char *end;   // 末尾
+};
+struct initrd_file g_initrd_files[] = {
+    {"user.elf", g_initrd_user_elf, g_initrd_user_elf_end},
+};
+/**
+ * @brief 初期RAMディスクのファイルの検索
+ * @param name : ファイル名
+ * @return ファイル (見つからない場合はNULL)
+ */
+struct initrd_file *find_initrd_file(const char *name)
+{
+    for (unsigned int i = 0; i < sizeof(g_initrd_files) / sizeof(g_initrd_files[0]); i++)
+    {
+        if (strcmp(g_initrd_files[i].name, name) == 0)
+        {
+            return &g_initrd_files[i];
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief ELFヘッダ (32ビット)
+ */
+struct elf_header
+{
+    unsigned char e_ident[16];  // 識別情報 (マジックナンバー・クラス・エンディアンなど)
+    unsigned short e_type;      // ファイルの種類
+    unsigned short e_machine;   // アーキテクチャ
+    unsigned int e_version;     // バージョン
+    unsigned int e_entry;       // エントリーポイントの仮想アドレス
+    unsigned int e_phoff;       // プログラムヘッダの先頭のファイル上のオフセット
+    unsigned int e_shoff;       // セクションヘッダの先頭のファイル上のオフセット
+    unsigned int e_flags;       // アーキテクチャ固有のフラグ
+    unsigned short e_ehsize;    // ELFヘッダのサイズ
+    unsigned short e_phentsize; // プログラムヘッダ1つのサイズ
+    unsigned short e_phnum;     // プログラムヘッダの数
+    unsigned short e_shentsize; // セクションヘッダ1つのサイズ
+    unsigned short e_shnum;     // セクションヘッダの数
+    unsigned short e_shstrndx;  // セクション名の文字列テーブルのセクション番号
+};
+/**
+ * @brief プログラムヘッダ (32ビット)
+ */
+struct elf_program_header
+{
+    unsigned int p_type;   // セグメントの種類
+    unsigned int p_offset; // ファイル上のオフセット
+    unsigned int p_vaddr;  // 仮想アドレス
+    unsigned int p_paddr;  // 物理アドレス (使用しない)
+    unsigned int p_filesz; // ファイル上のサイズ
+    unsigned int p_memsz;  // メモリ上のサイズ (ファイル上のサイズを超える部分は0で埋める)
+    unsigned int p_flags;  // アクセス権 (ELF_PF_R/W/X)
+    unsigned int p_align;  // アライメント
+};
+/**
+ * @brief ELFの読み込みの統計情報(グローバル変数)
+ */
+unsigned int g_elf_shared_pages; // イメージのページを直接対応付けた数
+unsigned int g_elf_copied_pages; // ページを割り当てて複写(または0で埋めた)数
+/**
+ * @brief セグメントの読み込み
+ * @param table1 : プロセスのページテーブル(1段目)
+ * @param image  : ELFイメージの先頭 (ページ境界)
+ * @param ph     : PT_LOADのプログラムヘッダ (範囲は確認済みであること)
+ * @param share  : 1なら、書き込み不可で全体がファイルの内容のページはイメージのページを直接対応付ける
+ * @retval 0     : 成功
+ * @retval -1    : メモリが不足しているか、他のセグメントとページが重なる
+ * @details ファイル上のオフセットと仮想アドレスのページ内の位置が同じ場合だけ、イメージのページを対応付けられる
+ *          書き込み可のページ、ファイルの末尾を含むページ、0で埋める部分(.bss)のページは割り当てて複写する
+ */
+int load_elf_segment(unsigned int *table1, const char *image, const struct elf_program_header *ph, int share)
+{
+    unsigned int flags = PAGE_U;
+    flags |= (ph->p_flags & ELF_PF_R) ? PAGE_R : 0;
+    flags |= (ph->p_flags & ELF_PF_W) ? PAGE_W : 0;
+    flags |= (ph->p_flags & ELF_PF_X) ? PAGE_X : 0;
+    int mappable = share && !(ph->p_flags & ELF_PF_W) && ((ph->p_offset % PAGE_SIZE) == (ph->p_vaddr % PAGE_SIZE));
+    unsigned int file_end = ph->p_vaddr + ph->p_filesz; // ファイルの内容がある範囲の末尾(仮想アドレス)
+
+    for (unsigned int va = ph->p_vaddr & ~(PAGE_SIZE - 1); va < ph->p_vaddr + ph->p_memsz; va += PAGE_SIZE)
+    {
+        unsigned int *pte = walk_page(table1, va);
+        if ((pte != NULL) && (*pte & PAGE_V))
+        {
+            return -1;
+        }
+        if (mappable && (va + PAGE_SIZE <= file_end))
+        {
+            unsigned int paddr = (unsigned int)image + ph->p_offset - (ph->p_vaddr - va);
+            if (map_page(table1, va, paddr, flags) < 0)
+            {
+                return -1;
+            }
+            g_elf_shared_pages++;
+            continue;
+        }
+        char *page = (char *)alloc_page_table(); // 0クリアしたページ
+        if (page == NULL)
+        {
+            return -1;
+        }
+        unsigned int start = (va > ph->p_vaddr) ? va : ph->p_vaddr;
+        unsigned int end = (va + PAGE_SIZE < file_end) ? va + PAGE_SIZE : file_end;
+        for (unsigned int addr = start; addr < end; addr++)
+        {
+            page[addr - va] = image[ph->p_offset + (addr - ph->p_vaddr)];
+        }
+        if (map_page(table1, va, (unsigned int)page, flags) < 0)
+        {
+            free_pages(page, 1);
+            return -1;
+        }
+        g_elf_copied_pages++;
+    }
+    return 0;
+}
+/**
+ * @brief ELFイメージの読み込み
+ * @param table1 : プロセスのページテーブル(1段目)
+ * @param image  : ELFイメージの先頭 (ページ境界)
+ * @param size   : ELFイメージのサイズ
+ * @param share  : 1なら、書き込み不可のページはイメージのページを直接対応付ける (0なら全て複写する)
+ * @param entry  : エントリーポイントの仮想アドレスを返す
+ * @retval 0     : 成功
+ * @retval -1    : 不正なELFイメージか、メモリが不足している (対応付けたページはページテーブルと共に解放する)
+ * @details RISC-Vの32ビットの実行ファイルかを確認し、PT_LOADのセグメントをユーザー領域(ヒープより下)へ読み込む
+ */
+int load_elf(unsigned int *table1, const char *image, unsigned int size, int share, unsigned int *entry)
+{
+    const struct elf_header *eh = (const struct elf_header *)image;
+    if ((size < sizeof(*eh)) || (*(const unsigned int *)eh->e_ident != ELF_MAGIC) ||
+        (eh->e_ident[4] != ELF_CLASS32) || (eh->e_ident[5] != ELF_DATA2LSB) ||
+        (eh->e_type != ELF_ET_EXEC) || (eh->e_machine != ELF_EM_RISCV) ||
+        (eh->e_phentsize != sizeof(struct elf_program_header)) || ((eh->e_phoff % 4) != 0) ||
+        (eh->e_phoff > size) || (eh->e_phnum * sizeof(struct elf_program_header) > size - eh->e_phoff))
+    {
+        return -1;
+    }
+    const struct elf_program_header *ph = (const struct elf_program_header *)(image + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++, ph++)
+    {
+        if ((ph->p_type != ELF_PT_LOAD) || (ph->p_memsz == 0))
+        {
+            continue;
+        }
+        if ((ph->p_filesz > ph->p_memsz) || (ph->p_offset > size) || (ph->p_filesz > size - ph->p_offset) ||
+            (ph->p_vaddr < (unsigned int)__user_base) || (ph->p_vaddr > USER_HEAP_BASE) ||
+            (ph->p_memsz > USER_HEAP_BASE - ph->p_vaddr))
+        {
+            return -1;
+        }
+        if (load_elf_segment(table1, image, ph, share) < 0)
+        {
+            return -1;
+        }
+    }
+    *entry = eh->e_entry;
+    return 0;
+}
+/**
+ * @brief ユーザーのスタックの初期設定
+ * @param table1 : プロセスのページテーブル(1段目)
+ * @param name   : プログラム名 (argv[0])
+ * @return ユーザーモードの最初のスタックポインタ (16バイト境界)
+ * @details スタックの末尾にプログラム名を、その下にargc・argv[0]・argv[1](NULL)を置く
+ *          (プログラムの_startはspからargcとargvを読む)
+ *          カーネルはRAMを仮想アドレス=物理アドレスで対応付けているため、スタックのページへ直接書き込む
+ */
+unsigned int setup_user_stack(unsigned int *table1, const char *name)
+{
+    char *page = (char *)((*walk_page(table1, USER_END - PAGE_SIZE) >> 10) * PAGE_SIZE);
+    unsigned int len = strlen(name);
+    if (len >= ELF_ARG_MAX)
+    {
+        len = ELF_ARG_MAX - 1;
+    }
+    unsigned int sp = USER_END - ((len + 1 + 15) & ~15);
+    unsigned int arg = sp;
+    for (unsigned int i = 0; i < len; i++)
+    {
+        page[arg - (USER_END - PAGE_SIZE) + i] = name[i];
+    }
+    page[arg - (USER_END - PAGE_SIZE) + len] = '\0';
+    sp -= 16;
+    unsigned int *words = (unsigned int *)&page[sp - (USER_END - PAGE_SIZE)];
+    words[0] = 1;   // argc
+    words[1] = arg; // argv[0]
+    words[2] = 0;   // argv[1]
+    words[3] = 0;
+    return sp;
+}
+/**
+ * @brief プロセスの作成 (初期RAMディスクのELF)
+ * @param name  : 初期RAMディスクのファイル名
+ * @param share : 1なら書き込み不可のページをイメージから直接対応付け、0なら全て複写する
+ * @return 作成したプロセスのID (ファイルがない、不正なELF、メモリが不足している場合は-1)
+ */
+int create_process_elf(const char *name, int share)
+{
+    struct initrd_file *file = find_initrd_file(name);
+    unsigned int entry = 0;
+    if (file == NULL)
+    {
+        return -1;
+    }
+    unsigned int *table1 = create_user_page_table();
+    if (table1 == NULL)
+    {
+        return -1;
+    }
+    if (load_elf(table1, file->start, (unsigned int)(file->end - file->start), share, &entry) < 0)
+    {
+        free_user_page_table(table1);
+        return -1;
+    }
+    return start_process(table1, entry, setup_user_stack(table1, name), next_thread_hart());
+}
+/**
+ * @brief 実行中のアドレス空間のASID
+ * @return satpのASID (ASIDを使わない場合は0)
+ */
+unsigned int current_asid(void)
+{
+    unsigned int satp = 0;
+    __asm__ __volatile__("csrr %0, satp\n" : "=r"(satp));
+    return (satp >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+}
+/**
+ * @brief 自ハートのTLBの無効化 (実行中のアドレス空間)
+ * @details 実行中のプロセスのページテーブルのエントリを書き換えた後に呼び出す
+ *          実行中のASIDのエントリだけを無効化し、他のプロセスのエントリは残す
+ *          (他のハートに残っている古いエントリは、プロセスがそのハートへ移る時に無効化する)
+ */
+void flush_tlb(void)
+{
+    __asm__ __volatile__("sfence.vma zero, %0\n" ::"r"(current_asid()) : "memory");
+}
+/**
+ * @brief 自ハートのTLBの無効化 (実行中のアドレス空間の1ページ)
+ * @param vaddr : 仮想アドレス
+ */
+void flush_tlb_page(unsigned int vaddr)
+{
+    __asm__ __volatile__("sfence.vma %0, %1\n" ::"r"(vaddr), "r"(current_asid()) : "memory");
+}
+/**
+ * @brief プロセスの複製 (fork)
+ * @param parent : 親プロセス (実行中のプロセス)
+ * @param tf     : 親のシステムコールのトラップフレーム (sepcはecallの次の命令)
+ * @return 子プロセスのID (メモリが不足している場合は-1)
+ * @details ユーザー領域をcopy_user_pagesで複製し、子プロセスは親と同じレジスタでforkから0を返して始める
+ *          g_fork_cowが1ならページを共有するため、ページテーブルの分しか割り当てない
+ */
+int fork_process(struct process *parent, struct trap_frame *tf)
+{
+    unsigned int free_before = g_free_page_count;
+    unsigned int *table1 = alloc_user_page_table();
+    if (table1 == NULL)
+    {
+        return -1;
+    }
+    int result = copy_user_pages(table1, parent->page_table, g_fork_cow);
+    // 親のページを書き込み不可にしたため、古い変換結果を無効化する (プロセスは1つのスレッドのため自ハートだけでよい)
+    flush_tlb();
+    if (result < 0)
+    {
+        free_user_page_table(table1);
+        return -1;
+    }
+    struct process *process = alloc_process(table1);
+    if (process == NULL)
+    {
+        return -1;
+    }
+    int pid = process->execution.id;
+    process->parent = parent;
+    process->forked = 1;
+    process->frame = *tf;
+    process->frame.a0 = 0;
+    process->heap_end = parent->heap_end;
+    process->mmap_next = parent->mmap_next;
+    process->mmap_count = parent->mmap_count;
+    for (int i = 0; i < parent->mmap_count; i++)
+    {
+        process->mmaps[i] = parent->mmaps[i];
+    }
+    unsigned int sie = spin_lock_irqsave(&parent->child_wq.lock);
+    parent->children++;
+    spin_unlock_irqrestore(&parent->child_wq.lock, sie);
+    g_fork_page_count += free_before - g_free_page_count;
+    start_thread_on(process->thread, next_thread_hart());
+    return pid;
+}
+/**
+ * @brief コピーオンライトのページの複写
+ * @param pte : PAGE_COWのページテーブルエントリ
+ * @retval 0  : 成功 (書き込み可にした)
+ * @retval -1 : メモリが不足している
+ * @details 他のプロセスと共有していれば複写して自プロセスの対応付けを新しいページへ移し、
+ *          共有が終わっていれば(他のプロセスが複写済み・終了済み)複写せずに書き込み可に戻す
+ *          複写を終えてから共有数を減らすため、複写中に他のプロセスがページを書き換えたり解放したりしない
+ */
+int break_cow(unsigned int *pte)
+{
+    unsigned int paddr = (*pte >> 10) * PAGE_SIZE;
+    unsigned int flags = (*pte & 0x3ff & ~PAGE_COW) | PAGE_W;
+    if (__atomic_load_n(&g_page_share[paddr / PAGE_SIZE - g_first_pfn], __ATOMIC_ACQUIRE) == 0)
+    {
+        *pte = (*pte & ~0x3ff) | flags;
+        __atomic_fetch_add(&g_cow_reuse_count, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    void *page = alloc_pages(1);
+    if (page == NULL)
+    {
+        return -1;
+    }
+    memcpy(page, (void *)paddr, PAGE_SIZE);
+    *pte = (((unsigned int)page / PAGE_SIZE) << 10) | flags;
+    put_user_page(paddr);
+    __atomic_fetch_add(&g_cow_copy_count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+/**
+ * @brief 要求時のページ割り当ての統計情報(グローバル変数)
+ */
+unsigned int g_demand_fault_count; // ページフォルトで割り当てたページ数
+/**
+ * @brief 予約した領域の検索
+ * @param process : プロセス
+ * @param vaddr   : 仮想アドレス
+ * @return 仮想アドレスを含む領域のページテーブルエントリのフラグ (予約した領域の外なら0)
+ * @details ヒープ・無名の対応付け・スタック(最大まで)のいずれかに含まれるかを調べる
+ */
+unsigned int find_user_region(struct process *process, unsigned int vaddr)
+{
+    if ((vaddr >= USER_HEAP_BASE) && (vaddr < process->heap_end))
+    {
+        return PAGE_R | PAGE_W | PAGE_U;
+    }
+    if ((vaddr >= USER_END - USER_STACK_MAX_PAGES * PAGE_SIZE) && (vaddr < USER_END))
+    {
+        return PAGE_R | PAGE_W | PAGE_U;
+    }
+    for (int i = 0; i < process->mmap_count; i++)
+    {
+        if ((vaddr >= process->mmaps[i].start) && (vaddr < process->mmaps[i].end))
+        {
+            return process->mmaps[i].flags;
+        }
+    }
+    return 0;
+}
+/**
+ * @brief 要求時のページ割り当て
+ * @param process : プロセス (実行中のプロセス)
+ * @param vaddr   : 対応付けていない仮想アドレス
+ * @retval 0      : 成功 (0クリアしたページを対応付けた)
+ * @retval -1     : 予約した領域の外か、メモリが不足している
+ */
+int demand_map_page(struct process *process, unsigned int vaddr)
+{
+    unsigned int flags = find_user_region(process, vaddr);
+    if (flags == 0)
+    {
+        return -1;
+    }
+    void *page = alloc_page_table(); // 0クリアしたページ
+    if (page == NULL)
+    {
+        return -1;
+    }
+    if (map_page(process->page_table, vaddr & ~(PAGE_SIZE - 1), (unsigned int)page, flags) < 0)
+    {
+        free_pages(page, 1);
+        return -1;
+    }
+    __atomic_fetch_add(&g_demand_fault_count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+/**
+ * @brief ユーザー領域の対応付けの解除
+ * @param process : プロセス (実行中のプロセス)
+ * @param start   : 先頭の仮想アドレス (ページ境界)
+ * @param end     : 末尾の仮想アドレス (ページ境界)
+ * @details 対応付けているページを解放(共有している場合は共有数を減らす)し、自ハートのTLBを無効化する
+ */
+void unmap_user_range(struct process *process, unsigned int start, unsigned int end)
+{
+    for (unsigned int vaddr = start; vaddr < end; vaddr += PAGE_SIZE)
+    {
+        unsigned int *pte = walk_page(process->page_table, vaddr);
+        if ((pte == NULL) || ((*pte & PAGE_V) == 0))
+        {
+            continue;
+        }
+        put_user_page((*pte >> 10) * PAGE_SIZE);
+        *pte = 0;
+    }
+    flush_tlb();
+}
+/**
+ * @brief プロセスのメモリ使用量
+ * @param process  : プロセス
+ * @param resident : 1なら実メモリ(対応付けているページ)、0なら仮想メモリ(プログラムと予約した領域)
+ * @return ページ数
+ * @details 実メモリはページテーブルの有効なエントリを数える (共有しているページも含む)
+ *          仮想メモリは、プログラムの対応付けているページ・ヒープ・無名の対応付け・スタックの最大を合計する
+ */
+unsigned int process_memory_pages(struct process *process, int resident)
+{
+    unsigned int pages = 0;
+    for (unsigned int vpn1 = (unsigned int)__user_base >> 22; vpn1 < (USER_END >> 22); vpn1++)
+    {
+        if ((process->page_table[vpn1] & PAGE_V) == 0)
+        {
+            continue;
+        }
+        unsigned int *table0 = (unsigned int *)((process->page_table[vpn1] >> 10) * PAGE_SIZE);
+        for (unsigned int vpn0 = 0; vpn0 < 1024; vpn0++)
+        {
+            unsigned int vaddr = (vpn1 << 22) | (vpn0 << 12);
+            if ((table0[vpn0] & PAGE_V) && (resident || (vaddr < USER_HEAP_BASE)))
+            {
+                pages++;
+            }
+        }
+    }
+    if (resident)
+    {
+        return pages;
+    }
+    pages += (process->heap_end - USER_HEAP_BASE + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (int i = 0; i < process->mmap_count; i++)
+    {
+        pages += (process->mmaps[i].end - process->mmaps[i].start) / PAGE_SIZE;
+    }
+    return pages + USER_STACK_MAX_PAGES;
+}
+/**
+ * @brief 子プロセスの終了待ち
+ * @param process : 実行中のプロセス
+ * @details forkで作成した子プロセスが全て終了(解放)するまで待つ
+ */
+void wait_children(struct process *process)
+{
+    unsigned int sie = spin_lock_irqsave(&process->child_wq.lock);
+    while (process->children > 0)
+    {
+        wait_queue_sleep(&process->child_wq, sie);
+        sie = spin_lock_irqsave(&process->child_wq.lock);
+    }
+    spin_unlock_irqrestore(&process->child_wq.lock, sie);
+}
+/**
+ * @brief プロセスの終了 (戻らない)
+ * @param code : 終了コード
+ * @details 子プロセスが全て終了するのを待ってから、プロセスを実行するスレッドを終了する
+ *          (アドレス空間はスレッドの解放と共に解放する)
+ */
+void exit_process(int code)
+{
+    struct process *process = current_thread()->process;
+    wait_children(process);
+    process->exit_code = code;
+    process->execution.status = TERMINATED;
+    thread_exit();
+}
+/**
+ * @brief ユーザー領域のアクセス可否の確認
+ * @param process : プロセス
+ * @param addr    : ユーザー領域の先頭アドレス
+ * @param len     : バイト数
+ * @param flags   : 必要なアクセス権 (PAGE_R/PAGE_W)
+ * @retval 1      : 全てのページがユーザーモードからアクセスできる
+ * @retval 0      : ユーザー領域の外か、予約していない領域を含む
+ * @details 予約した領域のまだ割り当てていないページは、カーネルからのアクセスでページフォルトにならないようにここで割り当てる
+ */
+int check_user_range(struct process *process, unsigned int addr, unsigned int len, unsigned int flags)
+{
+    if ((addr < (unsigned int)__user_base) || (addr > USER_END) || (len > USER_END - addr))
+    {
+        return 0;
+    }
+    for (unsigned int page = addr & ~(PAGE_SIZE - 1); page < addr + len; page += PAGE_SIZE)
+    {
+        unsigned int *pte = walk_page(process->page_table, page);
+        if (((pte == NULL) || ((*pte & PAGE_V) == 0)) && (demand_map_page(process, page) == 0))
+        {
+            pte = walk_page(process->page_table, page);
+        }
+        if ((pte == NULL) || ((*pte & (PAGE_V | PAGE_U | flags)) != (PAGE_V | PAGE_U | flags)))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+/**
+ * @brief ユーザー領域からの複写
+ * @param dst : 複写先 (カーネル)
+ * @param src : 複写元 (ユーザー領域、check_user_rangeで確認済みであること)
+ * @param n   : バイト数
+ * @details sstatus.SUMをセットしている間だけ、Sモードからユーザーモード用のページを読める
+ */
+void copy_from_user(void *dst, unsigned int src, unsigned int n)
+{
+    unsigned char *d = dst;
+    const unsigned char *s = (const unsigned char *)src;
+    __asm__ __volatile__("csrs sstatus, %0\n" ::"r"(SSTATUS_SUM) : "memory"); /* ユーザーモード用のページへのアクセスを許可 */
+    while (n--)
+    {
+        *d++ = *s++;
+    }
+    __asm__ __volatile__("csrc sstatus, %0\n" ::"r"(SSTATUS_SUM) : "memory"); /* ユーザーモード用のページへのアクセスを禁止 */
+}
+/**
+ * @brief システムコール : プロセスIDの取得
+ * @return プロセスID
+ */
+int sys_getpid(unsigned int arg0, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+    return current_thread()->process->execution.id;
+}
+/**
+ * @brief システムコール : CPUを譲る
+ * @return 0
+ */
+int sys_yield(unsigned int arg0, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+    schedule_threads();
+    return 0;
+}
+/**
+ * @brief システムコール : コンソールへの書き込み
+ * @param fd  : ファイル記述子 (1のみ)
+ * @param buf : 書き込む文字列 (ユーザー領域)
+ * @param len : バイト数
+ * @return 書き込んだバイト数 (エラーの場合は-1)
+ */
+int sys_write(unsigned int fd, unsigned int buf, unsigned int len)
+{
+    char chunk[SYSCALL_WRITE_CHUNK];
+    if ((fd != 1) || !check_user_range(current_thread()->process, buf, len, PAGE_R))
+    {
+        return -1;
+    }
+    for (unsigned int done = 0; done < len;)
+    {
+        unsigned int n = (len - done > SYSCALL_WRITE_CHUNK) ? SYSCALL_WRITE_CHUNK : len - done;
+        copy_from_user(chunk, buf + done, n);
+        console_puts(chunk, n);
+        done += n;
+    }
+    return (int)len;
+}
+/**
+ * @brief システムコール : プロセスの終了 (戻らない)
+ * @param code : 終了コード
+ */
+int sys_exit(unsigned int code, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg1;
+    (void)arg2;
+    exit_process((int)code);
+    return 0;
+}
+/**
+ * @brief システムコール : プロセスの複製
+ * @return 親には子プロセスのID、子には0 (メモリが不足している場合は-1)
+ */
+int sys_fork(unsigned int arg0, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+    struct thread *thread = current_thread();
+    return fork_process(thread->process, thread->trap_frame);
+}
+/**
+ * @brief システムコール : プログラムの実行
+ * @param name : 初期RAMディスクのファイル名 (ユーザー領域)
+ * @param len  : ファイル名のバイト数
+ * @return 新しいプログラムのargc (失敗した場合は-1を返し、元のプログラムを続ける)
+ * @details 初期RAMディスクのELFを新しいアドレス空間へ読み込み、アドレス空間を切り替えてから古いアドレス空間を解放する
+ *          トラップフレームのレジスタを0にし、sepcをエントリーポイント、spをスタック、a1をargvにしてsretで戻る
+ */
+int sys_exec(unsigned int name, unsigned int len, unsigned int arg2)
+{
+    (void)arg2;
+    struct thread *thread = current_thread();
+    struct process *process = thread->process;
+    struct trap_frame *tf = thread->trap_frame;
+    char path[ELF_ARG_MAX];
+    unsigned int entry = 0;
+
+    if ((len == 0) || (len >= ELF_ARG_MAX) || !check_user_range(process, name, len, PAGE_R))
+    {
+        return -1;
+    }
+    copy_from_user(path, name, len);
+    path[len] = '\0';
+    struct initrd_file *file = find_initrd_file(path);
+    unsigned int *table1 = (file != NULL) ? create_user_page_table() : NULL;
+    if (table1 == NULL)
+    {
+        return -1;
+    }
+    if (load_elf(table1, file->start, (unsigned int)(file->end - file->start), 1, &entry) < 0)
+    {
+        free_user_page_table(table1);
+        return -1;
+    }
+    unsigned int sp = setup_user_stack(table1, path);
+    // システムコールの処理中は割り込み禁止のため、切り替えの途中でスケジューラが古いページテーブルへ戻すことはない
+    // ASIDはそのまま使うため、古いアドレス空間の変換結果を無効化する (他のハートの分はプロセスが移る時に無効化される)
+    unsigned int *old = process->page_table;
+    unsigned int asid = current_asid();
+    process->page_table = table1;
+    __asm__ __volatile__(
+        "csrw satp, %0\n"
+        "sfence.vma zero, %1\n" /* 古いアドレス空間の変換結果を無効化 (新しいページテーブルへの書き込みも反映される) */
+        ::"r"(SATP_SV32 | (asid << SATP_ASID_SHIFT) | ((unsigned int)table1 / PAGE_SIZE)), "r"(asid)
+        : "memory");
+    this_hart()->page_table = table1;
+    free_user_page_table(old);
+    process->heap_end = USER_HEAP_BASE;
+    process->mmap_next = USER_MMAP_BASE;
+    process->mmap_count = 0;
+    for (unsigned int *reg = &tf->ra; reg <= &tf->t6; reg++)
+    {
+        *reg = 0;
+    }
+    tf->sp = sp;
+    tf->a1 = sp + 4;
+    tf->sepc = entry;
+    return 1;
+}
+/**
+ * @brief システムコール : 子プロセスの終了待ち
+ * @return 0
+ */
+int sys_wait(unsigned int arg0, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+    wait_children(current_thread()->process);
+    return 0;
+}
+/**
+ * @brief システムコール : ヒープの伸縮
+ * @param increment : 増減するバイト数 (負の値で縮める)
+ * @return 元のヒープの末尾 (範囲外の場合は-1)
+ * @details 伸ばす場合は領域を予約するだけで、ページは最初のアクセスで割り当てる
+ *          縮める場合は、外れたページの対応付けを解除する
+ */
+int sys_sbrk(unsigned int increment, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg1;
+    (void)arg2;
+    struct process *process = current_thread()->process;
+    unsigned int old_end = process->heap_end;
+    unsigned int new_end = old_end + increment; // 符号付きの増減も2の補数で加算できる
+    if (((int)increment >= 0) ? (new_end < old_end) || (new_end > USER_MMAP_BASE) : (new_end > old_end) || (new_end < USER_HEAP_BASE))
+    {
+        return -1;
+    }
+    process->heap_end = new_end;
+    if (new_end < old_end)
+    {
+        unmap_user_range(process, (new_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1), (old_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    }
+    return (int)old_end;
+}
+/**
+ * @brief システムコール : 無名の対応付け
+ * @param len  : バイト数
+ * @param prot : アクセス権 (MMAP_PROT_READ/MMAP_PROT_WRITE)
+ * @return 領域の先頭アドレス (領域が足りない場合は-1)
+ * @details 無名の対応付けの領域の末尾に予約し、ページは最初のアクセスで0クリアして割り当てる
+ */
+int sys_mmap(unsigned int len, unsigned int prot, unsigned int arg2)
+{
+    (void)arg2;
+    struct process *process = current_thread()->process;
+    unsigned int start = process->mmap_next;
+    unsigned int size = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    unsigned int limit = USER_END - USER_STACK_MAX_PAGES * PAGE_SIZE;
+    if ((len == 0) || (size > limit - start) || (process->mmap_count >= USER_MMAP_MAX))
+    {
+        return -1;
+    }
+    struct user_region *region = &process->mmaps[process->mmap_count++];
+    region->start = start;
+    region->end = start + size;
+    region->flags = PAGE_U | ((prot & MMAP_PROT_READ) ? PAGE_R : 0) | ((prot & MMAP_PROT_WRITE) ? PAGE_R | PAGE_W : 0);
+    process->mmap_next = region->end;
+    return (int)start;
+}
+/**
+ * @brief システムコール : 無名の対応付けの解除
+ * @param addr : mmapで返した先頭アドレス
+ * @param len  : mmapで指定したバイト数
+ * @return 0 (mmapした領域と一致しない場合は-1)
+ * @details 領域全体の対応付けを解除する (最後に対応付けた領域なら、その仮想アドレスを再び使う)
+ */
+int sys_munmap(unsigned int addr, unsigned int len, unsigned int arg2)
+{
+    (void)arg2;
+    struct process *process = current_thread()->process;
+    unsigned int size = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    for (int i = 0; i < process->mmap_count; i++)
+    {
+        struct user_region *region = &process->mmaps[i];
+        if ((region->start != addr) || (region->end - region->start != size))
+        {
+            continue;
+        }
+        unmap_user_range(process, region->start, region->end);
+        if (region->end == process->mmap_next)
+        {
+            process->mmap_next = region->start;
+        }
+        process->mmaps[i] = process->mmaps[--process->mmap_count];
+        return 0;
+    }
+    return -1;
+}
+/**
+ * @brief システムコール : プロセスのメモリ使用量
+ * @param resident : 1なら実メモリ、0なら仮想メモリ
+ * @return ページ数
+ */
+int sys_meminfo(unsigned int resident, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg1;
+    (void)arg2;
+    return (int)process_memory_pages(current_thread()->process, resident != 0);
+}
+/**
+ * @brief システムコール : 何もしない
+ * @return 0
+ * @details 通常のパス(全レジスタのトラップフレームとtrap_handlerの振り分け)の往復時間の計測に使う
+ */
+int sys_null(unsigned int arg0, unsigned int arg1, unsigned int arg2)
+{
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+    return 0;
+}
+/**
+ * @brief システムコールのテーブル
+ * @note システムコール番号をインデックスとする (高速パスではtrap_entryから直接引く)
+ */
+typedef int (*syscall_handler_t)(unsigned int arg0, unsigned int arg1, unsigned int arg2);
+syscall_handler_t g_syscall_table[SYS_NUM] = {
+    [SYS_GETPID] = sys_getpid,
+    [SYS_YIELD] = sys_yield,
+    [SYS_WRITE] = sys_write,
+    [SYS_EXIT] = sys_exit,
+    [SYS_NULL] = sys_null,
+    [SYS_FORK] = sys_fork,
+    [SYS_EXEC] = sys_exec,
+    [SYS_WAIT] = sys_wait,
+    [SYS_SBRK] = sys_sbrk,
+    [SYS_MMAP] = sys_mmap,
+    [SYS_MUNMAP] = sys_munmap,
+    [SYS_MEMINFO] = sys_meminfo,
+};
+/**
+ * @brief システムコールの処理 (通常のパス)
+ * @param tf : トラップフレーム
+ * @details 高速パス以外のシステムコールを、トラップフレームのa7の番号でテーブルから振り分ける
+ *          ecallの次の命令へ戻り、戻り値をa0に設定する
+ */
+void handle_syscall(struct trap_frame *tf)
+{
+    tf->sepc += 4;
+    if (tf->a7 >= SYS_NUM)
+    {
+        tf->a0 = -1;
+        return;
+    }
+    tf->a0 = g_syscall_table[tf->a7](tf->a0, tf->a1, tf->a2);
+}
+/**
+ * @brief ユーザーモードの例外の処理
+ * @param tf : トラップフレーム
+ * @details 不正なアクセスなどで継続できないプロセスを終了する (カーネルは停止しない)
+ */
+void handle_user_fault(struct trap_frame *tf)
+{
+    struct process *process = current_thread()->process;
+    printf("process %d: scause = 0x%08x, sepc = 0x%08x, stval = 0x%08x, killed\n",
+           process->execution.id, tf->scause, tf->sepc, tf->stval);
+    exit_process(-1);
+}
+/**
+ * @brief ロード・ストアのページフォルトの処理
+ * @param tf : トラップフレーム
+ * @details ユーザーモードから、予約した領域(ヒープ・無名の対応付け・スタック)のまだ割り当てていないページへのアクセスなら、
+ *          0クリアしたページを割り当て、コピーオンライトのページへの書き込みならページを複写して、アクセスをやり直す
+ *          それ以外はユーザーモードならプロセスを終了し、Sモードなら未対応のトラップとして扱う
+ */
+void handle_page_fault(struct trap_frame *tf)
+{
+    struct process *process = current_thread()->process;
+    if ((tf->sstatus & SSTATUS_SPP) || (process == NULL))
+    {
+        handle_unknown_trap(tf);
+        return;
+    }
+    unsigned int vaddr = tf->stval & ~(PAGE_SIZE - 1);
+    unsigned int *pte = ((vaddr >= (unsigned int)__user_base) && (vaddr < USER_END)) ? walk_page(process->page_table, vaddr) : NULL;
+    int result = -1;
+    if ((pte == NULL) || ((*pte & PAGE_V) == 0))
+    {
+        result = demand_map_page(process, vaddr);
+    }
+    else if ((tf->scause == SCAUSE_STORE_PAGE_FAULT) && ((*pte & (PAGE_U | PAGE_COW)) == (PAGE_U | PAGE_COW)))
+    {
+        result = break_cow(pte);
+    }
+    if (result < 0)
+    {
+        handle_user_fault(tf);
+        return;
+    }
+    flush_tlb_page(vaddr);
+}
+/**
+ * @brief プロセス管理の初期設定
+ * @details プロセスのスラブキャッシュを初期化し、ユーザーモードからのecallと
+ *          ロード・ストアのページフォルト(要求時のページ割り当て・コピーオンライト)のハンドラを登録する
+ */
+void init_processes(void)
+{
+    init_slab_cache(&g_process_cache, "process", sizeof(struct process));
+    g_next_pid = 1;
+    register_trap_handler(SCAUSE_ECALL_U, handle_syscall);
+    register_trap_handler(SCAUSE_LOAD_PAGE_FAULT, handle_page_fault);
+    register_trap_handler(SCAUSE_STORE_PAGE_FAULT, handle_page_fault);
+}
+/**
+ * @brief タイマー割り込み処理
+ * @param tf : トラップフレーム
+ * @details 起きる時刻になったスレッドを実行可能キューへ戻し、次のスレッドへ切り替える
+ *          タイムスライスを使い切ったスレッドの場合は横取りとして数え、実際に動作した時間とクォンタムの差をジッタとして記録する
+ */
+void handle_timer_interrupt(struct trap_frame *tf)
+{
+    (void)tf;
+    struct hart *hart = this_hart();
+    struct thread *thread = hart->current_thread;
+    unsigned long long now = get_time();
+    unsigned int elapsed = (unsigned int)(now - thread->slice_start); // 実際に動作した時間(tick)
+
+    hart->timer_count++;
+    // 発生したタイマーは次回必ず設定し直す (SBIで設定し直すまで割り込みが保留されたままになる)
+    hart->timer_deadline = 0;
+    wake_sleeping_threads(hart, now);
+    // 統計情報の更新 (スリープ中のスレッドを起こすための割り込みは横取りに数えない)
+    if ((thread != hart->idle_thread) && (elapsed >= TIME_SLICE_TICKS))
+    {
+        unsigned int jitter = elapsed - TIME_SLICE_TICKS;
+        thread->stats.preempt_count++;
+        thread->stats.jitter_sum += jitter;
+        if (jitter > thread->stats.jitter_max)
+        {
+            thread->stats.jitter_max = jitter;
+        }
+    }
+    // 次のスレッドへ切り替える (次のタイマーもスケジューラで設定される)
+    schedule_threads();
+}
+/**
+ * @brief トラップハンドラ処理
+ * @param tf : トラップ発生時のスタック上に作成されたトラップフレーム
+ * @details CPUがエラーや特別な状況を検知したときに、それをOSに通知して適切に処理するための仕組み
+ *          scauseの要因コードでハンドラのテーブルを引き、登録されたハンドラへ処理を振り分ける
+ *          ハンドラから戻るとtrap_entryがトラップフレームを復元し、トラップ発生元へ戻る
+ */
+void trap_handler(struct trap_frame *tf)
+{
+    struct thread *thread = current_thread(); // トラップが発生したスレッド
+    struct trap_frame *prev_tf = NULL;        // トラップ処理中に発生したトラップの場合は、処理中のトラップフレーム
+    unsigned int code = tf->scause & ~SCAUSE_INTERRUPT;
+    trap_handler_t handler = NULL;
+
+    // スレッドのトラップフレームとして記録 (スレッドの初期化前はスレッドが存在しない)
+    if (thread != NULL)
+    {
+        prev_tf = thread->trap_frame;
+        thread->trap_frame = tf;
+    }
+    // 要因コードからハンドラを取得
+    if (code < TRAP_CAUSE_NUM)
+    {
+        handler = (tf->scause & SCAUSE_INTERRUPT) ? g_interrupt_handlers[code] : g_exception_handlers[code];
+    }
+    if (handler == NULL)
+    {
+        // ユーザーモードの未対応の例外はプロセスだけを終了する
+        handler = ((tf->sstatus & SSTATUS_SPP) == 0) ? handle_user_fault : handle_unknown_trap;
+    }
+#if PROFILE_ENABLE
+    // スレッドが切り替わった場合は他のスレッドの実行時間を含むため、計測結果を記録しない
+    unsigned int switch_count = (thread != NULL) ? thread->stats.switch_count : 0;
+    PROFILE_BEGIN(start);
+    handler(tf);
+    if (thread == NULL || thread->stats.switch_count == switch_count)
+    {
+        PROFILE_END(PROFILE_TRAP_HANDLER, start);
+    }
+#else
+    handler(tf);
+#endif
+    // トラップ処理の終了 (スレッドが切り替わっていても、このスレッドに戻ってきている)
+    if (thread != NULL)
+    {
+        thread->trap_frame = prev_tf;
+    }
+}
+/**
+ * @brief トラップの入口〜出口の性能計測
+ * @details ebreakでブレークポイント例外を発生させ、トラップフレームの保存・ハンドラの振り分け・
+ *          復元・sretまでの往復のサイクル数を計測し、TRAP_CYCLE_BUDGETと比較する
+ */
+void benchmark_trap(void)
+{
+    unsigned int sum = 0;
+    unsigned int min = 0xffffffff;
+    unsigned int max = 0;
+
+    for (int i = 0; i < TRAP_BENCH_COUNT; i++)
+    {
+        unsigned int start = get_cycle();
+        __asm__ __volatile__("ebreak\n" ::: "memory"); /* ブレークポイント例外を発生させる */
+        unsigned int cycles = get_cycle() - start;
+        sum += cycles;
+        min = (cycles < min) ? cycles : min;
+        max = (cycles > max) ? cycles : max;
+    }
+    printf("trap round trip: avg=%d min=%d max=%d cycles (budget %d): %s\n",
+           sum / TRAP_BENCH_COUNT, min, max, TRAP_CYCLE_BUDGET,
+           (sum / TRAP_BENCH_COUNT <= TRAP_CYCLE_BUDGET) ? "OK" : "OVER BUDGET");
+}
+/**
+ * @brief 自ハートのタイマー割り込みの開始
+ * @details タイマー割り込みを許可し、最初のタイムスライスを設定する (タイマーはハートごとに設定する)
+ */
+void start_hart_timer(void)
+{
+    start_time_slice(current_thread());
+    __asm__ __volatile__("csrs sie, %0\n" ::"r"(SIE_STIE)); /* sieのSTIEビットをセット (タイマー割り込み許可) */
+    intr_enable();
+}
+/**
+ * @brief タイマー割り込みの開始
+ * @details スケジューラの開始時刻を記録し、自ハートのタイマー割り込みを開始する
+ */
+void start_timer(void)
+{
+    g_sched_start_time = get_time();
+    start_hart_timer();
+}
+/**
+ * @brief タイマー割り込みの停止
+ * @details タイマー割り込みを禁止し、タイマーを最大値に設定して割り込みが発生しないようにする
+ */
+void stop_timer(void)
+{
+    __asm__ __volatile__("csrc sie, %0\n" ::"r"(SIE_STIE)); /* sieのSTIEビットをクリア (タイマー割り込み禁止) */
+    this_hart()->timer_deadline = TIMER_NEVER;
+    sbi_set_timer(TIMER_NEVER);
+}
+/**
+ * @brief スレッドのエントリー関数処理
+ * @details スレッドで実施する処理内容
+ */
+void entry_thread(void *arg)
+{
+    (void)arg;
+    struct thread *thread = current_thread();
+
+    for (int i = 0; i < 2; i++)
+    {
+        // スレッドの情報
+        printf("thread_start_%d(id:%d sp:0x%08x) \n", i, thread->execution.id, thread->sp);
+        schedule_threads();
+        // スタックの使用量を確認 (作成時に書き込んだ値が残っていない部分)
+        printf("(thread%d)sp=0x%08x stack 0x%08x-0x%08x used %d/%d bytes\n",
+               thread->execution.id,
+               thread->sp,
+               thread->stack,
+               &thread->stack[thread->stack_size],
+               thread_stack_usage(thread),
+               thread->stack_size);
+        printf("-----------------------------------------\n");
+    }
+}
+/**
+ * @brief CPUを譲らないスレッドのエントリー関数処理
+ * @details schedule_threadsを一度も呼ばずにBUSY_THREAD_MSの間CPUを使い続ける
+ *          プリエンプションがなければ、このスレッドが終わるまで他のスレッドは動作できない
+ */
+void entry_busy_thread(void *arg)
+{
+    (void)arg;
+    unsigned long long end = get_time() + BUSY_THREAD_MS * TICKS_PER_MS;
+    unsigned int loops = 0;
+    struct thread *thread = current_thread();
+
+    printf("busy_thread_start(id:%d)\n", thread->execution.id);
+    while (get_time() < end)
+    {
+        loops++;
+    }
+    printf("busy_thread_end(id:%d loops:%d)\n", thread->execution.id, loops);
+}
+/**
+ * @brief CPUを譲り続けるスレッドのエントリー関数処理
+ * @details コンテキストスイッチの性能計測用に、SWITCH_BENCH_YIELDS回schedule_threadsを呼び出す
+ */
+void entry_yield_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < SWITCH_BENCH_YIELDS; i++)
+    {
+        schedule_threads();
+    }
+}
+/**
+ * @brief yieldの性能計測で各スレッドがCPUを譲る回数(グローバル変数)
+ */
+int g_yield_bench_count;
+/**
+ * @brief 指定回数CPUを譲るスレッドのエントリー関数処理
+ * @details yieldの性能計測用に、g_yield_bench_count回schedule_threadsを呼び出す
+ */
+void entry_count_yield_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < g_yield_bench_count; i++)
+    {
+        schedule_threads();
+    }
+}
+/**
+ * @brief アイドルスレッドの作成
+ * @param hart : 自ハート
+ * @retval 0    : 成功
+ * @retval -1   : スレッドを確保できない
+ * @details 呼び出し元(ブート処理から続くコンテキスト)を、そのハートのアイドルスレッドとして扱う
+ *          ハートのスタック(boot_stack・起動時に確保したスタック)上で動くため、スタック枠は割り当てない
+ *          (stackはNULLでstack_sizeは0、spは最初に切り替えたときに保存される)
+ */
+int init_idle_thread(struct hart *hart)
+{
+    struct thread *idle = slab_alloc(&g_thread_cache);
+    if (idle == NULL)
+    {
+        return -1;
+    }
+    init_thread_struct(idle, NULL, NULL);
+    idle->stack = NULL;
+    idle->stack_size = 0;
+    idle->sp = 0;
+    idle->execution.id = 0;
+    idle->execution.status = RUNNING;
+    idle->hart = hart;
+    hart->idle_thread = idle;
+    hart->current_thread = idle;
+    return 0;
+}
+/**
+ * @brief 実行できるスレッドがない間の停止
+ * @param hart : 自ハート
+ * @details 実行できるスレッドがなければ、wfiで割り込みが来るまで停止する
+ *          停止する前にg_idle_hartsへ自ハートのビットを立ててから確認し直すことで、
+ *          確認とwfiの間に追加されたスレッドを見落とさない (追加した側がビットを見てIPIを送る)
+ *          wfiは割り込み禁止(sstatus.SIE=0)でも、sieで許可した割り込みが保留されれば戻る
+ *          戻った後に割り込みを許可し、保留中の割り込み(IPI・タイマー・UART)を処理する
+ */
+void idle_wait(struct hart *hart)
+{
+    unsigned int bit = 1u << hart->hartid;
+    intr_disable();
+    __atomic_fetch_or(&g_idle_harts, bit, __ATOMIC_SEQ_CST);
+    if (!has_ready_thread(hart) && (hart->current_thread == hart->idle_thread))
+    {
+        unsigned long long start = get_time();
+        __asm__ __volatile__("wfi\n"); /* 割り込みが保留されるまで停止 */
+        hart->idle_ticks += (unsigned int)(get_time() - start);
+        hart->wfi_count++;
+    }
+    __atomic_fetch_and(&g_idle_harts, ~bit, __ATOMIC_SEQ_CST);
+    intr_enable();
+}
+/**
+ * @brief アイドル処理
+ * @param hart : 自ハート
+ * @details 実行できるスレッドが来るまでidle_waitで停止し、スケジューラを呼び出す
+ */
+void idle_loop(struct hart *hart)
+{
+    for (;;)
+    {
+        idle_wait(hart);
+        schedule_threads();
+    }
+}
+/**
+ * @brief ブートしたハート以外のハートのメイン処理
+ * @param hartid : ハートID
+ * @details sbi_hart_startで起動したハートは、ページングが無効の状態でsecondary_bootから始まる
+ *          トラップの入口処理とカーネルのページテーブルを設定し、アイドルスレッドを作成してからスケジューラを動かす
+ *          初期化に失敗した場合は、失敗をブートしたハートへ通知してからsbi_hart_stopで停止する
+ *          (ブートしたハートは停止を確認してから、このハートのスタックを解放する)
+ */
+void secondary_main(unsigned int hartid)
+{
+    __asm__ __volatile__(
+        "csrw stvec, %0\n" /* stvecレジスタにトラップの入口処理のアドレスを設定 */
+        ::"r"(trap_entry)  /* 入力オペランド: トラップの入口処理のアドレス */
+    );
+    struct hart *hart = init_hart(hartid);
+    switch_page_table(g_kernel_page_table);
+    int ret = init_ready_queues(hart);
+    if ((ret == 0) && (init_idle_thread(hart) < 0))
+    {
+        free_ready_queues(hart);
+        ret = -1;
+    }
+    if (ret < 0)
+    {
+        __atomic_store_n(&hart->online, -1, __ATOMIC_RELEASE);
+        sbi_call(SBI_EXT_HSM, SBI_HSM_HART_STOP, 0, 0, 0, 0);
+        for (;;)
+            ;
+    }
+    // 起動完了をブートしたハートへ通知 (ここまでの書き込みを先に反映する)
+    __atomic_store_n(&hart->online, 1, __ATOMIC_RELEASE);
+    start_hart_timer();
+    idle_loop(hart);
+}
+/**
+ * @brief ブートしたハート以外のハートの入口処理
+ * @details sbi_hart_startの引数で、a0にハートID、a1にopaque(スタックの末端)が渡される
+ */
+__attribute__((naked))      /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
+__attribute__((aligned(4))) /* sbi_hart_startの開始アドレスは4バイト境界に配置 */
+void
+secondary_boot(void)
+{
+    __asm__ __volatile__(
+        "mv sp, a1\n"           /* opaqueで渡されたスタックの末端をスタックポインタへ設定 */
+        "call secondary_main\n" /* secondary_mainを呼び出す (a0はハートID) */
+    );
+}
+/**
+ * @brief ブートしたハート以外のハートの起動 (SBI HSM Extension)
+ * @details 停止中のハートごとにスタックを割り当ててsbi_hart_startで起動し、起動完了を待つ
+ *          起動したハートはg_online_hartsへ起動した順に追加する
+ */
+void start_harts(void)
+{
+    unsigned int boot_hartid = this_hart()->hartid;
+
+    for (unsigned int hartid = 0; hartid < HART_MAX; hartid++)
+    {
+        if (hartid == boot_hartid)
+        {
+            continue;
+        }
+        // 存在しないハート、停止中でないハートは対象外
+        struct sbiret ret = sbi_call(SBI_EXT_HSM, SBI_HSM_HART_GET_STATUS, hartid, 0, 0, 0);
+        if ((ret.error != 0) || (ret.value != SBI_HSM_STATE_STOPPED))
+        {
+            continue;
+        }
+        char *stack = alloc_pages(HART_STACK_PAGES);
+        if (stack == NULL)
+        {
+            break;
+        }
+        ret = sbi_call(SBI_EXT_HSM, SBI_HSM_HART_START, hartid,
+                       (long)secondary_boot, (long)&stack[HART_STACK_PAGES * PAGE_SIZE], 0);
+        if (ret.error != 0)
+        {
+            free_pages(stack, HART_STACK_PAGES);
+            continue;
+        }
+        int online = 0;
+        while ((online = __atomic_load_n(&g_harts[hartid].online, __ATOMIC_ACQUIRE)) == 0)
+            ;
+        if (online < 0)
+        {
+            // 初期化に失敗したハートは、停止してからスタックを解放する (停止するまではスタックを使っている)
+            // 停止できなかった場合(sbi_hart_stopの失敗)はスタックを解放しない
+            unsigned long long deadline = get_time() + HART_STOP_TIMEOUT_MS * TICKS_PER_MS;
+            do
+            {
+                ret = sbi_call(SBI_EXT_HSM, SBI_HSM_HART_GET_STATUS, hartid, 0, 0, 0);
+            } while ((ret.error == 0) && (ret.value != SBI_HSM_STATE_STOPPED) && (get_time() < deadline));
+            printf("smp: hart %d failed to initialize, skipped\n", hartid);
+            if ((ret.error == 0) && (ret.value == SBI_HSM_STATE_STOPPED))
+            {
+                free_pages(stack, HART_STACK_PAGES);
+            }
+            continue;
+        }
+        g_online_harts[g_hart_count++] = hartid;
+    }
+    printf("smp: %d harts online (boot hart %d)\n", g_hart_count, boot_hartid);
+}
+/**
+ * @brief コンテキストスイッチの性能計測
+ * @details 実行可能なスレッドの数を変えて、1回のスレッド切り替えにかかるサイクル数を計測する
+ *          次のスレッドの選択はスレッド数によらず一定時間のため、スレッド数を増やしても変わらないことを確認する
+ *          (スレッドは全て自ハートで実行する)
+ */
+void benchmark_switch_latency(void)
+{
+    static const int thread_nums[] = {2, 16, 128, 1024}; // 実行可能なスレッドの数
+
+    for (unsigned int i = 0; i < sizeof(thread_nums) / sizeof(thread_nums[0]); i++)
+    {
+        int num = 0;
+        while ((num < thread_nums[i]) && (create_thread_on(entry_yield_thread, NULL, this_hart()) != NULL))
+        {
+            num++;
+        }
+        // 全てのスレッドが終了するまでの切り替え回数とサイクル数
+        unsigned int start = get_cycle();
+        while (!are_all_threads_terminated())
+        {
+            schedule_threads();
+        }
+        unsigned int cycles = get_cycle() - start;
+        unsigned int switches = num * (SWITCH_BENCH_YIELDS + 1);
+        printf("switch latency (%d threads): %d cycles/switch, thread slab %d pages (%d objects)\n",
+               num, cycles / switches, g_thread_cache.page_count, g_thread_cache.object_count);
+    }
+}
+/**
+ * @brief yieldの性能計測
+ * @details 自ハートでCPUを譲り合うスレッドの数を1, 2, 8と変えて、1秒当たりのyield(schedule_threadsの呼び出し)回数を求める
+ *          1スレッドの場合は同じスレッドが選ばれ続けるため、コンテキストスイッチを省く経路の速さになる
+ *          (計測中に他のハートへ移らないように、ワークスティーリングを無効にする)
+ */
+void benchmark_yield(void)
+{
+    static const int thread_nums[] = {1, 2, 8}; // CPUを譲り合うスレッドの数
+
+    g_work_stealing = 0;
+    for (unsigned int i = 0; i < sizeof(thread_nums) / sizeof(thread_nums[0]); i++)
+    {
+        int num = thread_nums[i];
+        g_yield_bench_count = YIELD_BENCH_YIELDS / num;
+        for (int t = 0; t < num; t++)
+        {
+            create_thread_on(entry_count_yield_thread, NULL, this_hart());
+        }
+        unsigned long long start = get_time();
+        while (!are_all_threads_terminated())
+        {
+            schedule_threads();
+        }
+        unsigned int elapsed_us = (unsigned int)(get_time() - start) / TICKS_PER_US;
+        unsigned int yields = g_yield_bench_count * num;
+        if (elapsed_us == 0)
+        {
+            elapsed_us = 1;
+        }
+        unsigned long long rate = (unsigned long long)yields * 1000000;
+        div64_u32(&rate, elapsed_us);
+        printf("yield (%d threads): %d yields in %d us, %u yields/s\n", num, yields, elapsed_us, (unsigned int)rate);
+    }
+    g_work_stealing = 1;
+}
+/**
+ * @brief 計算だけを行うスレッドのエントリー関数処理
+ * @details マルチコアの性能計測用に、SMP_BENCH_WORK回の疑似乱数の計算を行う
+ *          (共有データに触れないため、ハートの数に比例して処理が進む)
+ */
+void entry_work_thread(void *arg)
+{
+    (void)arg;
+    unsigned int x = 2463534242u;
+    for (int i = 0; i < SMP_BENCH_WORK; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    __asm__ __volatile__("" ::"r"(x)); /* 計算結果を使い、ループが最適化で消えないようにする */
+}
+/**
+ * @brief マルチコアの性能計測
+ * @details 使用するハートの数を1, 2, 4, 8と変えて、SMP_BENCH_THREADS個の計算スレッドをハートへ均等に割り当て、
+ *          全て終了するまでの時間から1秒当たりに終了したスレッド数を求める (起動済みのハート数を超える場合は省略)
+ */
+void benchmark_smp_scaling(void)
+{
+    static const int hart_nums[] = {1, 2, 4, 8}; // 使用するハートの数
+
+    for (unsigned int i = 0; i < sizeof(hart_nums) / sizeof(hart_nums[0]); i++)
+    {
+        int num = hart_nums[i];
+        if (num > g_hart_count)
+        {
+            printf("smp scaling (%d harts): skipped, %d harts online\n", num, g_hart_count);
+            continue;
+        }
+        for (int h = 0; h < num; h++)
+        {
+            g_harts[g_online_harts[h]].completed_count = 0;
+        }
+        unsigned long long start = get_time();
+        for (int t = 0; t < SMP_BENCH_THREADS; t++)
+        {
+            create_thread_on(entry_work_thread, NULL, &g_harts[g_online_harts[t % num]]);
+        }
+        // 自ハートに割り当てたスレッドも実行しながら、全てのスレッドの終了を待つ
+        while (!are_all_threads_terminated())
+        {
+            schedule_threads();
+        }
+        unsigned int elapsed_ms = (unsigned int)(get_time() - start) / TICKS_PER_MS;
+        if (elapsed_ms == 0)
+        {
+            elapsed_ms = 1;
+        }
+        printf("smp scaling (%d harts): %d threads in %d ms (%d threads/s), per hart:",
+               num, SMP_BENCH_THREADS, elapsed_ms, SMP_BENCH_THREADS * 1000 / elapsed_ms);
+        for (int h = 0; h < num; h++)
+        {
+            printf(" %u", g_harts[g_online_harts[h]].completed_count);
+        }
+        printf("\n");
+    }
+}
+/**
+ * @brief ワークスティーリングの性能計測
+ * @details SMP_BENCH_THREADS個の計算スレッドを全て自ハートに割り当てた偏った負荷で、
+ *          ワークスティーリングの無効・有効を切り替えて、全て終了するまでの時間とハートごとの使用率を比べる
+ *          (無効の場合は自ハートだけが動作し、有効の場合は空いたハートが盗んで使用率が揃っていく)
+ */
+void benchmark_work_stealing(void)
+{
+    for (int stealing = 0; stealing <= 1; stealing++)
+    {
+        g_work_stealing = stealing;
+        for (int h = 0; h < g_hart_count; h++)
+        {
+            struct hart *hart = &g_harts[g_online_harts[h]];
+            hart->busy_ticks = 0;
+            hart->completed_count = 0;
+            hart->steal_count = 0;
+        }
+        unsigned long long start = get_time();
+        for (int t = 0; t < SMP_BENCH_THREADS; t++)
+        {
+            create_thread_on(entry_work_thread, NULL, this_hart());
+        }
+        while (!are_all_threads_terminated())
+        {
+            schedule_threads();
+        }
+        unsigned int elapsed = (unsigned int)(get_time() - start);
+        unsigned int elapsed_ms = elapsed / TICKS_PER_MS;
+        printf("work stealing %s: %d threads in %d ms, per hart (busy%%/completed/stolen):",
+               stealing ? "on " : "off", SMP_BENCH_THREADS, elapsed_ms);
+        for (int h = 0; h < g_hart_count; h++)
+        {
+            struct hart *hart = &g_harts[g_online_harts[h]];
+            unsigned int busy = (elapsed >= 100) ? hart->busy_ticks / (elapsed / 100) : 0;
+            printf(" %u%%/%u/%u", (busy > 100) ? 100 : busy, hart->completed_count, hart->steal_count);
+        }
+        printf("\n");
+    }
+    g_work_stealing = 1;
+}
+/**
+ * @brief ロックの性能計測(グローバル変数)
+ * @note 計測スレッドはハートごとに1つ作成し、それぞれ自分の結果の要素だけを書き込む
+ */
+enum LockBenchType
+{
+    LOCK_BENCH_TAS,    // test-and-setのスピンロック
+    LOCK_BENCH_TICKET, // チケットロック
+    LOCK_BENCH_MCS,    // MCSロック
+    LOCK_BENCH_TYPE_NUM
+};
+struct lock_bench_result
+{
+    unsigned int count;         // ロックを取得した回数
+    unsigned long long cycles;  // 取得にかかったサイクル数の合計
+    unsigned int max_cycles;    // 取得にかかったサイクル数の最大値
+};
+/**
+ * @brief ロックの性能計測で表示するロックの種類の名前
+ */
+const char *const g_lock_bench_names[LOCK_BENCH_TYPE_NUM] = {"tas", "ticket", "mcs"};
+struct lock_bench_result g_lock_bench_results[HART_MAX]; // 計測スレッドごとの結果
+int g_lock_bench_type;                                   // 計測するロックの種類
+int g_lock_bench_ready;                                  // 計測の開始を待っているスレッドの数
+int g_lock_bench_go;                                     // 1なら計測開始
+unsigned long long g_lock_bench_end;                     // 計測の終了時刻
+unsigned int g_lock_bench_counter;                       // ロックで保護する共有カウンタ
+struct spinlock g_bench_spinlock;                        // 計測用のスピンロック
+struct ticket_lock g_bench_ticket_lock;                  // 計測用のチケットロック
+struct mcs_lock g_bench_mcs_lock;                        // 計測用のMCSロック
+/**
+ * @brief ロックを取り続けるスレッドのエントリー関数処理
+ * @details 開始の合図を待ってから、終了時刻まで割り込み禁止でロックを取得して共有カウンタを加算し、
+ *          取得にかかったサイクル数を記録する (割り込み禁止で、ロックを持ったまま横取りされないようにする)
+ */
+void entry_lock_bench_thread(void *arg)
+{
+    (void)arg;
+    struct lock_bench_result result = {0, 0, 0};
+    int slot = __atomic_fetch_add(&g_lock_bench_ready, 1, __ATOMIC_ACQ_REL);
+
+    while (!__atomic_load_n(&g_lock_bench_go, __ATOMIC_ACQUIRE))
+        ;
+    while (get_time() < g_lock_bench_end)
+    {
+        struct mcs_node node;
+        unsigned int sie = 0;
+        unsigned int start = get_cycle();
+        switch (g_lock_bench_type)
+        {
+        case LOCK_BENCH_TAS:
+            sie = spin_lock_irqsave(&g_bench_spinlock);
+            break;
+        case LOCK_BENCH_TICKET:
+            sie = ticket_spin_lock_irqsave(&g_bench_ticket_lock);
+            break;
+        default:
+            sie = mcs_spin_lock_irqsave(&g_bench_mcs_lock, &node);
+            break;
+        }
+        unsigned int cycles = get_cycle() - start;
+        g_lock_bench_counter++;
+        switch (g_lock_bench_type)
+        {
+        case LOCK_BENCH_TAS:
+            spin_unlock_irqrestore(&g_bench_spinlock, sie);
+            break;
+        case LOCK_BENCH_TICKET:
+            ticket_spin_unlock_irqrestore(&g_bench_ticket_lock, sie);
+            break;
+        default:
+            mcs_spin_unlock_irqrestore(&g_bench_mcs_lock, &node, sie);
+            break;
+        }
+        result.count++;
+        result.cycles += cycles;
+        if (cycles > result.max_cycles)
+        {
+            result.max_cycles = cycles;
+        }
+    }
+    g_lock_bench_results[slot] = result;
+}
+/**
+ * @brief ロックの性能計測
+ * @details 起動済みの全てのハートで1つのロックを奪い合い、ロックの種類ごとに
+ *          取得にかかった平均・最大のサイクル数と、ハートごとの取得回数の偏り(最小/最大)を比べる
+ *          ハートごとの取得回数が揃っているほど公平で、共有カウンタの値が取得回数の合計と一致すれば排他できている
+ *          (計測スレッドが他のハートへ移らないように、計測中はワークスティーリングを無効にする)
+ */
+void benchmark_locks(void)
+{
+    g_work_stealing = 0;
+    for (int type = 0; type < LOCK_BENCH_TYPE_NUM; type++)
+    {
+        g_lock_bench_type = type;
+        g_lock_bench_ready = 0;
+        g_lock_bench_go = 0;
+        g_lock_bench_counter = 0;
+        // 他のハートの計測スレッドが開始を待つ状態になってから合図を出す
+        for (int h = 0; h < g_hart_count; h++)
+        {
+            if (g_online_harts[h] != this_hart()->hartid)
+            {
+                create_thread_on(entry_lock_bench_thread, NULL, &g_harts[g_online_harts[h]]);
+            }
+        }
+        while (__atomic_load_n(&g_lock_bench_ready, __ATOMIC_ACQUIRE) < g_hart_count - 1)
+            ;
+        g_lock_bench_end = get_time() + LOCK_BENCH_MS * TICKS_PER_MS;
+        __atomic_store_n(&g_lock_bench_go, 1, __ATOMIC_RELEASE);
+        // 自ハートの計測スレッドは合図の後に作成する (開始を待つ間に他のスレッドへ譲れないため)
+        create_thread_on(entry_lock_bench_thread, NULL, this_hart());
+        while (!are_all_threads_terminated())
+        {
+            schedule_threads();
+        }
+        // 結果の集計
+        unsigned int total = 0;
+        unsigned long long cycles = 0;
+        unsigned int max_cycles = 0;
+        unsigned int min_count = 0xffffffff;
+        unsigned int max_count = 0;
+        for (int i = 0; i < g_hart_count; i++)
+        {
+            struct lock_bench_result *result = &g_lock_bench_results[i];
+            total += result->count;
+            cycles += result->cycles;
+            max_cycles = (result->max_cycles > max_cycles) ? result->max_cycles : max_cycles;
+            min_count = (result->count < min_count) ? result->count : min_count;
+            max_count = (result->count > max_count) ? result->count : max_count;
+        }
+        unsigned long long fairness = (unsigned long long)min_count * 100;
+        if (total != 0)
+        {
+            div64_u32(&cycles, total); // 平均のサイクル数
+            div64_u32(&fairness, max_count);
+        }
+        printf("lock %-6s (%d harts): %u acquires, avg %u cycles, max %u cycles, fairness %u%% (min %u / max %u)%s\n",
+               g_lock_bench_names[type], g_hart_count, total, (unsigned int)cycles, max_cycles,
+               (unsigned int)fairness, min_count, max_count, (g_lock_bench_counter == total) ? "" : " COUNTER MISMATCH");
+    }
+    g_work_stealing = 1;
+}
+/**
+ * @brief 全てのスレッドの終了待ち (ブートしたハートのアイドルスレッドから呼び出す)
+ * @param hart : 自ハート
+ * @details 自ハートのスレッドを実行しながら、実行できるスレッドがない間はidle_waitで停止して待つ
+ *          (他のハートで最後のスレッドが終了すると、IPIで起こされる)
+ */
+void wait_for_threads(struct hart *hart)
+{
+    while (!are_all_threads_terminated())
+    {
+        idle_wait(hart);
+        schedule_threads();
+    }
+}
+/**
+ * @brief スリープの計測(グローバル変数)
+ */
+unsigned int g_sleep_late_sum; // 起きる時刻からの遅れの合計(tick)
+unsigned int g_sleep_late_max; // 起きる時刻からの遅れの最大値(tick)
+/**
+ * @brief スリープを繰り返すスレッドのエントリー関数処理
+ * @details SLEEP_BENCH_MSのスリープをSLEEP_BENCH_COUNT回繰り返し、起きる時刻から実際に動き出すまでの遅れを記録する
+ */
+void entry_sleep_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < SLEEP_BENCH_COUNT; i++)
+    {
+        unsigned long long deadline = get_time() + SLEEP_BENCH_MS * TICKS_PER_MS;
+        thread_sleep_until(deadline);
+        unsigned int late = (unsigned int)(get_time() - deadline);
+        __atomic_fetch_add(&g_sleep_late_sum, late, __ATOMIC_RELAXED);
+        unsigned int max = __atomic_load_n(&g_sleep_late_max, __ATOMIC_RELAXED);
+        while ((late > max) && !__atomic_compare_exchange_n(&g_sleep_late_max, &max, late, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+}
+/**
+ * @brief アイドル時の停止(wfi)とティックレスタイマーの計測
+ * @details スリープを繰り返すスレッドだけが動作するほぼアイドルの状態で、ハートごとに
+ *          wfiで停止していた時間の割合(アイドル率)とタイマー割り込みの回数を表示する
+ *          タイムスライスごとの周期的なタイマー(ティック)の場合の回数と比べることで、ティックレスの効果を確認する
+ *          ブートしたハートも終了を待つ間はidle_waitで停止する
+ */
+void benchmark_idle(void)
+{
+    struct hart *hart = this_hart();
+    g_sleep_late_sum = 0;
+    g_sleep_late_max = 0;
+    for (int h = 0; h < g_hart_count; h++)
+    {
+        struct hart *other = &g_harts[g_online_harts[h]];
+        other->idle_ticks = 0;
+        other->wfi_count = 0;
+        other->timer_count = 0;
+    }
+    unsigned long long start = get_time();
+    for (int t = 0; t < SLEEP_BENCH_THREADS; t++)
+    {
+        create_thread(entry_sleep_thread, NULL);
+    }
+    start_hart_timer();
+    wait_for_threads(hart);
+    stop_timer();
+    unsigned int elapsed = (unsigned int)(get_time() - start);
+    unsigned int wakeups = SLEEP_BENCH_THREADS * SLEEP_BENCH_COUNT;
+    printf("idle (%d threads x %d sleeps of %d ms): %d ms, wakeup late avg %d us max %d us, periodic tick would be %d/hart\n",
+           SLEEP_BENCH_THREADS, SLEEP_BENCH_COUNT, SLEEP_BENCH_MS, elapsed / TICKS_PER_MS,
+           g_sleep_late_sum / wakeups / TICKS_PER_US, g_sleep_late_max / TICKS_PER_US, elapsed / TIME_SLICE_TICKS);
+    printf("idle per hart (idle%%/wfi/timer irqs):");
+    for (int h = 0; h < g_hart_count; h++)
+    {
+        struct hart *other = &g_harts[g_online_harts[h]];
+        unsigned int idle = (elapsed >= 100) ? other->idle_ticks / (elapsed / 100) : 0;
+        printf(" %u%%/%u/%u", (idle > 100) ? 100 : idle, other->wfi_count, other->timer_count);
+    }
+    printf("\n");
+}
+/**
+ * @brief 生産者・消費者の計測(グローバル変数)
+ * @note 生産者は作成した時刻を、ミューテックスと条件変数で保護した有限のキューへ入れ、消費者が受け取った時刻との差を記録する
+ */
+struct mutex g_pc_mutex;                            // キューのミューテックス
+struct condvar g_pc_not_empty;                      // キューが空でなくなったことを知らせる条件変数
+struct condvar g_pc_not_full;                       // キューが一杯でなくなったことを知らせる条件変数
+unsigned long long g_pc_queue[PC_BENCH_QUEUE_SIZE]; // キュー (データを作成した時刻)
+unsigned int g_pc_head;                             // キューの先頭 (次に取り出す位置)
+unsigned int g_pc_tail;                             // キューの末尾 (次に追加する位置)
+unsigned int g_pc_latency_sum;                      // 受け渡しにかかった時間の合計(tick)
+unsigned int g_pc_latency_max;                      // 受け渡しにかかった時間の最大値(tick)
+struct semaphore g_ping_sem;                        // ピンポンの計測の送信側のセマフォ
+struct semaphore g_pong_sem;                        // ピンポンの計測の受信側のセマフォ
+/**
+ * @brief 生産者スレッドのエントリー関数処理
+ * @details キューが一杯の間は条件変数で待ち、作成した時刻をPC_BENCH_ITEMS個キューへ入れる
+ */
+void entry_producer_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < PC_BENCH_ITEMS; i++)
+    {
+        mutex_lock(&g_pc_mutex);
+        while (g_pc_tail - g_pc_head >= PC_BENCH_QUEUE_SIZE)
+        {
+            cond_wait(&g_pc_not_full, &g_pc_mutex);
+        }
+        g_pc_queue[g_pc_tail % PC_BENCH_QUEUE_SIZE] = get_time();
+        g_pc_tail++;
+        cond_signal(&g_pc_not_empty);
+        mutex_unlock(&g_pc_mutex);
+    }
+}
+/**
+ * @brief 消費者スレッドのエントリー関数処理
+ * @details キューが空の間は条件変数で待ち、受け取った時刻と作成した時刻の差(受け渡しの遅延)を記録する
+ */
+void entry_consumer_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < PC_BENCH_ITEMS; i++)
+    {
+        mutex_lock(&g_pc_mutex);
+        while (g_pc_tail == g_pc_head)
+        {
+            cond_wait(&g_pc_not_empty, &g_pc_mutex);
+        }
+        unsigned int latency = (unsigned int)(get_time() - g_pc_queue[g_pc_head % PC_BENCH_QUEUE_SIZE]);
+        g_pc_head++;
+        cond_signal(&g_pc_not_full);
+        mutex_unlock(&g_pc_mutex);
+        g_pc_latency_sum += latency;
+        g_pc_latency_max = (latency > g_pc_latency_max) ? latency : g_pc_latency_max;
+    }
+}
+/**
+ * @brief ピンポンの送信側スレッドのエントリー関数処理
+ * @details 受信側を起こしてから、受信側に起こされるまで待つ (1往復で2回の受け渡し)
+ */
+void entry_ping_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < PC_BENCH_ITEMS; i++)
+    {
+        sem_up(&g_pong_sem);
+        sem_down(&g_ping_sem);
+    }
+}
+/**
+ * @brief ピンポンの受信側スレッドのエントリー関数処理
+ */
+void entry_pong_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < PC_BENCH_ITEMS; i++)
+    {
+        sem_down(&g_pong_sem);
+        sem_up(&g_ping_sem);
+    }
+}
+/**
+ * @brief 生産者・消費者の性能計測
+ * @details 生産者と消費者を同じハートと別のハートに置いた場合について、
+ *          ミューテックス・条件変数のキューでの受け渡しの遅延(平均・最大)と、
+ *          セマフォのピンポンでの1回の受け渡しにかかる時間を計測する
+ *          待っているスレッドは実行可能キューにないため、待ちの間にスケジューラが探索することはない
+ */
+void benchmark_producer_consumer(void)
+{
+    struct hart *hart = this_hart();
+    for (int remote = 0; remote <= 1; remote++)
+    {
+        struct hart *other = hart;
+        if (remote)
+        {
+            if (g_hart_count < 2)
+            {
+                printf("producer/consumer (cross hart): skipped, 1 hart online\n");
+                break;
+            }
+            other = &g_harts[g_online_harts[1]];
+        }
+        // 計測中に他のハートへ移らないようにする
+        g_work_stealing = 0;
+        init_mutex(&g_pc_mutex);
+        init_condvar(&g_pc_not_empty);
+        init_condvar(&g_pc_not_full);
+        g_pc_head = 0;
+        g_pc_tail = 0;
+        g_pc_latency_sum = 0;
+        g_pc_latency_max = 0;
+        unsigned long long start = get_time();
+        create_thread_on(entry_consumer_thread, NULL, other);
+        create_thread_on(entry_producer_thread, NULL, hart);
+        wait_for_threads(hart);
+        unsigned int queue_ms = (unsigned int)(get_time() - start) / TICKS_PER_MS;
+        // セマフォのピンポン
+        init_semaphore(&g_ping_sem, 0);
+        init_semaphore(&g_pong_sem, 0);
+        start = get_time();
+        create_thread_on(entry_pong_thread, NULL, other);
+        create_thread_on(entry_ping_thread, NULL, hart);
+        wait_for_threads(hart);
+        unsigned int pingpong = (unsigned int)(get_time() - start);
+        g_work_stealing = 1;
+        printf("producer/consumer (%s): %d items in %d ms, latency avg %d us max %d us, semaphore handoff %d ns\n",
+               remote ? "cross hart" : "same hart", PC_BENCH_ITEMS, queue_ms,
+               g_pc_latency_sum / PC_BENCH_ITEMS / TICKS_PER_US, g_pc_latency_max / TICKS_PER_US,
+               pingpong * (1000 / TICKS_PER_US) / (PC_BENCH_ITEMS * 2));
+    }
+}
+/**
+ * @brief 短時間で終了するスレッドのエントリー関数処理
+ * @param arg : 終了したスレッドの数を数えるカウンタ
+ */
+void entry_churn_thread(void *arg)
+{
+    __atomic_fetch_add((unsigned int *)arg, 1, __ATOMIC_RELAXED);
+}
+/**
+ * @brief スレッドを作成して合流し続けるスレッドのエントリー関数処理
+ * @param arg : 作成したスレッドが数えるカウンタ
+ * @details CHURN_BENCH_BATCH個ずつ全てのハートへ作成してから合流することを、CHURN_BENCH_THREADS個になるまで繰り返す
+ */
+void entry_churn_spawner_thread(void *arg)
+{
+    struct thread *threads[CHURN_BENCH_BATCH];
+    for (int i = 0; i < CHURN_BENCH_THREADS; i += CHURN_BENCH_BATCH)
+    {
+        for (int j = 0; j < CHURN_BENCH_BATCH; j++)
+        {
+            threads[j] = create_joinable_thread(entry_churn_thread, arg);
+        }
+        for (int j = 0; j < CHURN_BENCH_BATCH; j++)
+        {
+            if (threads[j] != NULL)
+            {
+                thread_join(threads[j]);
+            }
+        }
+    }
+}
+/**
+ * @brief スレッドの作成・合流の性能計測
+ * @details 短時間で終了するスレッドの作成と合流を繰り返し、1秒当たりに処理できたスレッドの数を計測する
+ *          スタック枠とスレッドは一定時間で再利用されるため、使用したスタック枠の数・スレッドのスラブ・空きページが
+ *          計測の前後で(同時に存在したスレッドの数を超えて)増えないことを確認する
+ */
+void benchmark_thread_churn(void)
+{
+    unsigned int count = 0;
+    int slots_before = g_stack_slot_used;
+    unsigned int objects_before = g_thread_cache.object_count;
+    unsigned int free_before = g_free_page_count;
+
+    unsigned long long start = get_time();
+    create_thread_on(entry_churn_spawner_thread, &count, this_hart());
+    wait_for_threads(this_hart());
+    unsigned int elapsed_us = (unsigned int)(get_time() - start) / TICKS_PER_US;
+    unsigned long long rate = (unsigned long long)count * 1000000;
+    div64_u32(&rate, (elapsed_us > 0) ? elapsed_us : 1);
+    printf("thread churn (%d threads, join every %d): %d exited in %d us, %u threads/s, stack slots %d->%d, thread slab %d->%d objects (%d used), free pages %d->%d\n",
+           CHURN_BENCH_THREADS, CHURN_BENCH_BATCH, count, elapsed_us, (unsigned int)rate,
+           slots_before, g_stack_slot_used, objects_before, g_thread_cache.object_count, g_thread_cache.used_count,
+           free_before, g_free_page_count);
+}
+/**
+ * @brief システムコールの呼び出し (ユーザーモード)
+ * @param num  : システムコール番号
+ * @param arg0 : 第1引数
+ * @param arg1 : 第2引数
+ * @param arg2 : 第3引数
+ * @return システムコールの戻り値
+ */
+USER_TEXT int user_syscall(int num, int arg0, int arg1, int arg2)
+{
+    register int a0 __asm__("a0") = arg0;
+    register int a1 __asm__("a1") = arg1;
+    register int a2 __asm__("a2") = arg2;
+    register int a7 __asm__("a7") = num;
+    __asm__ __volatile__(
+        "ecall\n"
+        : "+r"(a0), "+r"(a1), "+r"(a2), "+r"(a7)
+        :
+        : "t0", "t1", "t2", "t3", "t4", "t5", "t6", "a3", "a4", "a5", "a6", "memory");
+    return a0;
+}
+/**
+ * @brief サイクル数の取得 (ユーザーモード)
+ * @return cycleレジスタの下位32ビット
+ */
+USER_TEXT unsigned int user_cycle(void)
+{
+    unsigned int cycle = 0;
+    __asm__ __volatile__("rdcycle %0\n" : "=r"(cycle));
+    return cycle;
+}
+/**
+ * @brief 文字列の表示 (ユーザーモード)
+ * @param s : 表示する文字列 (USER_RODATAの定数)
+ */
+USER_TEXT void user_puts(const char *s)
+{
+    unsigned int len = 0;
+    while (s[len] != '\0')
+    {
+        len++;
+    }
+    user_syscall(SYS_WRITE, 1, (int)s, (int)len);
+}
+/**
+ * @brief 符号なし整数の表示 (ユーザーモード)
+ * @param n    : 表示する値
+ * @param base : 基数 (10または16)
+ */
+USER_TEXT void user_put_uint(unsigned int n, unsigned int base)
+{
+    char buf[12];
+    int i = sizeof(buf);
+    do
+    {
+        unsigned int digit = n % base;
+        buf[--i] = (char)((digit < 10) ? ('0' + digit) : ('a' + digit - 10));
+        n /= base;
+    } while (n != 0);
+    user_syscall(SYS_WRITE, 1, (int)&buf[i], (int)sizeof(buf) - i);
+}
+/**
+ * @brief ユーザーモードのプログラムの文字列(グローバル変数)
+ * @note 文字列リテラルはカーネルの.rodataに置かれるため、ユーザー領域から参照する文字列は配列として定義する
+ */
+USER_RODATA const char g_user_str_hello[] = "hello from user mode: pid ";
+USER_RODATA const char g_user_str_stack[] = ", stack 0x";
+USER_RODATA const char g_user_str_done[] = ": done after yield\n";
+USER_RODATA const char g_user_str_pid[] = "pid ";
+USER_RODATA const char g_user_str_fault[] = ": reading kernel memory\n";
+USER_RODATA const char g_user_str_fast[] = "syscall round trip (getpid, fast path): ";
+USER_RODATA const char g_user_str_slow[] = "syscall round trip (null, full trap frame): ";
+USER_RODATA const char g_user_str_cycles[] = " cycles\n";
+USER_RODATA const char g_user_str_newline[] = "\n";
+USER_RODATA const char g_user_str_fork[] = "fork + exit + wait round trip: ";
+USER_RODATA const char g_user_str_exec_path[] = "user.elf";
+USER_RODATA const char g_user_str_exec_failed[] = ": exec failed\n";
+USER_RODATA const char g_user_str_exec_done[] = ": child exited after exec\n";
+USER_RODATA const char g_user_str_mem_start[] = "memory at start:        ";
+USER_RODATA const char g_user_str_mem_sbrk[] = "memory after sbrk:      ";
+USER_RODATA const char g_user_str_mem_heap[] = "memory after heap use:  ";
+USER_RODATA const char g_user_str_mem_mmap[] = "memory after mmap use:  ";
+USER_RODATA const char g_user_str_mem_free[] = "memory after release:   ";
+USER_RODATA const char g_user_str_mem_stack[] = "memory after recursion: ";
+USER_RODATA const char g_user_str_mem_virtual[] = "virtual ";
+USER_RODATA const char g_user_str_mem_resident[] = " KB, resident ";
+USER_RODATA const char g_user_str_kb[] = " KB\n";
+USER_RODATA const char g_user_str_demand[] = "demand zero fill: ";
+USER_RODATA const char g_user_str_cycles_page[] = " cycles/page\n";
+USER_RODATA const char g_user_str_ping_pong[] = ": ping-pong round trip ";
+USER_RODATA const char g_user_str_cycles_round[] = " cycles\n";
+/**
+ * @brief あいさつを表示するプログラム (ユーザーモード)
+ * @details プロセスIDとスタック上の変数のアドレス(全プロセスで同じ仮想アドレス)を表示し、CPUを譲ってから終了する
+ */
+USER_TEXT void user_main_hello(void)
+{
+    int pid = user_syscall(SYS_GETPID, 0, 0, 0);
+    user_puts(g_user_str_hello);
+    user_put_uint((unsigned int)pid, 10);
+    user_puts(g_user_str_stack);
+    user_put_uint((unsigned int)&pid, 16);
+    user_puts(g_user_str_newline);
+    user_syscall(SYS_YIELD, 0, 0, 0);
+    user_puts(g_user_str_pid);
+    user_put_uint((unsigned int)pid, 10);
+    user_puts(g_user_str_done);
+    user_syscall(SYS_EXIT, 0, 0, 0);
+}
+/**
+ * @brief カーネルのメモリを読もうとするプログラム (ユーザーモード)
+ * @details カーネルの対応付けはユーザーモードからアクセスできないため、ページフォルトで終了させられる
+ */
+USER_TEXT void user_main_fault(void)
+{
+    user_puts(g_user_str_pid);
+    user_put_uint((unsigned int)user_syscall(SYS_GETPID, 0, 0, 0), 10);
+    user_puts(g_user_str_fault);
+    (void)*(volatile unsigned int *)__kernel_base;
+    user_syscall(SYS_EXIT, 0, 0, 0);
+}
+/**
+ * @brief システムコールの往復時間を計測するプログラム (ユーザーモード)
+ * @details 高速パスのgetpidと、通常のパスの何もしないシステムコールをSYSCALL_BENCH_COUNT回ずつ呼び出し、
+ *          1回当たりのサイクル数を表示する
+ */
+USER_TEXT void user_main_syscall_bench(void)
+{
+    unsigned int start = user_cycle();
+    for (int i = 0; i < SYSCALL_BENCH_COUNT; i++)
+    {
+        user_syscall(SYS_GETPID, 0, 0, 0);
+    }
+    unsigned int fast = (user_cycle() - start) / SYSCALL_BENCH_COUNT;
+    start = user_cycle();
+    for (int i = 0; i < SYSCALL_BENCH_COUNT; i++)
+    {
+        user_syscall(SYS_NULL, 0, 0, 0);
+    }
+    unsigned int slow = (user_cycle() - start) / SYSCALL_BENCH_COUNT;
+    user_puts(g_user_str_fast);
+    user_put_uint(fast, 10);
+    user_puts(g_user_str_cycles);
+    user_puts(g_user_str_slow);
+    user_put_uint(slow, 10);
+    user_puts(g_user_str_cycles);
+    user_syscall(SYS_EXIT, 0, 0, 0);
+}
+/**
+ * @brief forkの往復時間を計測するプログラム (ユーザーモード)
+ * @details sbrkで確保したヒープ(FORK_BENCH_HEAP_PAGESページ)の全ページに書き込んでから、
+ *          forkして子がヒープの1ページに書き込んで終了し、親が終了を待つまでをFORK_BENCH_COUNT回繰り返し、1回当たりのサイクル数を表示する
+ */
+USER_TEXT void user_main_fork_bench(void)
+{
+    volatile unsigned int *heap = (volatile unsigned int *)user_syscall(SYS_SBRK, FORK_BENCH_HEAP_PAGES * PAGE_SIZE, 0, 0);
+    for (unsigned int i = 0; i < FORK_BENCH_HEAP_PAGES; i++)
+    {
+        heap[i * PAGE_SIZE / sizeof(unsigned int)] = i;
+    }
+    unsigned int start = user_cycle();
+    for (int i = 0; i < FORK_BENCH_COUNT; i++)
+    {
+        if (user_syscall(SYS_FORK, 0, 0, 0) == 0)
+        {
+            heap[0]++;
+            user_syscall(SYS_EXIT, 0, 0, 0);
+        }
+        user_syscall(SYS_WAIT, 0, 0, 0);
+    }
+    unsigned int cycles = (user_cycle() - start) / FORK_BENCH_COUNT;
+    user_puts(g_user_str_fork);
+    user_put_uint(cycles, 10);
+    user_puts(g_user_str_cycles);
+    user_syscall(SYS_EXIT, 0, 0, 0);
+}
+/**
+ * @brief forkとexecで初期RAMディスクのプログラムを起動するプログラム (ユーザーモード)
+ * @details 子プロセスでuser.elfをexecし、親は子プロセスの終了を待ってから終了する
+ */
+USER_TEXT void user_main_spawn(void)
+{
+    int pid = user_syscall(SYS_FORK, 0, 0, 0);
+    if (pid == 0)
+    {
+        user_syscall(SYS_EXEC, (int)g_user_str_exec_path, sizeof(g_user_str_exec_path) - 1, 0);
+        user_puts(g_user_str_exec_path);
+        user_puts(g_user_str_exec_failed);
+        user_syscall(SYS_EXIT, 1, 0, 0);
+    }
+    user_syscall(SYS_WAIT, 0, 0, 0);
+    user_puts(g_user_str_pid);
+    user_put_uint((unsigned int)pid, 10);
+    user_puts(g_user_str_exec_done);
+    user_syscall(SYS_EXIT, 0, 0, 0);
+}
+/**
+ * @brief プロセスのメモリ使用量の表示 (ユーザーモード)
+ * @param label : 表示する見出し (USER_RODATAの定数)
+ */
+USER_TEXT void user_print_memory(const char *label)
+{
+    user_puts(label);
+    user_puts(g_user_str_mem_virtual);
+    user_put_uint((unsigned int)user_syscall(SYS_MEMINFO, 0, 0, 0) * (PAGE_SIZE / 1024), 10);
+    user_puts(g_user_str_mem_resident);
+    user_put_uint((unsigned int)user_syscall(SYS_MEMINFO, 1, 0, 0) * (PAGE_SIZE / 1024), 10);
+    user_puts(g_user_str_kb);
+}
+/**
+ * @brief スタックを伸ばす再帰関数 (ユーザーモード)
+ * @param depth : 残りの再帰の深さ
+ * @return 各段のスタック上の配列に書いた値の合計 (最適化で配列を消されないようにする)
+ */
+USER_TEXT unsigned int user_grow_stack(unsigned int depth)
+{
+    volatile char frame[1024];
+    frame[0] = (char)depth;
+    if (depth == 0)
+    {
+        return frame[0];
+    }
+    return user_grow_stack(depth - 1) + frame[0];
+}
+/**
+ * @brief 要求時のページ割り当てを確認するプログラム (ユーザーモード)
+ * @details sbrk・mmapで予約しただけでは実メモリが増えず、アクセスしたページだけが割り当てられることと、
+ *          スタックが再帰に合わせて伸びることを、仮想メモリと実メモリの使用量で表示する
+ *          ヒープの各ページの最初の書き込み(ページフォルトでの0クリアしたページの割り当て)の1ページ当たりのサイクル数も表示する
+ */
+USER_TEXT void user_main_demand_paging(void)
+{
+    user_print_memory(g_user_str_mem_start);
+    volatile unsigned int *heap = (volatile unsigned int *)user_syscall(SYS_SBRK, LAZY_BENCH_HEAP_PAGES * PAGE_SIZE, 0, 0);
+    user_print_memory(g_user_str_mem_sbrk);
+    unsigned int start = user_cycle();
+    for (unsigned int i = 0; i < LAZY_BENCH_HEAP_PAGES / 2; i++)
+    {
+        heap[i * PAGE_SIZE / sizeof(unsigned int)] = i;
+    }
+    unsigned int cycles = (user_cycle() - start) / (LAZY_BENCH_HEAP_PAGES / 2);
+    user_print_memory(g_user_str_mem_heap);
+    user_puts(g_user_str_demand);
+    user_put_uint(cycles, 10);
+    user_puts(g_user_str_cycles_page);
+    int addr = user_syscall(SYS_MMAP, LAZY_BENCH_MMAP_PAGES * PAGE_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE, 0);
+    volatile unsigned int *area = (volatile unsigned int *)addr;
+    area[0] = area[PAGE_SIZE / sizeof(unsigned int)] + 1; // 読み込みと書き込みで1ページずつ
+    user_print_memory(g_user_str_mem_mmap);
+    user_syscall(SYS_MUNMAP, addr, LAZY_BENCH_MMAP_PAGES * PAGE_SIZE, 0);
+    user_syscall(SYS_SBRK, -(LAZY_BENCH_HEAP_PAGES * PAGE_SIZE), 0, 0);
+    user_print_memory(g_user_str_mem_free);
+    user_grow_stack(LAZY_BENCH_STACK_DEPTH);
+    user_print_memory(g_user_str_mem_stack);
+    user_syscall(SYS_EXIT, 0, 0, 0);
+}
+/**
+ * @brief 他のプロセスと交互に実行するプログラム (ユーザーモード)
+ * @details ヒープのASID_BENCH_PAGESページに書き込んでからCPUを譲ることをASID_BENCH_ROUNDS回繰り返し、
+ *          同じハートのもう1つのプロセスとの1往復(切り替え2回)当たりのサイクル数を表示する
+ *          切り替えでTLBを無効化すると、戻るたびに書き込むページの変換をやり直す
+ */
+USER_TEXT void user_main_ping_pong(void)
+{
+    volatile unsigned int *heap = (volatile unsigned int *)user_syscall(SYS_SBRK, ASID_BENCH_PAGES * PAGE_SIZE, 0, 0);
+    for (unsigned int i = 0; i < ASID_BENCH_PAGES; i++)
+    {
+        heap[i * PAGE_SIZE / sizeof(unsigned int)] = 0;
+    }
+    user_syscall(SYS_YIELD, 0, 0, 0);
+    unsigned int start = user_cycle();
+    for (int round = 0; round < ASID_BENCH_ROUNDS; round++)
+    {
+        for (unsigned int i = 0; i < ASID_BENCH_PAGES; i++)
+        {
+            heap[i * PAGE_SIZE / sizeof(unsigned int)]++;
+        }
+        user_syscall(SYS_YIELD, 0, 0, 0);
+    }
+    unsigned int cycles = (user_cycle() - start) / ASID_BENCH_ROUNDS;
+    user_puts(g_user_str_pid);
+    user_put_uint((unsigned int)user_syscall(SYS_GETPID, 0, 0, 0), 10);
+    user_puts(g_user_str_ping_pong);
+    user_put_uint(cycles, 10);
+    user_puts(g_user_str_cycles_round);
+    user_syscall(SYS_EXIT, 0, 0, 0);
+}
+/**
+ * @brief ユーザーモードのプロセスの動作確認と性能計測
+ * @details プロセスごとのアドレス空間・高速パスのシステムコール・ユーザーモードの例外でのプロセスの終了を確認し、
+ *          システムコールの往復時間を計測する (終了したプロセスのページが全て解放されることも確認する)
+ */
+void benchmark_processes(void)
+{
+    struct hart *hart = this_hart();
+    unsigned int free_before = g_free_page_count;
+
+    create_process(user_main_hello);
+    create_process(user_main_hello);
+    create_process(user_main_fault);
+    wait_for_threads(hart);
+    // 計測中に他のハートへ移らないようにする
+    g_work_stealing = 0;
+    int pid = create_process(user_main_syscall_bench);
+    wait_for_threads(hart);
+    g_work_stealing = 1;
+    printf("processes: bench pid %d, free pages %d -> %d\n", pid, free_before, g_free_page_count);
+}
+/**
+ * @brief ELFの読み込みの性能計測
+ * @details 初期RAMディスクのuser.elfについて、全てのセグメントを複写する場合と、書き込み不可のページを
+ *          イメージから直接対応付ける場合のそれぞれで、アドレス空間の作成〜読み込み〜スタックの設定(プログラムの起動)に
+ *          かかるサイクル数と、割り当てたページ数を比べる
+ *          続けて実際にプロセスとして実行し、作成から終了までの時間と、終了後に全てのページが解放されることを確認する
+ */
+void benchmark_elf_loading(void)
+{
+    struct initrd_file *file = find_initrd_file("user.elf");
+    if (file == NULL)
+    {
+        printf("elf: user.elf not found\n");
+        return;
+    }
+    printf("elf: initrd %d bytes, user.elf %d bytes\n", __initrd_end - __initrd, file->end - file->start);
+    for (int share = 0; share <= 1; share++)
+    {
+        unsigned int free_before = g_free_page_count;
+        unsigned int cycles = 0;
+        g_elf_shared_pages = 0;
+        g_elf_copied_pages = 0;
+        for (int i = 0; i < ELF_BENCH_COUNT; i++)
+        {
+            unsigned int start = get_cycle();
+            unsigned int *table1 = create_user_page_table();
+            unsigned int entry = 0;
+            if ((table1 == NULL) || (load_elf(table1, file->start, (unsigned int)(file->end - file->start), share, &entry) < 0))
+            {
+                printf("elf: load failed\n");
+                if (table1 != NULL)
+                {
+                    free_user_page_table(table1);
+                }
+                return;
+            }
+            setup_user_stack(table1, file->name);
+            cycles += get_cycle() - start;
+            free_user_page_table(table1);
+        }
+        unsigned int shared = g_elf_shared_pages / ELF_BENCH_COUNT;
+        unsigned int copied = g_elf_copied_pages / ELF_BENCH_COUNT;
+        unsigned long long start = get_time();
+        create_process_elf(file->name, share);
+        wait_for_threads(this_hart());
+        unsigned int elapsed_us = (unsigned int)(get_time() - start) / TICKS_PER_US;
+        printf("elf load (%s): %d cycles/startup, %d shared + %d copied pages, spawn to exit %d us, free pages %d -> %d\n",
+               share ? "map" : "copy", cycles / ELF_BENCH_COUNT, shared, copied, elapsed_us, free_before, g_free_page_count);
+    }
+}
+/**
+ * @brief forkの性能計測
+ * @details 1MBのヒープを持つプロセスで、全てのページを複写するforkとコピーオンライトのforkの往復時間
+ *          (fork〜子の1ページの書き込み〜終了〜親の待ち合わせ)と、fork1回当たりに割り当てたページ数を比べる
+ *          続けてforkとexecで初期RAMディスクのプログラムを起動し、終了後に全てのページが解放されることを確認する
+ */
+void benchmark_fork(void)
+{
+    struct hart *hart = this_hart();
+    for (int cow = 0; cow <= 1; cow++)
+    {
+        unsigned int free_before = g_free_page_count;
+        g_fork_cow = cow;
+        g_fork_page_count = 0;
+        g_cow_copy_count = 0;
+        g_cow_reuse_count = 0;
+        printf("fork (%s, heap %d KB):\n", cow ? "cow" : "copy", FORK_BENCH_HEAP_PAGES * PAGE_SIZE / 1024);
+        create_process(user_main_fork_bench);
+        wait_for_threads(hart);
+        printf("fork (%s): %d pages allocated per fork, %d copied + %d reused on write faults per fork, free pages %d -> %d\n",
+               cow ? "cow" : "copy", g_fork_page_count / FORK_BENCH_COUNT, g_cow_copy_count / FORK_BENCH_COUNT,
+               g_cow_reuse_count / FORK_BENCH_COUNT, free_before, g_free_page_count);
+    }
+    unsigned int free_before = g_free_page_count;
+    create_process(user_main_spawn);
+    wait_for_threads(hart);
+    printf("fork + exec: free pages %d -> %d\n", free_before, g_free_page_count);
+}
+/**
+ * @brief ASIDの性能計測
+ * @details 2つのプロセスを同じハートで交互に実行し、切り替えのたびにTLBを全て無効化する場合(flush)と、
+ *          ASIDでsatpを書き換えるだけの場合(asid)の往復時間を比べる
+ *          ASIDの最大値を1に制限し、切り替えのたびに世代を進める場合(rollover)も計測して、割り当て直しが正しく動くことを確認する
+ *          ブートしたハートは終了を待つ間もスケジューラを呼ぶため、2つ目のハートがあればそちらで実行する
+ */
+void benchmark_asid(void)
+{
+    const char *names[] = {"flush", "asid", "rollover"};
+    struct hart *hart = this_hart();
+    struct hart *target = (g_hart_count >= 2) ? &g_harts[g_online_harts[1]] : hart;
+    unsigned int asid_max = g_asid_max;
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        if ((mode > 0) && (asid_max == 0))
         {
-            putchar(*fmt); // 文字をそのまま表示
+            printf("process ping-pong (%s): skipped, asid not implemented\n", names[mode]);
+            continue;
         }
-        // 指定した文字列を進める
-        fmt++;
+        unsigned int rollover_before = g_asid_rollover_count;
+        g_asid_enable = (mode > 0);
+        g_asid_max = (mode == 2) ? 1 : asid_max;
+        printf("process ping-pong (%s, %d pages):\n", names[mode], ASID_BENCH_PAGES);
+        // 計測中に他のハートへ移らないようにする
+        g_work_stealing = 0;
+        create_process_on(user_main_ping_pong, target);
+        create_process_on(user_main_ping_pong, target);
+        wait_for_threads(hart);
+        g_work_stealing = 1;
+        printf("process ping-pong (%s): %d asid rollovers\n", names[mode], g_asid_rollover_count - rollover_before);
     }
-    // 可変長引数の取得を終了
-    va_end(vargs);
+    g_asid_max = asid_max;
+    g_asid_enable = (asid_max != 0);
 }
 /**
- * @brief トラップハンドラ処理
- * @param なし
- * @details CPUがエラーや特別な状況を検知したときに、それをOSに通知して適切に処理するための仕組み
+ * @brief 要求時のページ割り当ての確認
+ * @details ヒープ・無名の対応付け・スタックをページフォルトで割り当てるプロセスを実行し、
+ *          ページフォルトで割り当てたページ数と、終了後に全てのページが解放されることを確認する
  */
-__attribute__((aligned(4))) /* アライメントを４バイト境界でスタックの割り当て */
-void
-trap_handler(void)
+void benchmark_demand_paging(void)
 {
-    unsigned int scause = 0; // 例外や割り込み時の原因
-    unsigned int sepc = 0;   // 例外や割り込み時のプログラムカウンタ
-
-    /*
-        インラインアセンブラとは
-        オペコードは、アセンブリの命令名、オペランドは、アセンブリ命令の引数を示します。
-        出力オペランドは、アセンブリコードが結果を格納する場所を指定します。
-        "=r"(var) のように、=rでレジスタを使用し、varに格納できます。
-        なお、r(レジスタに結果を書き込む), +(オペランドが入力でも出力でもある), -(通常は使用しない)があります。
-        入力オペランドは、アセンブリコードに渡される入力値を指定します。
-        "r"(var) で、varの値がレジスタに格納されてアセンブリコードに渡されます。
-        なお、r(レジスタオペランド)、m（メモリ）,i（即値）,n（整数定数）,g（汎用オペランド）があります。
-        __asm__ (
-          ”オペコード オペランド1, オペランド2, ... ,"    <アセンブリテンプレート : ％0,%1...は、％番目の出力/入力オペランドで指定したレジスタを示す>
-        : "制約"(C言語中の変数名)                       <出力オペランド : レジスタの値をC言語の変数へ出力するもの。通常は、"＝r"を指定する>
-        : "制約"(C言語中の変数名)                       <入力オペランド : C言語の変数をレジスタに設定する。”r”を指定しなければならない>
-        :  破壊されるレジスタのリスト                    <レジスタの値が変更されてしまい、影響を与えてしまう項目>
-    */
-
-    // 例外や割り込みが発生すると、scauseレジスタにはその原因を示すビットがセットされる
-    // sepcレジスタは、例外や割り込みが発生した際のプログラムカウンタ（PC）の値を保持される
-    __asm__ __volatile__(
-        "csrr %0, scause\n"        /* %0にscauseレジスタの内容を読み込む */
-        "csrr %1, sepc\n"          /* %1にsepcレジスタの内容を読み込む */
-        : "=r"(scause), "=r"(sepc) /* 上記の結果をC言語の変数scauseとsepcに書き込む */
-    );
-    printf("trap: scause = 0x%x, sepc = 0x%x\n", scause, sepc);
-    for (;;)
-        ;
+    unsigned int free_before = g_free_page_count;
+    g_demand_fault_count = 0;
+    create_process(user_main_demand_paging);
+    wait_for_threads(this_hart());
+    printf("demand paging: %d pages allocated on fault, free pages %d -> %d\n",
+           g_demand_fault_count, free_before, g_free_page_count);
 }
 /**
- * @brief コンテキストスッチの処理
- * @param prev_sp   : 前回のスタックポインタ
- * @param next_sp   : 次回のスタックポインタ
- * @details 現在のレジスタの状態を保存し、新しいスタックポインタに切り替えてから、以前の状態を復元します。
+ * @brief kmallocの負荷試験(グローバル変数)
  */
-__attribute__((naked)) /* 通常の関数処理を無効化 (関数が通常の関数呼び出しや戻り処理をしない) */
-void
-switch_context(unsigned int *prev_sp, unsigned int *next_sp)
+unsigned int g_kmalloc_bench_cycles[HART_MAX]; // ハートごとの負荷試験のサイクル数
+unsigned int g_kmalloc_bench_failed;           // 割り当てに失敗した回数
+/**
+ * @brief kmallocの負荷試験のスレッドのエントリー関数処理
+ * @param arg : 乱数の種
+ * @details ランダムに選んだスロットの割り当て/解放を繰り返す (サイズは小さいものほど多くなるように選ぶ)
+ *          最後に保持している領域を全て解放し、マガジンをスラブキャッシュへ返却する
+ */
+void entry_kmalloc_bench_thread(void *arg)
 {
-    /*
-        switch_contextが呼ばれると、a0/a1レジスタにprev_sp/next_spが設定され、
-        スタックポインタの位置の更新、フレームポインタの設定などが行われます。
-    */
-    __asm__ __volatile__(
-        /* 新しいスタックフレームを作成して、レジスタの値を保存する領域を作る */
-        "addi sp, sp, -13 * 4 \n"
-        /* レジスタの値をスタック(メモリ)に保存 (レジスタの保存) */
-        /* s1からs11の保存レジスタは、関数の呼び出し間でデータを保持するもので、関数をまたいでもその値が保持される */
-        "sw ra,   0 * 4(sp)\n" /* 現在のspの位置にリターンアドレスを保存 */
-        "sw s0,   1 * 4(sp)\n" /* 現在のspの位置から4バイトずらした位置にフレームポインタを保存 */
-        "sw s1,   2 * 4(sp)\n" /* 現在のspの位置から8バイトずらした位置に保存レジスタを保存 */
-        "sw s2,   3 * 4(sp)\n" /* 現在のspの位置から12バイトずらした位置に保存レジスタを保存 */
-        "sw s3,   4 * 4(sp)\n" /* 現在のspの位置から16バイトずらした位置に保存レジスタを保存 */
-        "sw s4,   5 * 4(sp)\n" /* 現在のspの位置から20バイトずらした位置に保存レジスタを保存 */
-        "sw s5,   6 * 4(sp)\n" /* 現在のspの位置から24バイトずらした位置に保存レジスタを保存 */
-        "sw s6,   7 * 4(sp)\n" /* 現在のspの位置から28バイトずらした位置に保存レジスタを保存 */
-        "sw s7,   8 * 4(sp)\n" /* 現在のspの位置から32バイトずらした位置に保存レジスタを保存 */
-        "sw s8,   9 * 4(sp)\n" /* 現在のspの位置から36バイトずらした位置に保存レジスタを保存 */
-        "sw s9,  10 * 4(sp)\n" /* 現在のspの位置から40バイトずらした位置に保存レジスタを保存 */
-        "sw s10, 11 * 4(sp)\n" /* 現在のspの位置から44バイトずらした位置に保存レジスタを保存 */
-        "sw s11, 12 * 4(sp)\n" /* 現在のspの位置から48バイトずらした位置に保存レジスタを保存 */
-        /* 現在のスタックポインタの位置をa0が指すアドレスに保存 */
-        /* a0は、関数呼び出しの第1引数であり、prev_spをとなる */
-        "sw sp,  (a0)\n"
-        /* a1が指すデータを現在のスタックポインタにする */
-        /*
-            a1は、関数呼び出しの第2引数であり、next_spをとなる
-            next_spのスタックのアドレスをレジスタのスタックポインタに設定する
-            ここからnext_spのスタックをレジスタが処理する
-        */
-        "lw sp,  (a1)\n"
-        /* ここから、next_spのスタックに保存していた値をレジスタにロード (レジスタの復元) */
-        "lw ra,   0 * 4(sp)\n" /* 現在のsp位置のデータをリターンアドレスに設定 */
-        "lw s0,   1 * 4(sp)\n" /* 現在のsp位置から4バイト先のデータをフレームポインタに設定 */
-        "lw s1,   2 * 4(sp)\n" /* 現在のsp位置から8バイト先のデータを保存レジスタに設定 */
-        "lw s2,   3 * 4(sp)\n" /* 現在のsp位置から12バイト先のデータを保存レジスタに設定 */
-        "lw s3,   4 * 4(sp)\n" /* 現在のsp位置から16バイト先のデータを保存レジスタに設定 */
-        "lw s4,   5 * 4(sp)\n" /* 現在のsp位置から20バイト先のデータを保存レジスタに設定 */
-        "lw s5,   6 * 4(sp)\n" /* 現在のsp位置から24バイト先のデータを保存レジスタに設定 */
-        "lw s6,   7 * 4(sp)\n" /* 現在のsp位置から28バイト先のデータを保存レジスタに設定 */
-        "lw s7,   8 * 4(sp)\n" /* 現在のsp位置から32バイト先のデータを保存レジスタに設定 */
-        "lw s8,   9 * 4(sp)\n" /* 現在のsp位置から36バイト先のデータを保存レジスタに設定 */
-        "lw s9,  10 * 4(sp)\n" /* 現在のsp位置から40バイト先のデータを保存レジスタに設定 */
-        "lw s10, 11 * 4(sp)\n" /* 現在のsp位置から44バイト先のデータを保存レジスタに設定 */
-        "lw s11, 12 * 4(sp)\n" /* 現在のsp位置から48バイト先のデータを保存レジスタに設定 */
-        /* スタックポインタの位置を戻す */
-        "addi sp, sp, 13 * 4 \n"
-        /* 終了 */
-        "ret\n");
+    void *slots[KMALLOC_BENCH_SLOTS];
+    unsigned int seed = (unsigned int)arg;
+    unsigned int failed = 0;
+
+    memset(slots, 0, sizeof(slots));
+    unsigned int start = get_cycle();
+    for (int i = 0; i < KMALLOC_BENCH_OPS; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        unsigned int slot = seed % KMALLOC_BENCH_SLOTS;
+        if (slots[slot] != NULL)
+        {
+            kfree(slots[slot]);
+            slots[slot] = NULL;
+        }
+        else
+        {
+            // 16〜KMALLOC_MAX_SIZEバイト (2の累乗の区間を等確率で選び、区間内は一様)
+            unsigned int shift = 4 + (seed >> 8) % 7;
+            slots[slot] = kmalloc((1u << shift) + (seed >> 16) % (1u << shift));
+            failed += (slots[slot] == NULL);
+        }
+    }
+    unsigned int cycles = get_cycle() - start;
+    for (int i = 0; i < KMALLOC_BENCH_SLOTS; i++)
+    {
+        kfree(slots[i]);
+    }
+    kmalloc_drain();
+    g_kmalloc_bench_cycles[this_hart()->hartid] = cycles;
+    __atomic_fetch_add(&g_kmalloc_bench_failed, failed, __ATOMIC_RELAXED);
 }
 /**
- * @brief 実行状態の定義
- * @note スレッドやプロセスの状態を示す
+ * @brief kmallocの性能計測
+ * @details 1. サイズクラスごとに割り当て・解放を繰り返し、1組当たりのサイクル数をマガジンの有無で比べる
+ *          2. 全てのハートで同時にランダムな割り当て/解放を行い、1回当たりのサイクル数をマガジンの有無で比べる
+ *             (マガジンがなければ、同じサイズクラスのスラブキャッシュのロックを奪い合う)
+ *          3. ページ単位の割り当て(KMALLOC_MAX_SIZE超)
+ *          最後にサイズクラスごとの使用量を表示し、使用中の領域の数が元に戻ること(リークがないこと)を確認する
  */
-typedef enum
+void benchmark_kmalloc(void)
 {
-    READY,     // 実行可能プロセス
-    RUNNING,   // 実行中
-    WAITING,   // 実行待ち
-    TERMINATED // ターミネート(終了状態/未設定状態)
-} ExecutionState;
+    struct hart *hart = this_hart();
+    unsigned int used_before = kmalloc_used_count();
+    unsigned int free_before = g_free_page_count;
+
+    for (int enable = 1; enable >= 0; enable--)
+    {
+        g_kmalloc_magazine_enable = enable;
+        printf("kmalloc pairs (%s):", enable ? "magazine" : "locked");
+        for (int i = 0; i < KMALLOC_CLASS_NUM; i++)
+        {
+            unsigned int start = get_cycle();
+            for (int n = 0; n < KMALLOC_BENCH_PAIRS; n++)
+            {
+                kfree(kmalloc(g_kmalloc_sizes[i]));
+            }
+            printf(" %d:%d", g_kmalloc_sizes[i], (get_cycle() - start) / KMALLOC_BENCH_PAIRS);
+        }
+        printf(" cycles/pair\n");
+        kmalloc_drain();
+    }
+    for (int enable = 1; enable >= 0; enable--)
+    {
+        g_kmalloc_magazine_enable = enable;
+        g_kmalloc_bench_failed = 0;
+        // 計測スレッドが他のハートへ移らないようにする
+        g_work_stealing = 0;
+        for (int h = 0; h < g_hart_count; h++)
+        {
+            create_thread_on(entry_kmalloc_bench_thread, (void *)(2463534242u + h), &g_harts[g_online_harts[h]]);
+        }
+        wait_for_threads(hart);
+        g_work_stealing = 1;
+        unsigned int max_cycles = 0;
+        for (int h = 0; h < g_hart_count; h++)
+        {
+            unsigned int cycles = g_kmalloc_bench_cycles[g_online_harts[h]];
+            max_cycles = (cycles > max_cycles) ? cycles : max_cycles;
+        }
+        printf("kmalloc stress (%s, %d harts): %d ops/hart, %d cycles/op (slowest hart), failed %d\n",
+               enable ? "magazine" : "locked", g_hart_count, KMALLOC_BENCH_OPS, max_cycles / KMALLOC_BENCH_OPS, g_kmalloc_bench_failed);
+    }
+    g_kmalloc_magazine_enable = 1;
+    unsigned int start = get_cycle();
+    for (int n = 0; n < KMALLOC_BENCH_PAIRS / 10; n++)
+    {
+        kfree(kmalloc(KMALLOC_MAX_SIZE * 4));
+    }
+    printf("kmalloc large (%d bytes): %d cycles/pair\n", KMALLOC_MAX_SIZE * 4, (get_cycle() - start) / (KMALLOC_BENCH_PAIRS / 10));
+    print_kmalloc_stats();
+    // スラブのページはキャッシュに残るため、空きページはその分だけ減る
+    unsigned int slab_pages = 0;
+    for (int i = 0; i < KMALLOC_CLASS_NUM; i++)
+    {
+        slab_pages += g_kmalloc_caches[i].page_count;
+    }
+    printf("kmalloc: in use %d -> %d (%s), free pages %d -> %d (%d slab pages)\n", used_before, kmalloc_used_count(),
+           (used_before == kmalloc_used_count()) ? "OK" : "LEAK", free_before, g_free_page_count, slab_pages);
+}
 /**
- * @brief 実行管理エンティティを示す構造体
- * @note スレッドやプロセスの状態とIDを管理する
+ * @brief 疑似乱数の状態(グローバル変数)
  */
-typedef struct
+unsigned int g_rand_state = 2463534242u;
+/**
+ * @brief 疑似乱数の生成 (xorshift32)
+ * @return 32ビットの疑似乱数
+ * @note 性能計測の負荷パターンを作るためのもの (毎回同じ系列になる)
+ */
+unsigned int rand32(void)
 {
-    ExecutionState status; // 状態
-    int id;                // ID (プロセスやスレッドの識別)
-} Execution;
+    g_rand_state ^= g_rand_state << 13;
+    g_rand_state ^= g_rand_state >> 17;
+    g_rand_state ^= g_rand_state << 5;
+    return g_rand_state;
+}
 /**
- * @brief スレッド
- * @note
+ * @brief ページ割り当ての負荷試験
+ * @details ランダムに選んだスロットの割り当て/解放を繰り返し、1秒当たりの処理回数と
+ *          処理後の断片化率 (空きページのうち最大の空きブロックに含まれないページの割合) を計測する
+ *          最後に全て解放し、空きブロックが元通りに結合されることを確認する
  */
-struct thread
+void benchmark_page_alloc(void)
 {
-    Execution execution;    // 実行管理エンティティ
-    unsigned int sp;        // スレッドのスタックポインタ
-    char stack[STACK_SIZE]; // スレッドのスタック領域
-};
+    static void *slots[PAGE_BENCH_SLOTS]; // 割り当てたページ領域
+    static int orders[PAGE_BENCH_SLOTS];  // 割り当てた次数
+    unsigned int free_before = g_free_page_count;
+    unsigned int ops = 0;
+    unsigned int failed = 0;
+
+    unsigned long long start = get_time();
+    for (int i = 0; i < PAGE_BENCH_ITERATIONS; i++)
+    {
+        unsigned int slot = rand32() % PAGE_BENCH_SLOTS;
+        if (slots[slot] != NULL)
+        {
+            free_pages_order(slots[slot], orders[slot]);
+            slots[slot] = NULL;
+        }
+        else
+        {
+            orders[slot] = rand32() % PAGE_BENCH_MAX_ORDER;
+            slots[slot] = alloc_pages_order(orders[slot]);
+            failed += (slots[slot] == NULL);
+        }
+        ops++;
+    }
+    unsigned int elapsed_ms = (unsigned int)(get_time() - start) / TICKS_PER_MS;
+    if (elapsed_ms == 0)
+    {
+        elapsed_ms = 1;
+    }
+    // 断片化率 : 最大の空きブロックで割り当てられないページの割合
+    int largest = PAGE_ORDER_NUM - 1;
+    while ((largest > 0) && (g_free_block_count[largest] == 0))
+    {
+        largest--;
+    }
+    unsigned int fragmentation = (g_free_page_count > 0) ? (100 - (100u << largest) / g_free_page_count) : 0;
+    printf("page alloc: %d ops in %d ms (%d ops/s), failed %d, largest free block %d pages, fragmentation %d%%\n",
+           ops, elapsed_ms, ops * 1000 / elapsed_ms, failed, 1u << largest, fragmentation);
+    print_page_stats();
+    // 全て解放し、元の空きページ数に戻ることを確認
+    for (int i = 0; i < PAGE_BENCH_SLOTS; i++)
+    {
+        if (slots[i] != NULL)
+        {
+            free_pages_order(slots[i], orders[i]);
+            slots[i] = NULL;
+        }
+    }
+    printf("page alloc: free pages %d -> %d (%s)\n", free_before, g_free_page_count,
+           (free_before == g_free_page_count) ? "OK" : "LEAK");
+}
 /**
- * @brief スレッド(グローバル変数)
- * @note　各種スレッド関連のデータ
+ * @brief バイト単位のメモリ領域の初期化 (性能計測の比較用)
+ * @param buf : 初期化するメモリ領域の先頭アドレス
+ * @param c   : 設定する値
+ * @param n   : 初期化するバイト数
  */
-struct thread g_thread_list[THREAD_MAX_NUM]; // スレッド
-struct thread *g_idle_thread;                // アイドル(何もしない)スレッド
-struct thread *g_current_thread;             // 現在実行中のスレッド
+void byte_memset(unsigned char *buf, unsigned char c, unsigned int n)
+{
+    while (n--)
+    {
+        *buf++ = c;
+    }
+}
 /**
- * @brief スレッドリストの初期設定
- * @details グローバルのスレッドリストの情報を初期化する
+ * @brief バイト単位のメモリ領域の複写 (性能計測の比較用)
+ * @param dst : 複写先の先頭アドレス
+ * @param src : 複写元の先頭アドレス
+ * @param n   : 複写するバイト数
+ * @details 複写先が後ろで重なる場合は後ろから複写する (memmoveの比較にも使う)
  */
-void init_threads(void)
+void byte_memmove(unsigned char *dst, const unsigned char *src, unsigned int n)
 {
-    for (int i = 0; i < THREAD_MAX_NUM; i++)
+    if ((dst <= src) || (dst >= src + n))
     {
-        g_thread_list[i].execution.id = 0;
-        g_thread_list[i].execution.status = TERMINATED;
+        while (n--)
+        {
+            *dst++ = *src++;
+        }
+    }
+    else
+    {
+        while (n--)
+        {
+            dst[n] = src[n];
+        }
     }
-    return;
 }
 /**
- * @brief スレッドの作成
- * @param void (*entry)(void)   : スレッドのエントリー関数のポインタ
- * @details スレッドリストにスレッドを設定し、スレッドを使用可能な状態にする
+ * @brief memset/memcpy/memmoveの性能計測
+ * @details サイズと境界のずれ(複写先/複写元の4バイト境界からのずれ)の組み合わせごとに、
+ *          ワード単位の実装とバイト単位のループの1回当たりのサイクル数を比べる
+ *          memmoveは複写先が後ろで重なる(後ろから複写する)場合を計測する
+ *          計測の前に、同じ入力でバイト単位のループと結果が一致することを確認する
  */
-struct thread *create_thread(void (*entry)(void))
+void benchmark_memory(void)
 {
-    // 空いているスレッドを探す
-    struct thread *thread = NULL;
-    int i = 0;
-    for (i = 0; i < THREAD_MAX_NUM; i++)
+    static const unsigned int sizes[] = {16, 64, 256, 1024, 4096, MEM_BENCH_MAX_SIZE};
+    static const unsigned int offsets[][2] = {{0, 0}, {1, 1}, {0, 1}, {3, 2}}; // 複写先, 複写元のずれ
+    unsigned int pages = (MEM_BENCH_MAX_SIZE + 8) / PAGE_SIZE + 1;
+    unsigned char *buf = alloc_pages(pages * 3);
+    if (buf == NULL)
+    {
+        printf("memory bench: out of memory\n");
+        return;
+    }
+    unsigned char *a = buf;
+    unsigned char *b = buf + pages * PAGE_SIZE;
+    unsigned char *ref = buf + pages * PAGE_SIZE * 2;
+    int errors = 0;
+
+    for (unsigned int o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
     {
-        if (g_thread_list[i].execution.status == TERMINATED)
+        for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
         {
-            thread = &g_thread_list[i];
-            break;
+            unsigned int n = sizes[i];
+            unsigned char *dst = b + offsets[o][0];
+            unsigned char *src = a + offsets[o][1];
+            // 結果の確認 (前後の1バイトが書き換わらないことも確認する)
+            for (unsigned int k = 0; k < n + 8; k++)
+            {
+                a[k] = (unsigned char)(k * 7 + 1);
+                ref[k] = (unsigned char)(k * 13 + 5);
+            }
+            memcpy(b, ref, n + 8);
+            memcpy(dst, src, n);
+            byte_memmove(ref + offsets[o][0], src, n);
+            errors += (memcmp(b, ref, n + 8) != 0);
+            memset(dst, 0xa5, n);
+            byte_memset(ref + offsets[o][0], 0xa5, n);
+            errors += (memcmp(b, ref, n + 8) != 0);
+            memcpy(b, a, n + 8);
+            memcpy(ref, a, n + 8);
+            memmove(b + 4 + offsets[o][0], b + offsets[o][1], n);
+            byte_memmove(ref + 4 + offsets[o][0], ref + offsets[o][1], n);
+            errors += (memcmp(b, ref, n + 8) != 0);
+            // 計測 (ワード単位 / バイト単位)
+            unsigned int cycles[6];
+            unsigned int start = get_cycle();
+            for (int r = 0; r < MEM_BENCH_REPEAT; r++)
+            {
+                memset(dst, r, n);
+            }
+            cycles[0] = get_cycle() - start;
+            start = get_cycle();
+            for (int r = 0; r < MEM_BENCH_REPEAT; r++)
+            {
+                byte_memset(dst, r, n);
+            }
+            cycles[1] = get_cycle() - start;
+            start = get_cycle();
+            for (int r = 0; r < MEM_BENCH_REPEAT; r++)
+            {
+                memcpy(dst, src, n);
+            }
+            cycles[2] = get_cycle() - start;
+            start = get_cycle();
+            for (int r = 0; r < MEM_BENCH_REPEAT; r++)
+            {
+                byte_memmove(dst, src, n);
+            }
+            cycles[3] = get_cycle() - start;
+            start = get_cycle();
+            for (int r = 0; r < MEM_BENCH_REPEAT; r++)
+            {
+                memmove(a + 4 + offsets[o][0], a + offsets[o][1], n);
+            }
+            cycles[4] = get_cycle() - start;
+            start = get_cycle();
+            for (int r = 0; r < MEM_BENCH_REPEAT; r++)
+            {
+                byte_memmove(a + 4 + offsets[o][0], a + offsets[o][1], n);
+            }
+            cycles[5] = get_cycle() - start;
+            printf("mem %5d bytes (dst+%d src+%d): memset %d/%d, memcpy %d/%d, memmove %d/%d cycles (word/byte)\n",
+                   n, offsets[o][0], offsets[o][1],
+                   cycles[0] / MEM_BENCH_REPEAT, cycles[1] / MEM_BENCH_REPEAT, cycles[2] / MEM_BENCH_REPEAT,
+                   cycles[3] / MEM_BENCH_REPEAT, cycles[4] / MEM_BENCH_REPEAT, cycles[5] / MEM_BENCH_REPEAT);
         }
     }
-    // コンテキストスイッチ用のレジスタの初期設定
-    unsigned int *sp = (unsigned int *)&thread->stack[sizeof(thread->stack) / sizeof(thread->stack[0])];
-    *--sp = 0;                   // s11
-    *--sp = 0;                   // s10
-    *--sp = 0;                   // s9
-    *--sp = 0;                   // s8
-    *--sp = 0;                   // s7
-    *--sp = 0;                   // s6
-    *--sp = 0;                   // s5
-    *--sp = 0;                   // s4
-    *--sp = 0;                   // s3
-    *--sp = 0;                   // s2
-    *--sp = 0;                   // s1
-    *--sp = 0;                   // s0
-    *--sp = (unsigned int)entry; // ra
-    // スレッドの初期設定
-    thread->execution.id = i + 1;
-    thread->execution.status = READY;
-    thread->sp = (unsigned int)sp;
-    printf("thread(sp:0x%x) 0x%x\n", thread->sp, &thread->stack[STACK_SIZE - 1]);
-    return thread;
+    printf("mem: results %s\n", (errors == 0) ? "OK" : "MISMATCH");
+    free_pages(buf, pages * 3);
 }
 /**
- * @brief 全てのスレッドが終了状態であるかどうか
- * @retval  0   :   動作中のスレッドあり
- * @retval  1   :   全てのスレッドが終了状態である
- * @details 詳細説明
+ * @brief メガページの性能計測
+ * @details 同じ領域をメガページで対応付けたページテーブルと、4KBページのみで対応付けたページテーブルで
+ *          ページ単位に読み込むメモリ走査を行い、サイクル数を比較する
+ *          (4KBページのみの場合、TLBミスが増え、ページテーブルの探索も1段深くなる)
  */
-int are_all_threads_terminated(void)
+void benchmark_paging(void)
 {
-    // 全スレッドの状態をチェック
-    for (int i = 0; i < THREAD_MAX_NUM; i++)
+    unsigned int start = ((unsigned int)__free_ram + MEGAPAGE_SIZE - 1) & ~(MEGAPAGE_SIZE - 1);
+    unsigned int end = start + PAGING_BENCH_SIZE;
+    unsigned int *tables[2] = {g_kernel_page_table, create_kernel_page_table(0)};
+    const char *names[2] = {"megapages", "4KB pages"};
+    volatile unsigned int sum = 0;
+
+    if (tables[1] == NULL)
+    {
+        printf("paging bench: out of memory\n");
+        return;
+    }
+    for (int i = 0; i < 2; i++)
     {
-        if ((g_thread_list[i].execution.status != TERMINATED) && (g_thread_list[i].execution.id > 0))
+        switch_page_table(tables[i]);
+        unsigned int cycles = get_cycle();
+        for (int pass = 0; pass < PAGING_BENCH_PASSES; pass++)
         {
-            return 0; // まだ動作中のスレッドがある
+            for (unsigned int addr = start; addr < end; addr += PAGE_SIZE)
+            {
+                sum += *(volatile unsigned int *)addr;
+            }
         }
+        cycles = get_cycle() - cycles;
+        printf("paging bench (%s): %d KB x %d passes, %d cycles (%d cycles/page)\n",
+               names[i], PAGING_BENCH_SIZE / 1024, PAGING_BENCH_PASSES, cycles,
+               cycles / (PAGING_BENCH_SIZE / PAGE_SIZE * PAGING_BENCH_PASSES));
     }
-    return 1; // 全スレッドが終了している
+    // カーネルのページテーブルに戻す
+    switch_page_table(g_kernel_page_table);
+    free_page_table(tables[1]);
 }
 /**
- * @brief スレッドスケジューラ
- * @details 現在のスレッドを休ませて、次に動作するスレッドを探索し、スレッドを動作させる
- *          スレッドの切り替えを行うスケジュール関数
+ * @brief コンソール出力の性能計測
+ * @details 同じ行を1文字ずつSBIを呼び出す方法と、リングバッファに溜めてまとめて出力する方法で表示し、
+ *          1行当たりのサイクル数を比較する
  */
-void schedule_threads(void)
+void benchmark_console(void)
 {
-    struct thread *next = NULL;
+    unsigned int cycles[3] = {0, 0, 0}; // [0]:SBIで1文字ずつ [1]:SBIでバッファリング [2]:UARTでバッファリング
 
-    // 次に動作するスレッドを探す
-    for (int i = 0; i < THREAD_MAX_NUM; i++)
+    for (int mode = 0; mode < 3; mode++)
     {
-        struct thread *thread = &g_thread_list[(g_current_thread->execution.id + i) % THREAD_MAX_NUM];
-        if ((thread->execution.status == READY) && (thread->execution.id > 0))
+        // 出力先を切り替える前に、それまでの出力を送信し終えておく
+        console_sync();
+        g_console_buffered = (mode != 0);
+        g_console_uart = (mode == 2);
+        unsigned int start = get_cycle();
+        for (int i = 0; i < CONSOLE_BENCH_LINES; i++)
         {
-            thread->execution.status = RUNNING;
-            next = thread;
-            break;
+            printf("console bench %d: the quick brown fox jumps over the lazy dog\n", i);
         }
+        cycles[mode] = get_cycle() - start;
     }
-    // 実行可能なスレッドがない場合は、アイドルスレッドに設定
-    if (next == NULL)
+    printf("console: sbi unbuffered %d cycles/line, sbi buffered %d cycles/line (debug console %s), uart %d cycles/line\n",
+           cycles[0] / CONSOLE_BENCH_LINES, cycles[1] / CONSOLE_BENCH_LINES,
+           g_console_dbcn ? "available" : "unavailable", cycles[2] / CONSOLE_BENCH_LINES);
+}
+/**
+ * @brief 10進数への変換 (書式変換の性能計測の比較用)
+ * @param buf   : 書き込み先
+ * @param value : 変換する値
+ * @return 書き込んだ文字数
+ * @details 従来のprintfの%dと同じく、10のべき乗で1桁ずつ割って変換する
+ */
+int format_decimal_by_digit(char *buf, int value)
+{
+    int len = 0;
+    int divisor = 1;
+    if (value < 0)
     {
-        g_idle_thread->execution.status = RUNNING;
-        next = g_idle_thread;
+        buf[len++] = '-';
+        value = -value;
     }
-    // コンテキストスイッチを行う
-    struct thread *prev = g_current_thread;
-    if (g_current_thread->execution.status == RUNNING)
+    while ((value / divisor) > 9)
+        divisor *= 10;
+    while (divisor > 0)
     {
-        prev->execution.status = READY;
+        buf[len++] = '0' + (value / divisor);
+        value %= divisor;
+        divisor /= 10;
     }
-    g_current_thread = next;
-    switch_context(&prev->sp, &next->sp);
+    return len;
 }
 /**
- * @brief アイドル(何もしない)スレッドの処理
- * @details 何もしないスレッドであるアイドルスレッドの処理
+ * @brief 書式変換の性能計測
+ * @details 同じ値の並びを、従来の1桁ずつの除算と2桁の表を使うsnprintfで変換し、1値当たりのサイクル数を比べる
+ *          複数の変換指定子を含む1行の変換量(バイト/秒)も求める
  */
-void entry_idle_thread(void)
+void benchmark_format(void)
 {
-    while (1)
+    static const int values[] = {0, 7, 42, 1234, 99999, -999999, 12345678, 2147483647};
+    const int value_num = sizeof(values) / sizeof(values[0]);
+    char buf[64];
+    unsigned int sink = 0; // 変換結果を使い、計測対象の処理が最適化で消えないようにする
+
+    unsigned int start = get_cycle();
+    for (int i = 0; i < FORMAT_BENCH_COUNT; i++)
+    {
+        sink += format_decimal_by_digit(buf, values[i % value_num]);
+    }
+    unsigned int by_digit = get_cycle() - start;
+
+    start = get_cycle();
+    for (int i = 0; i < FORMAT_BENCH_COUNT; i++)
+    {
+        sink += snprintf(buf, sizeof(buf), "%d", values[i % value_num]);
+    }
+    unsigned int by_pair = get_cycle() - start;
+
+    unsigned int bytes = 0;
+    unsigned long long time = get_time();
+    for (int i = 0; i < FORMAT_BENCH_COUNT; i++)
     {
-        // 何もしない（省電力のためにNOPを入れることもある）
-        __asm__ volatile("nop");
+        bytes += snprintf(buf, sizeof(buf), "id %5u sp %p val %-8d %08x %lld\n",
+                          i, buf, values[i % value_num], i, (long long)i * 1000000007);
     }
+    unsigned int elapsed_us = (unsigned int)(get_time() - time) / TICKS_PER_US;
+    if (elapsed_us == 0)
+    {
+        elapsed_us = 1;
+    }
+    printf("format: %%d by digit %u cycles/value, snprintf %u cycles/value, line %u bytes/sec (%u)\n",
+           by_digit / FORMAT_BENCH_COUNT, by_pair / FORMAT_BENCH_COUNT,
+           (bytes * 1000 / elapsed_us) * 1000, sink);
 }
 /**
- * @brief スレッドのエントリー関数処理
- * @details スレッドで実施する処理内容
+ * @brief UARTの送信性能の計測
+ * @details UART_BENCH_BYTESバイトを送信のリングバッファへ追加し、割り込みで全て送信し終えるまでの時間から
+ *          1秒当たりの送信バイト数を求める (追加に掛かった時間は、printfが呼び出し元を止める時間となる)
+ * @note 割り込みが許可された状態で呼び出すこと
  */
-void entry_thread(void)
+void benchmark_uart(void)
 {
-    for (int i = 0; i < 2; i++)
+    static const char line[] = "uart bench: the quick brown fox jumps over the lazy dog 0123456\n"; // 64バイト
+    unsigned int len = sizeof(line) - 1;
+
+    console_sync();
+    unsigned int stalls = g_uart_tx_stalls;
+    unsigned long long start = get_time();
+    for (unsigned int sent = 0; sent < UART_BENCH_BYTES; sent += len)
     {
-        // スレッドの情報
-        printf("thread_start_%d(id:%d sp:0x%x) \n", i, g_current_thread->execution.id, g_current_thread->sp);
-        schedule_threads();
-        // スタックのデータを確認
-        for (int j = STACK_SIZE; j > 0; j--)
-        {
-            // スタックのデータが設定されている場合
-            if (g_current_thread->stack[j - 1] != 0)
-            {
-                printf("(thread%d)sp=0x%x stack%d:0x%x(0x%x)\n",
-                       g_current_thread->execution.id,
-                       g_current_thread->sp,
-                       j,
-                       g_current_thread->stack[j - 1],
-                       &g_current_thread->stack[j - 1]);
-            }
-        }
-        printf("-----------------------------------------\n");
+        uart_write(line, len);
+    }
+    unsigned int queued = (unsigned int)(get_time() - start);
+    // 割り込みで送信のリングバッファが空になるまで待つ (g_uart_tx_tailは割り込みハンドラが更新するため、毎回読み込み直す)
+    while (__atomic_load_n(&g_uart_tx_tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&g_uart_tx_head, __ATOMIC_ACQUIRE))
+        ;
+    unsigned int elapsed = (unsigned int)(get_time() - start);
+    unsigned int elapsed_us = elapsed / TICKS_PER_US;
+    if (elapsed_us == 0)
+    {
+        elapsed_us = 1;
     }
-    g_current_thread->execution.status = TERMINATED;
+    printf("uart: %d bytes in %d us (%d bytes/sec), enqueue %d us, tx stalls %d, rx dropped %d\n",
+           UART_BENCH_BYTES, elapsed_us, (UART_BENCH_BYTES * 1000 / elapsed_us) * 1000,
+           queued / TICKS_PER_US, g_uart_tx_stalls - stalls, g_uart_rx_dropped);
 }
 /**
  * @brief カーネルメイン処理
- * @param なし
+ * @param hartid : ブートしたハートのID (OpenSBIがa0で渡す)
  * @details 詳細説明
  */
-void kernel_main(void)
+void kernel_main(unsigned int hartid)
 {
     // RISC-Vアーキテクチャにおけるトラップハンドラの設定
     __asm__ __volatile__(
-        "csrw stvec, %0\n"  /* stvecレジスタにトラップハンドラのアドレスを設定 */
-        ::"r"(trap_handler) /* 入力オペランド: トラップハンドラのアドレス */
+        "csrw stvec, %0\n" /* stvecレジスタにトラップの入口処理のアドレスを設定 */
+        ::"r"(trap_entry)  /* 入力オペランド: トラップの入口処理のアドレス */
     );
+    // ブートしたハートの管理情報の設定
+    init_hart(hartid);
+    g_boot_hartid = hartid;
+    g_online_harts[0] = hartid;
+    g_hart_count = 1;
+    // コンソールの初期化 (UARTの送受信は割り込みで進むため、割り込みを許可する)
+    init_console();
+    intr_enable();
     // Hellow Worldの表示
     printf("Hello World\n");
     // printf機能の確認
-    printf("0x%x\n", 0x1234abcd);
+    printf("0x%08x\n", 0x1234abcd);
     printf("%d\n", 999999);
     printf("%d\n", -999999);
+    printf("%d %u [%5d] [%-5d] [%05d] %llu %llx %p %c\n",
+           -2147483647 - 1, 4294967295u, 42, 42, -42, 18446744073709551615ULL, 0x123456789abcdefULL, (void *)0x80200000, 'A');
+#if BENCHMARK_ENABLE
+    // トラップの入口〜出口・コンソール出力の性能計測
+    benchmark_trap();
+    benchmark_console();
+    benchmark_uart();
+    benchmark_format();
+#endif
+    // ページ割り当ての初期化と負荷試験
+    init_pages();
+    init_kmalloc();
+    print_page_stats();
+#if BENCHMARK_ENABLE
+    benchmark_page_alloc();
+    // メモリ領域の初期化・複写の性能計測
+    benchmark_memory();
+#endif
+    // ページングの有効化と性能計測
+    init_paging();
+#if BENCHMARK_ENABLE
+    benchmark_paging();
+#endif
     // スレッドの初期化
     init_threads();
-    // アイドルスレッドの作成
-    g_idle_thread = create_thread(entry_idle_thread);
-    g_idle_thread->execution.id = 0;
-    g_current_thread = g_idle_thread;
-    // スレッドの生成
-    create_thread(entry_thread);
-    create_thread(entry_thread);
-    // スケジューラの動作
+    init_processes();
+    // 実行可能キューとアイドルスレッドの作成
+    struct hart *hart = this_hart();
+    if (init_ready_queues(hart) < 0)
+    {
+        printf("threads: out of memory for the ready queues\n");
+        console_sync();
+        for (;;)
+            ;
+    }
+    if (init_idle_thread(hart) < 0)
+    {
+        printf("threads: out of memory for the idle thread\n");
+        console_sync();
+        for (;;)
+            ;
+    }
+    // 他のハートの起動
+    start_harts();
+    // スレッドの生成 (プリエンプションの確認のため、全て自ハートで実行する)
+    struct thread *thread = NULL;
+    thread = create_thread_on(entry_busy_thread, NULL, hart);
+    printf("thread(sp:0x%08x) 0x%08x\n", thread->sp, &thread->stack[thread->stack_size - 1]);
+    thread = create_thread_on(entry_thread, NULL, hart);
+    printf("thread(sp:0x%08x) 0x%08x\n", thread->sp, &thread->stack[thread->stack_size - 1]);
+    thread = create_thread_on(entry_thread, NULL, hart);
+    printf("thread(sp:0x%08x) 0x%08x\n", thread->sp, &thread->stack[thread->stack_size - 1]);
+    // スケジューラの動作 (タイマー割り込みによるプリエンプションを開始)
     printf("thread start\n");
+    g_report_thread_stats = 1;
+    start_timer();
     while (!are_all_threads_terminated())
     {
         schedule_threads();
     }
+    stop_timer();
+    g_report_thread_stats = 0;
     printf("thread finished\n");
-    // 無限ループ
+    print_thread_stats(hart->idle_thread, (unsigned int)(get_time() - g_sched_start_time));
+#if BENCHMARK_ENABLE
+    // コンテキストスイッチの性能計測
+    benchmark_switch_latency();
+    benchmark_yield();
+    // マルチコアの性能計測
+    benchmark_smp_scaling();
+    // ワークスティーリングの性能計測
+    benchmark_work_stealing();
+    // ロックの性能計測
+    benchmark_locks();
+    // アイドル時の停止とティックレスタイマーの計測
+    benchmark_idle();
+    // 待ち行列を使う同期機構の性能計測
+    benchmark_producer_consumer();
+    // スレッドの作成・合流の性能計測
+    benchmark_thread_churn();
+    // ユーザーモードのプロセスとシステムコールの性能計測
+    benchmark_processes();
+    // ELFの読み込み(複写と直接の対応付け)の性能計測
+    benchmark_elf_loading();
+    // forkの性能計測 (全ページの複写とコピーオンライト)
+    benchmark_fork();
+    // 要求時のページ割り当て(ヒープ・無名の対応付け・スタック)の確認
+    benchmark_demand_paging();
+    // ASIDによるプロセスの切り替えの性能計測
+    benchmark_asid();
+    // カーネルのヒープ(kmalloc)の性能計測
+    benchmark_kmalloc();
+#endif
+    // プロファイル用のカウンタの表示
+    profile_dump();
+    // 無限ループ (UARTから受信した文字をそのまま表示し、Ctrl-Pでプロファイル用のカウンタを表示する)
+    // 受信がない間はidle_waitで停止し、UARTの受信割り込みで起きる
+    start_hart_timer();
     for (;;)
-        ;
+    {
+        int ch = uart_getchar();
+        if (ch == PROFILE_DUMP_KEY)
+        {
+            profile_dump();
+        }
+        else if (ch >= 0)
+        {
+            putchar(ch);
+            console_flush();
+        }
+        else
+        {
+            idle_wait(hart);
+            schedule_threads();
+        }
+    }
 }
 /**
  * @brief エントリー関数
@@ -532,9 +8067,20 @@ boot(void)
         :  破壊されるレジスタのリスト                    <レジスタの値が変更されてしまい、影響を与えてしまう項目>
     */
     __asm__ __volatile__(
-        "mv sp, %0\n"                          /* boot_stackの末端をスタックポインタへ設定 */
-        "call kernel_main\n"                   /* karnel_mainを呼び出す */
-        :                                      /* 出力オペランドはなし */
-        : "r"(&boot_stack[sizeof(boot_stack)]) /* スタックの末端アドレスを汎用レジスタに設定(スタックは末端から使用される) */
+        "la t0, __bss\n"        /* .bssの先頭アドレス (4バイト境界) */
+        "la t1, __bss_end\n"    /* .bssの末尾アドレス (4バイト境界) */
+        "1:\n"                  /* .bssを0クリア (初期値なしのグローバル変数を0にする。boot_stackも含むため、呼び出し前に行う) */
+        "bgeu t0, t1, 2f\n"     /* 末尾まで書き込んだら終了 */
+        "sw zero, 0(t0)\n"      /* 1ワード(4バイト)を0にする */
+        "addi t0, t0, 4\n"      /* 次のワードへ */
+        "j 1b\n"                /* 繰り返し */
+        "2:\n"
+        "la sp, boot_stack\n"   /* boot_stackの先頭アドレスを設定 (a0のハートIDを壊さないよう、spだけを使う) */
+        "li t0, %0\n"           /* スタックサイズ */
+        "add sp, sp, t0\n"      /* boot_stackの末端をスタックポインタへ設定 (スタックは末端から使用される) */
+        "andi sp, sp, -16\n"    /* RISC-Vの呼び出し規約に合わせて16バイト境界に揃える */
+        "call kernel_main\n"    /* karnel_mainを呼び出す (a0はOpenSBIが渡すハートID) */
+        :                       /* 出力オペランドはなし */
+        : "i"(STACK_SIZE)       /* スタックサイズを即値で渡す */
         :);
 }
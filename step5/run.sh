@@ -14,7 +14,12 @@ set -xue
 # -Wl,<arg> : リンカにカンマ区切りの引数を渡す。今回の場合、kernel.ld
 CC=/opt/homebrew/opt/llvm/bin/clang
 CFLAGS="-std=c11 -O2 -g3 -Wall -Wextra --target=riscv32 -ffreestanding -nostdlib"
-$CC $CFLAGS -Wl,-Tkernel.ld -o kernel.elf kernel.c 
+# ユーザープログラム(user.c)を、(-Tオプション)のリンカスクリプト(user.ld)でユーザー領域に配置したELF形式のファイルにする
+# user.elfは、kernel.cの.incbinでカーネルイメージの初期RAMディスク(.initrdセクション)へ取り込むため、先にビルドする
+$CC $CFLAGS -Wl,-Tuser.ld -o user.elf user.c
+# -DBENCHMARK_ENABLE=1 : 起動時に性能計測を全て実行する (BENCH=0 ./run.shで計測を省いて起動する)
+BENCH=${BENCH:-1}
+$CC $CFLAGS -DBENCHMARK_ENABLE=$BENCH -Wl,-Tkernel.ld -o kernel.elf kernel.c 
 
 #### qemuの設定・操作 ####
 # qemuの起動:デフォルトのbios起動(OpenSBI)で実施
@@ -22,7 +27,10 @@ $CC $CFLAGS -Wl,-Tkernel.ld -o kernel.elf kernel.c
 # "ctrl-a x"で強制停止
 # "ctrl-a c"でコンソールとモニタの切り替えが可能
 # qemuの終了: "(qemu) q"
-qemu-system-riscv32 -machine virt -bios default -nographic -serial mon:stdio \
+# -m : RAMのサイズ (kernel.ldの空きメモリ領域の末尾と合わせる)
+# -smp : ハート(CPUコア)の数 (kernel.cのHART_MAX以下。例: SMP=8 ./run.sh)
+SMP=${SMP:-4}
+qemu-system-riscv32 -machine virt -bios default -nographic -serial mon:stdio -m 128M -smp $SMP \
  -kernel kernel.elf
 
 #### ターミナルでのコマンド集 ####
@@ -36,6 +44,13 @@ qemu-system-riscv32 -machine virt -bios default -nographic -serial mon:stdio \
 # (qemu) info registers
 # プログラムカウンタ(pc)のレジスタを確認(8020000c)
 
+### アイドル時のホストのCPU使用率を確認 (別のターミナルで実行) ###
+# 起動後の計測が終わり、入力待ちになってから確認する
+# アイドル中のハートはwfiで停止するため、nopで回り続ける場合(-smpの数×100%)より大きく下がる
+# top -pid $(pgrep -n qemu-system-riscv32)     (macOS)
+# top -p $(pgrep -n qemu-system-riscv32)       (Linux)
+# ps -o %cpu= -p $(pgrep -n qemu-system-riscv32)
+
 ### ここからはqemuを(qemu) qで終了し、実行モジュールの情報をllvm関連のコマンドで確認 ###
 
 ## アドレスに関連づけているファイル名と行番号を取得 (実行ファイルは、-eオプションで確認) ##
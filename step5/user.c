@@ -0,0 +1,118 @@
+/**
+ * @brief ユーザープログラム (ELF)
+ * @details run.shでuser.ldを使ってuser.elfにビルドし、kernel.cの初期RAMディスク(.initrdセクション)へ取り込む
+ *          カーネルはELFのPT_LOADのセグメントをプロセスのユーザー領域へ読み込み、_startから実行する
+ *          カーネルの関数・変数は参照できないため、システムコールだけでカーネルとやり取りする
+ */
+
+/**
+ * @brief システムコール番号 (kernel.cのSYS_*と合わせる)
+ */
+#define SYS_GETPID 0 // 自プロセスのIDを返す
+#define SYS_WRITE 2  // ユーザー領域の文字列をコンソールへ出力する (a0:1(標準出力), a1:アドレス, a2:バイト数)
+#define SYS_EXIT 3   // プロセスを終了する (a0:終了コード)
+
+/**
+ * @brief 読み込みの確認用の変数(グローバル変数)
+ * @note g_counterは.data(プロセスごとに複写)、g_bufferは.bss(読み込み時に0クリア)に置かれる
+ */
+int g_counter = 41;  // 初期値ありの変数
+char g_buffer[128]; // 初期値なしの変数 (表示する1行を組み立てる)
+
+/**
+ * @brief システムコールの呼び出し
+ * @param num  : システムコール番号 (a7)
+ * @param arg0 : 引数0 (a0)
+ * @param arg1 : 引数1 (a1)
+ * @param arg2 : 引数2 (a2)
+ * @return システムコールの戻り値 (a0)
+ */
+int syscall(int num, int arg0, int arg1, int arg2)
+{
+    register int a0 __asm__("a0") = arg0;
+    register int a1 __asm__("a1") = arg1;
+    register int a2 __asm__("a2") = arg2;
+    register int a7 __asm__("a7") = num;
+    __asm__ __volatile__(
+        "ecall\n"
+        : "+r"(a0), "+r"(a1), "+r"(a2), "+r"(a7)
+        :
+        : "t0", "t1", "t2", "t3", "t4", "t5", "t6", "a3", "a4", "a5", "a6", "memory");
+    return a0;
+}
+
+/**
+ * @brief 文字列の追加
+ * @param pos : g_bufferの書き込み位置
+ * @param s   : 追加する文字列
+ * @return 追加後の書き込み位置
+ */
+unsigned int append_str(unsigned int pos, const char *s)
+{
+    while ((*s != '\0') && (pos < sizeof(g_buffer)))
+    {
+        g_buffer[pos++] = *s++;
+    }
+    return pos;
+}
+
+/**
+ * @brief 符号なし整数(10進数)の追加
+ * @param pos : g_bufferの書き込み位置
+ * @param n   : 追加する値
+ * @return 追加後の書き込み位置
+ */
+unsigned int append_uint(unsigned int pos, unsigned int n)
+{
+    char digits[12];
+    int i = sizeof(digits);
+    digits[--i] = '\0';
+    do
+    {
+        digits[--i] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    return append_str(pos, &digits[i]);
+}
+
+/**
+ * @brief メイン関数
+ * @param argc : 引数の数
+ * @param argv : 引数 (argv[0]はプログラム名)
+ * @return 終了コード
+ * @details .dataの初期値と.bssの0クリアを確認し、1行にまとめて表示する
+ */
+int main(int argc, char **argv)
+{
+    int pid = syscall(SYS_GETPID, 0, 0, 0);
+    g_counter++;
+    unsigned int pos = 0;
+    pos = append_str(pos, "hello from ");
+    pos = append_str(pos, (argc > 0) ? argv[0] : "?");
+    pos = append_str(pos, " (ELF): pid ");
+    pos = append_uint(pos, (unsigned int)pid);
+    pos = append_str(pos, ", data ");
+    pos = append_uint(pos, (unsigned int)g_counter);
+    pos = append_str(pos, ", bss ");
+    pos = append_uint(pos, (unsigned int)g_buffer[sizeof(g_buffer) - 1]);
+    pos = append_str(pos, "\n");
+    syscall(SYS_WRITE, 1, (int)g_buffer, (int)pos);
+    return 0;
+}
+
+/**
+ * @brief エントリーポイント
+ * @details カーネルはスタックにargc・argv[0]・argv[1](NULL)を置いてから、ここへ移る
+ *          mainの戻り値を終了コードとしてプロセスを終了する
+ */
+__attribute__((naked, section(".text.start"))) void _start(void)
+{
+    __asm__ __volatile__(
+        "lw a0, 0(sp)\n"   // argc
+        "addi a1, sp, 4\n" // argv
+        "call main\n"
+        "li a7, %0\n" // mainの戻り値(a0)を終了コードとする
+        "ecall\n"
+        :
+        : "i"(SYS_EXIT));
+}